@@ -0,0 +1,278 @@
+/*
+ Simple HTTP Get Library
+ Copyright (C) 2021 Ahmet Öztürk
+ Version 0.1
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Benchmarks of http_get, https_get and http_get_with_thread against the loopback server in server.c.
+ *
+ * Usage: bench <ca file> [requests]
+ *
+ * The library has to be built with HTTP_PORT and HTTPS_PORT set to the ports of the server. Every benchmark reports
+ * the request rate, latency percentiles, the CPU time per request of this process and its peak resident set size. The
+ * results are written to stdout as JSON, progress and failures go to stderr. The exit status is non-zero if a request
+ * failed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "../src/socket.h"
+
+#define BENCH_HOST "localhost"
+#define BENCH_DEFAULT_REQUESTS 2000
+#define BENCH_THREAD_WORKERS 4
+#define BENCH_THREAD_QUEUE 64
+#define BENCH_SERVER_WAIT_MS 5000
+
+enum bench_api {
+	BenchApi_HttpGet,
+	BenchApi_HttpsGet,
+	BenchApi_HttpGetWithThread,
+	BenchApi_HttpsGetWithThread,
+};
+
+/** \brief A benchmark, running @p requests requests of the same target */
+struct bench_case {
+	char const *name; /**< @brief Name in the report */
+	enum bench_api api; /**< @brief Function under test */
+	char const *file; /**< @brief Request target, see server.c */
+	size_t body_size; /**< @brief Expected body length */
+	unsigned divisor; /**< @brief The number of requests is divided by this value for slow cases */
+};
+
+static struct bench_case const bench_cases[] = {
+	{"http_get_128B", BenchApi_HttpGet, "/size/128", 128, 1},
+	{"http_get_64KiB", BenchApi_HttpGet, "/size/65536", 65536, 1},
+	{"http_get_1MiB", BenchApi_HttpGet, "/size/1048576", 1048576, 10},
+	{"http_get_64KiB_chunked", BenchApi_HttpGet, "/size/65536?chunked=4096", 65536, 1},
+	{"http_get_128B_close", BenchApi_HttpGet, "/size/128?close", 128, 1},
+	{"http_get_128B_delay_1ms", BenchApi_HttpGet, "/size/128?delay=1", 128, 4},
+	{"https_get_128B", BenchApi_HttpsGet, "/size/128", 128, 1},
+	{"https_get_64KiB", BenchApi_HttpsGet, "/size/65536", 65536, 1},
+	{"https_get_1MiB", BenchApi_HttpsGet, "/size/1048576", 1048576, 10},
+	{"https_get_128B_close", BenchApi_HttpsGet, "/size/128?close", 128, 4},
+	{"http_get_with_thread_128B", BenchApi_HttpGetWithThread, "/size/128", 128, 1},
+	{"http_get_with_thread_64KiB", BenchApi_HttpGetWithThread, "/size/65536", 65536, 1},
+	{"http_get_with_thread_128B_delay_1ms", BenchApi_HttpGetWithThread, "/size/128?delay=1", 128, 1},
+	{"https_get_with_thread_64KiB", BenchApi_HttpsGetWithThread, "/size/65536", 65536, 1},
+};
+
+static char const *const bench_api_names[] = {"http_get", "https_get", "http_get_with_thread", "http_get_with_thread"};
+
+/** \brief Results of the running benchmark, shared with the callback of http_get_with_thread */
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int64_t *latencies; /**< @brief Latency of every request in microseconds */
+	size_t completed;
+	size_t failed;
+	size_t body_size;
+} bench_run = {.lock = PTHREAD_MUTEX_INITIALIZER, .done = PTHREAD_COND_INITIALIZER};
+
+/** \brief Returns a monotonic time stamp in microseconds */
+static int64_t bench_now_us(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/** \brief Returns the CPU time of this process in microseconds, user and system */
+static int64_t bench_cpu_us(struct rusage const *usage) {
+	return (int64_t) (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000 + usage->ru_utime.tv_usec
+			+ usage->ru_stime.tv_usec;
+}
+
+/** \brief Checks a response and reports a failure
+ *
+ * \param data struct HttpData* response
+ * \param expected size_t expected body length
+ * \return bool true if the response is as expected
+ *
+ */
+static bool bench_check(struct HttpData const *data, size_t expected) {
+	if (data->error == EError_NoError && data->http_code == 200 && data->received_data_length == expected)
+		return true;
+	fprintf(stderr, "Request failed: error %d, code %d, %zu of %zu bytes\n", data->error, data->http_code,
+			data->received_data_length, expected);
+	return false;
+}
+
+/** \brief Records a finished request of http_get_with_thread
+ * \details The latency is taken from the timing of the library, as the queue of the thread pool does not keep the
+ order of the requests. It includes the time the request waited in the queue.
+ *
+ * \param thread pthread_t unused
+ * \param data struct HttpData response
+ * \return void
+ *
+ */
+static void bench_thread_callback(pthread_t thread, struct HttpData data) {
+	(void) thread;
+	bool ok = bench_check(&data, bench_run.body_size);
+	pthread_mutex_lock(&bench_run.lock);
+	bench_run.latencies[bench_run.completed++] = data.timing.queued_us + data.timing.total_us;
+	bench_run.failed += !ok;
+	pthread_cond_signal(&bench_run.done);
+	pthread_mutex_unlock(&bench_run.lock);
+	http_data_free(&data);
+}
+
+/** \brief Runs one request with http_get or https_get
+ *
+ * \param https bool use https_get
+ * \param file char const* request target
+ * \param body_size size_t expected body length
+ * \return bool true on success
+ *
+ */
+static bool bench_request(bool https, char const *file, size_t body_size) {
+	struct HttpData data = https ? https_get(BENCH_HOST, file, 0, 0) : http_get(BENCH_HOST, file, 0, 0);
+	bool ok = bench_check(&data, body_size);
+	http_data_free(&data);
+	return ok;
+}
+
+static int bench_compare(void const *a, void const *b) {
+	int64_t x = *(int64_t const*) a, y = *(int64_t const*) b;
+	return (x > y) - (x < y);
+}
+
+/** \brief Returns a percentile of sorted latencies, using the nearest rank */
+static int64_t bench_percentile(int64_t const *sorted, size_t count, double percentile) {
+	size_t rank = (size_t) (percentile * count + 0.999999);
+	return sorted[rank ? rank - 1 : 0];
+}
+
+/** \brief Runs a benchmark and prints its JSON object
+ *
+ * \param bench struct bench_case const* benchmark
+ * \param requests size_t number of requests
+ * \param first bool this is the first object of the array
+ * \return bool true if all requests succeeded
+ *
+ */
+static bool bench_execute(struct bench_case const *bench, size_t requests, bool first) {
+	bool threaded = bench->api == BenchApi_HttpGetWithThread || bench->api == BenchApi_HttpsGetWithThread;
+	bool https = bench->api == BenchApi_HttpsGet || bench->api == BenchApi_HttpsGetWithThread;
+	enum HttpCommand command = https ? HttpCommand_GetHttps : HttpCommand_GetHttp;
+
+	bench_run.completed = bench_run.failed = 0;
+	bench_run.body_size = bench->body_size;
+	// Only the thread pool benchmarks need the timing of the library for their latencies
+	http_set_timing(threaded);
+	// Warm up the connection pool and the TLS session cache
+	for (int i = 0; i < BENCH_THREAD_WORKERS; i++)
+		bench_request(https, "/size/0", 0);
+
+	fprintf(stderr, "%s: %zu requests\n", bench->name, requests);
+	struct rusage usage_start, usage_end;
+	getrusage(RUSAGE_SELF, &usage_start);
+	int64_t start = bench_now_us();
+	if (threaded) {
+		for (size_t i = 0; i < requests; i++)
+			if (http_get_with_thread(command, BENCH_HOST, bench->file, 0, 0, 0, bench_thread_callback)) {
+				pthread_mutex_lock(&bench_run.lock);
+				bench_run.latencies[bench_run.completed++] = 0;
+				bench_run.failed++;
+				pthread_mutex_unlock(&bench_run.lock);
+			}
+		pthread_mutex_lock(&bench_run.lock);
+		while (bench_run.completed < requests)
+			pthread_cond_wait(&bench_run.done, &bench_run.lock);
+		pthread_mutex_unlock(&bench_run.lock);
+	} else {
+		for (size_t i = 0; i < requests; i++) {
+			int64_t request_start = bench_now_us();
+			bench_run.failed += !bench_request(https, bench->file, bench->body_size);
+			bench_run.latencies[bench_run.completed++] = bench_now_us() - request_start;
+		}
+	}
+	int64_t elapsed = bench_now_us() - start;
+	getrusage(RUSAGE_SELF, &usage_end);
+
+	qsort(bench_run.latencies, requests, sizeof(*bench_run.latencies), bench_compare);
+	printf("%s\n    {\"name\": \"%s\", \"api\": \"%s\", \"https\": %s, \"target\": \"%s\", \"body_bytes\": %zu, "
+			"\"requests\": %zu, \"errors\": %zu, \"seconds\": %.6f, \"requests_per_second\": %.1f, "
+			"\"latency_us\": {\"p50\": %lld, \"p99\": %lld, \"p999\": %lld, \"max\": %lld}, "
+			"\"cpu_us_per_request\": %.2f, \"peak_rss_kb\": %ld}", first ? "" : ",", bench->name,
+			bench_api_names[bench->api], https ? "true" : "false",
+			bench->file, bench->body_size, requests, bench_run.failed, elapsed / 1e6, requests * 1e6 / (elapsed ? elapsed : 1),
+			(long long) bench_percentile(bench_run.latencies, requests, 0.5),
+			(long long) bench_percentile(bench_run.latencies, requests, 0.99),
+			(long long) bench_percentile(bench_run.latencies, requests, 0.999),
+			(long long) bench_run.latencies[requests - 1],
+			(double) (bench_cpu_us(&usage_end) - bench_cpu_us(&usage_start)) / requests, usage_end.ru_maxrss);
+	fflush(stdout);
+	return !bench_run.failed;
+}
+
+/** \brief Waits until the server accepts requests
+ *
+ * \return bool true if the server answered in time
+ *
+ */
+static bool bench_wait_for_server(void) {
+	int64_t deadline = bench_now_us() + BENCH_SERVER_WAIT_MS * 1000;
+	do {
+		struct HttpData data = http_get(BENCH_HOST, "/size/0", 0, 0);
+		bool ok = data.error == EError_NoError && data.http_code == 200;
+		http_data_free(&data);
+		if (ok)
+			return true;
+		nanosleep(&(struct timespec) {.tv_nsec = 50000000}, 0);
+	} while (bench_now_us() < deadline);
+	return false;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: %s <ca file> [requests]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	size_t requests = argc == 3 ? strtoul(argv[2], 0, 10) : BENCH_DEFAULT_REQUESTS;
+	if (!requests || !https_set_ca_locations(argv[1], 0)) {
+		fprintf(stderr, "Invalid request count or ca file\n");
+		return EXIT_FAILURE;
+	}
+	if (!bench_wait_for_server()) {
+		fprintf(stderr, "The benchmark server on %s is not reachable\n", BENCH_HOST);
+		return EXIT_FAILURE;
+	}
+	http_thread_pool_configure(BENCH_THREAD_WORKERS, BENCH_THREAD_QUEUE, HttpQueuePolicy_Block);
+	bench_run.latencies = malloc(requests * sizeof(*bench_run.latencies));
+	if (!bench_run.latencies)
+		return EXIT_FAILURE;
+
+	bool ok = true;
+	printf("{\n  \"library\": \"SimpleHTTPGet\",\n  \"timestamp\": %lld,\n  \"benchmarks\": [", (long long) time(0));
+	for (size_t i = 0; i < sizeof(bench_cases) / sizeof(*bench_cases); i++) {
+		size_t count = requests / bench_cases[i].divisor;
+		ok &= bench_execute(&bench_cases[i], count ? count : 1, !i);
+	}
+	printf("\n  ]\n}\n");
+
+	http_thread_pool_shutdown();
+	http_pool_cleanup();
+	free(bench_run.latencies);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,650 @@
+/*
+ Simple HTTP Get Library
+ Copyright (C) 2021 Ahmet Öztürk
+ Version 0.1
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Loopback checks of the response handling against the server in server.c.
+ *
+ * Usage: check <ca file>
+ *
+ * The library and this program have to be built with HTTP_PORT and HTTPS_PORT set to the ports of the server. Every check prints a
+ * line, the exit status is non-zero if one of them failed.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "../src/socket.h"
+
+#define CHECK_HOST "localhost"
+#ifndef HTTP_PORT
+#define HTTP_PORT 80
+#endif
+#define CHECK_SERVER_WAIT_MS 5000
+#define CHECK_CHAIN_WAIT_MS 20000
+#define CHECK_CHAIN_REQUESTS 2000
+#define CHECK_DNS_SLOW_MS 300
+#define CHECK_BLACKHOLE_ADDRESS "127.0.0.2" // Not served by the server, so a listener with a full backlog fits there
+#define CHECK_CONNECT_RACE_MS 1000
+
+static unsigned check_failures;
+
+/** \brief Reports the result of a check
+ *
+ * \param ok bool result
+ * \param name char const* description of the check
+ * \param data struct HttpData const* response of the check, may be 0
+ * \return bool @p ok
+ *
+ */
+static bool check_report(bool ok, char const *name, struct HttpData const *data) {
+	if (data)
+		printf("%-4s %s (error %d, code %d, %zu bytes)\n", ok ? "ok" : "FAIL", name, data->error, data->http_code,
+				data->received_data_length);
+	else
+		printf("%-4s %s\n", ok ? "ok" : "FAIL", name);
+	check_failures += !ok;
+	return ok;
+}
+
+/** \brief Checks that a body consists of the bytes generated by the server */
+static bool check_body(char const *data, size_t length) {
+	for (size_t i = 0; i < length; i++)
+		if (data[i] != 'a' + (char) (i % 26))
+			return false;
+	return true;
+}
+
+/** \brief Checks that a response succeeded with the expected body
+ *
+ * \param data struct HttpData* response, released by this function
+ * \param name char const* description of the check
+ * \param size size_t expected body length
+ * \return bool true if the response is as expected
+ *
+ */
+static bool check_response(struct HttpData *data, char const *name, size_t size) {
+	bool ok = data->error == EError_NoError && data->http_code == 200 && data->received_data_length == size
+			&& data->data && check_body(data->data, size);
+	check_report(ok, name, data);
+	http_data_free(data);
+	return ok;
+}
+
+/** \brief Checks that a response failed with @p error
+ *
+ * \param data struct HttpData* response, released by this function
+ * \param name char const* description of the check
+ * \param error enum EError expected error
+ * \return bool true if the response is as expected
+ *
+ */
+static bool check_error(struct HttpData *data, char const *name, enum EError error) {
+	bool ok = data->error == error;
+	check_report(ok, name, data);
+	http_data_free(data);
+	return ok;
+}
+
+/** \brief Requests @p file over HTTP or HTTPS
+ *
+ * \param https bool use https_get
+ * \param file char const* request target
+ * \return struct HttpData response
+ *
+ */
+static struct HttpData check_get(bool https, char const *file) {
+	return https ? https_get(CHECK_HOST, file, 0, 0) : http_get(CHECK_HOST, file, 0, 0);
+}
+
+/** \brief Interim 1xx responses are skipped and the connection stays in sync with the requests */
+static void check_interim_responses(bool https) {
+	char name[100];
+	for (int i = 0; i < 3; i++) {
+		struct HttpData data = check_get(https, "/size/10?interim");
+		snprintf(name, sizeof(name), "%s 100 and 103 before the response, request %d", https ? "https" : "http", i);
+		check_response(&data, name, 10);
+		data = check_get(https, "/size/20");
+		snprintf(name, sizeof(name), "%s next request on the connection, request %d", https ? "https" : "http", i);
+		check_response(&data, name, 20);
+	}
+
+	struct HttpRequest requests[] = {
+		{HttpCommand_GetHttp, CHECK_HOST, "/size/10?interim"},
+		{HttpCommand_GetHttp, CHECK_HOST, "/size/20"},
+		{HttpCommand_GetHttp, CHECK_HOST, "/size/30?interim&chunked=7"},
+		{HttpCommand_GetHttp, CHECK_HOST, "/size/40"},
+	};
+	size_t const count = sizeof(requests) / sizeof(*requests);
+	struct HttpData results[sizeof(requests) / sizeof(*requests)];
+	for (size_t i = 0; i < count; i++)
+		requests[i].command = https ? HttpCommand_GetHttps : HttpCommand_GetHttp;
+	if (!check_report(http_get_pipelined(requests, results, count, count, 0), "pipelined requests started", 0))
+		return;
+	for (size_t i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "%s pipelined %s", https ? "https" : "http", requests[i].file);
+		check_response(&results[i], name, 10 * (i + 1));
+	}
+}
+
+/** \brief Chunked bodies of several sizes and chunk sizes are decoded */
+static void check_chunked(bool https) {
+	static size_t const sizes[] = {0, 1, 100, 65536, 300000};
+	static unsigned const chunks[] = {1, 7, 4096, 65536};
+	char file[100], name[160];
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++)
+		for (size_t j = 0; j < sizeof(chunks) / sizeof(*chunks); j++) {
+			if (chunks[j] == 1 && sizes[i] > 100000)
+				continue;
+			snprintf(file, sizeof(file), "/size/%zu?chunked=%u", sizes[i], chunks[j]);
+			snprintf(name, sizeof(name), "%s chunked %s", https ? "https" : "http", file);
+			struct HttpData data = check_get(https, file);
+			check_response(&data, name, sizes[i]);
+		}
+}
+
+/** \brief Malformed and conflicting Content-Length headers are rejected, huge values do not allocate their size */
+static void check_content_length(void) {
+	static struct {
+		char const *file;
+		enum EError error;
+	} const cases[] = {
+		{"/size/4?length=18446744073709551620", EError_InvalidResponse},
+		{"/size/4?length=4x", EError_InvalidResponse},
+		{"/size/4?length=", EError_InvalidResponse},
+		{"/size/4?length=-4", EError_InvalidResponse},
+		{"/size/4?length=4&length2=5", EError_InvalidResponse},
+		{"/size/4?length=4&length2=4", EError_NoError},
+		{"/size/4?length=1000000000000&close", EError_IncompleteResponse},
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		char name[160];
+		snprintf(name, sizeof(name), "Content-Length %s", cases[i].file);
+		struct HttpData data = http_get(CHECK_HOST, cases[i].file, 0, 0);
+		check_error(&data, name, cases[i].error);
+	}
+	struct HttpData data = http_get(CHECK_HOST, "/size/50", 0, 0);
+	check_response(&data, "request after rejected responses", 50);
+}
+
+/** \brief A body which cannot be written to its destination aborts the transfer, also if it ends with the connection
+ * \details The destinations are /dev/full, which fails with ENOSPC, and a pipe without reader, which fails with EPIPE.
+ */
+static void check_fd_write_failure(bool https) {
+	static char const *const files[] = {"/size/300000", "/size/300000?eof"};
+	char name[120];
+	for (int destination = 0; destination < 2; destination++)
+		for (size_t i = 0; i < sizeof(files) / sizeof(*files); i++) {
+			int fds[2] = {-1, -1};
+			if (destination == 0)
+				fds[1] = open("/dev/full", O_WRONLY | O_CLOEXEC);
+			else if (!pipe(fds))
+				close(fds[0]);
+			snprintf(name, sizeof(name), "%s %s written to %s", https ? "https" : "http", files[i],
+					destination ? "a closed pipe" : "/dev/full");
+			if (fds[1] < 0) {
+				check_report(false, name, 0);
+				continue;
+			}
+			struct HttpData data = https ? https_get_to_fd(CHECK_HOST, files[i], 0, 0, fds[1])
+					: http_get_to_fd(CHECK_HOST, files[i], 0, 0, fds[1]);
+			check_error(&data, name, EError_Aborted);
+			close(fds[1]);
+		}
+}
+
+/** \brief A connection with bytes behind the response is not reused */
+static void check_trailing_garbage(bool https) {
+	static char const *const files[] = {"/size/10?extra=5", "/size/10?extra=10000", "/size/10?chunked=3&extra=10000"};
+	char name[100];
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); i++) {
+		struct HttpData data = check_get(https, files[i]);
+		snprintf(name, sizeof(name), "%s garbage behind %s", https ? "https" : "http", files[i]);
+		check_response(&data, name, 10);
+		data = check_get(https, "/size/20");
+		snprintf(name, sizeof(name), "%s next request after %s", https ? "https" : "http", files[i]);
+		check_response(&data, name, 20);
+	}
+}
+
+/** \brief A batch to one host shares a few connections instead of opening one per request */
+static void check_batch_connections(bool https) {
+	enum { count = 200, max_connections = 6 };
+	struct HttpRequest requests[count];
+	struct HttpData results[count];
+	char name[100];
+	for (size_t i = 0; i < count; i++)
+		requests[i] = (struct HttpRequest) {https ? HttpCommand_GetHttps : HttpCommand_GetHttp, CHECK_HOST,
+				"/size/100?delay=1"};
+	size_t misses = http_pool_get_stats().misses;
+	if (!check_report(http_get_many(requests, results, count, 0, 0), "batch started", 0))
+		return;
+	size_t failed = 0;
+	for (size_t i = 0; i < count; i++) {
+		failed += results[i].error != EError_NoError || results[i].received_data_length != 100
+				|| !check_body(results[i].data, 100);
+		http_data_free(&results[i]);
+	}
+	snprintf(name, sizeof(name), "%s batch of %d requests to one host, %zu failed", https ? "https" : "http", count,
+			failed);
+	check_report(!failed, name, 0);
+	misses = http_pool_get_stats().misses - misses;
+	snprintf(name, sizeof(name), "%s batch opened %zu connections, at most %d", https ? "https" : "http", misses,
+			max_connections);
+	check_report(misses <= max_connections, name, 0);
+}
+
+/** \brief Connections and TLS sessions established without verification are not reused once it is enabled
+ * \details Needs to run before the certificate of the server is trusted.
+ */
+static void check_verification_reuse(void) {
+	static char const *const files[] = {"/size/10", "/size/10?close"};
+	static char const *const names[] = {"pooled connection", "resumed session"};
+	char name[100];
+	for (size_t i = 0; i < sizeof(files) / sizeof(*files); i++) {
+		https_set_verification(false);
+		struct HttpData data = https_get(CHECK_HOST, files[i], 0, 0);
+		snprintf(name, sizeof(name), "unverified request before a %s", names[i]);
+		check_response(&data, name, 10);
+		https_set_verification(true);
+		data = https_get(CHECK_HOST, "/size/10", 0, 0);
+		snprintf(name, sizeof(name), "untrusted certificate rejected despite a %s", names[i]);
+		check_error(&data, name, EError_CertificateError);
+	}
+}
+
+static atomic_uint check_chain_submitted; /**< @brief Requests of check_callback_chains submitted so far */
+static atomic_uint check_chain_completed;
+static atomic_uint check_chain_rejected; /**< @brief Follow-up requests rejected, each one ends its chain */
+static atomic_uint check_chain_ended; /**< @brief Chains which submit no further request */
+static atomic_uint check_chain_failed;
+static atomic_uint check_chain_max_depth; /**< @brief Deepest nesting of callbacks on one worker */
+static _Thread_local unsigned check_chain_depth;
+
+/** \brief Callback of check_callback_chains, submits the next request of the chain from the worker */
+static void check_chain_callback(pthread_t thread_id, struct HttpData data) {
+	(void) thread_id;
+	enum { total = CHECK_CHAIN_REQUESTS };
+	unsigned depth = ++check_chain_depth, max = atomic_load(&check_chain_max_depth);
+	while (depth > max && !atomic_compare_exchange_weak(&check_chain_max_depth, &max, depth))
+		;
+	atomic_fetch_add(&check_chain_failed, data.error != EError_NoError || data.received_data_length != 10);
+	http_data_free(&data);
+	atomic_fetch_add(&check_chain_completed, 1);
+	if (atomic_fetch_add(&check_chain_submitted, 1) >= total)
+		atomic_fetch_add(&check_chain_ended, 1);
+	else if (http_get_with_thread(HttpCommand_GetHttp, CHECK_HOST, "/size/10?delay=1", 0, 0, 0, check_chain_callback)) {
+		atomic_fetch_add(&check_chain_rejected, 1);
+		atomic_fetch_add(&check_chain_ended, 1);
+	}
+	check_chain_depth--;
+}
+
+/** \brief Callbacks queueing follow-up requests into a full blocking queue neither deadlock the workers nor nest
+ without bound
+ * \details The chains fill the workers and the queue, every completed request submits the next one from its callback
+ until CHECK_CHAIN_REQUESTS requests have been submitted. The workers make the follow-ups themselves, up to 8 nested,
+ beyond that a follow-up is rejected and its chain ends.
+ */
+static void check_callback_chains(void) {
+	enum { workers = 2, chains = 3, total = CHECK_CHAIN_REQUESTS, max_depth = 8 + 1 };
+	char name[160];
+	http_thread_pool_shutdown();
+	if (!check_report(http_thread_pool_configure(workers, 1, HttpQueuePolicy_Block), "thread pool configured", 0))
+		return;
+	atomic_store(&check_chain_submitted, chains);
+	atomic_store(&check_chain_completed, 0);
+	atomic_store(&check_chain_rejected, 0);
+	atomic_store(&check_chain_ended, 0);
+	atomic_store(&check_chain_failed, 0);
+	atomic_store(&check_chain_max_depth, 0);
+	for (int i = 0; i < chains; i++)
+		if (http_get_with_thread(HttpCommand_GetHttp, CHECK_HOST, "/size/10?delay=1", 0, 0, 0, check_chain_callback)) {
+			atomic_fetch_add(&check_chain_failed, 1);
+			atomic_fetch_add(&check_chain_ended, 1);
+		}
+	for (int waited = 0; atomic_load(&check_chain_ended) < chains && waited < CHECK_CHAIN_WAIT_MS; waited += 10)
+		nanosleep(&(struct timespec) {.tv_nsec = 10000000}, 0);
+	unsigned completed = atomic_load(&check_chain_completed), rejected = atomic_load(&check_chain_rejected);
+	unsigned failed = atomic_load(&check_chain_failed), depth = atomic_load(&check_chain_max_depth);
+	snprintf(name, sizeof(name), "callbacks submitting to a full queue of %d workers, %u of %d completed, %u rejected, "
+			"%u failed", workers, completed, total, rejected, failed);
+	// Every rejection ends a chain, the last chain has to submit all remaining requests
+	bool ok = atomic_load(&check_chain_ended) == chains && completed + rejected == total && rejected < chains;
+	if (!check_report(ok && !failed, name, 0))
+		return; // Shutting down deadlocked workers would hang
+	snprintf(name, sizeof(name), "callbacks nested %u deep on a worker, at most %d", depth, max_depth);
+	check_report(depth <= max_depth, name, 0);
+	http_thread_pool_shutdown();
+}
+
+static pthread_mutex_t check_dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t check_dns_cond = PTHREAD_COND_INITIALIZER;
+static bool check_dns_released; /**< @brief Lets the resolutions of stuck.test finish */
+static unsigned check_dns_stuck; /**< @brief Number of resolutions of stuck.test which have not finished yet */
+static atomic_uint check_dns_calls;
+
+/** \brief Builds a list of IPv4 addresses like getaddrinfo, to be released with check_dns_free
+ *
+ * \param addresses char const*const* numeric addresses
+ * \param count size_t number of @p addresses
+ * \param res struct addrinfo** receives the list
+ * \return int 0 or EAI_MEMORY
+ *
+ */
+static int check_dns_list(char const *const *addresses, size_t count, struct addrinfo **res) {
+	*res = 0;
+	for (size_t i = count; i-- > 0;) {
+		struct addrinfo *ai = calloc(1, sizeof(struct addrinfo) + sizeof(struct sockaddr_in));
+		if (!ai)
+			return EAI_MEMORY;
+		struct sockaddr_in *address = (struct sockaddr_in*) (ai + 1);
+		address->sin_family = AF_INET;
+		inet_pton(AF_INET, addresses[i], &address->sin_addr);
+		*ai = (struct addrinfo) {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM, .ai_addrlen = sizeof(*address),
+				.ai_addr = (struct sockaddr*) address, .ai_next = *res};
+		*res = ai;
+	}
+	return 0;
+}
+
+/** \brief Releases a list of check_dns_list */
+static void check_dns_free(struct addrinfo *res) {
+	while (res) {
+		struct addrinfo *next = res->ai_next;
+		free(res);
+		res = next;
+	}
+}
+
+/** \brief Resolver of check_resolver. Every name is the loopback address after a delay depending on the name
+ * \details missing.test does not exist, slow.test takes CHECK_DNS_SLOW_MS and stuck.test waits for
+ check_dns_released. blackhole.test resolves to CHECK_BLACKHOLE_ADDRESS before the loopback address.
+ */
+static int check_dns_resolve(char const *node, char const *service, struct addrinfo const *hints,
+		struct addrinfo **res) {
+	(void) service;
+	(void) hints;
+	atomic_fetch_add(&check_dns_calls, 1);
+	if (!strcmp(node, "missing.test"))
+		return EAI_NONAME;
+	if (!strcmp(node, "slow.test"))
+		nanosleep(&(struct timespec) {.tv_nsec = CHECK_DNS_SLOW_MS * 1000000L}, 0);
+	if (!strcmp(node, "stuck.test")) {
+		pthread_mutex_lock(&check_dns_lock);
+		check_dns_stuck++;
+		while (!check_dns_released)
+			pthread_cond_wait(&check_dns_cond, &check_dns_lock);
+		check_dns_stuck--;
+		pthread_mutex_unlock(&check_dns_lock);
+	}
+	static char const *const blackhole[] = {CHECK_BLACKHOLE_ADDRESS, "127.0.0.1"};
+	if (!strcmp(node, "blackhole.test"))
+		return check_dns_list(blackhole, 2, res);
+	return check_dns_list(blackhole + 1, 1, res);
+}
+
+/** \brief A listener whose backlog is full, so that further connects to it neither succeed nor fail
+ *
+ * \param fds int[2] receive the listener and the connection filling its backlog, closed by the caller
+ * \return bool false if it could not be set up
+ *
+ */
+static bool check_blackhole_open(int fds[2]) {
+	struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(HTTP_PORT)};
+	inet_pton(AF_INET, CHECK_BLACKHOLE_ADDRESS, &address.sin_addr);
+	fds[0] = socket(AF_INET, SOCK_STREAM, 0);
+	fds[1] = socket(AF_INET, SOCK_STREAM, 0);
+	if (fds[0] < 0 || fds[1] < 0 || bind(fds[0], (struct sockaddr*) &address, sizeof(address)) || listen(fds[0], 0)
+			|| connect(fds[1], (struct sockaddr*) &address, sizeof(address)))
+		return false;
+	// The accept queue is full once a further connect hangs
+	int probe = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	connect(probe, (struct sockaddr*) &address, sizeof(address));
+	struct pollfd pending = {.fd = probe, .events = POLLOUT};
+	bool hangs = poll(&pending, 1, 100) == 0;
+	close(probe);
+	return hangs;
+}
+
+/** \brief An unreachable first address delays the connection by the attempt delay, not until the connect timeout
+ * \details blackhole.test resolves to an address which never answers before the address of the server. A
+ synchronous request and a batch are checked, the latter is driven by the event engine.
+ */
+static void check_connect_race(void) {
+	char name[120];
+	int blackhole[2] = {-1, -1};
+	if (check_report(check_blackhole_open(blackhole), "unreachable address set up", 0)) {
+		struct HttpTimeouts timeouts = http_get_timeouts();
+		http_set_timeouts((struct HttpTimeouts) {.connect_ms = 5000});
+		for (int batch = 0; batch < 2; batch++) {
+			http_pool_cleanup();
+			struct timespec start, end;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			struct HttpData data;
+			if (batch)
+				http_get_many(&(struct HttpRequest) {HttpCommand_GetHttp, "blackhole.test", "/size/10"}, &data, 1, 0, 0);
+			else
+				data = http_get("blackhole.test", "/size/10", 0, 0);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			long elapsed = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+			snprintf(name, sizeof(name), "%s behind an unreachable address in %ld ms, at most %d",
+					batch ? "batch" : "request", elapsed, CHECK_CONNECT_RACE_MS);
+			check_report(data.error == EError_NoError && data.received_data_length == 10 && check_body(data.data, 10)
+					&& elapsed <= CHECK_CONNECT_RACE_MS, name, &data);
+			http_data_free(&data);
+		}
+		http_set_timeouts(timeouts);
+	}
+	if (blackhole[0] >= 0)
+		close(blackhole[0]);
+	if (blackhole[1] >= 0)
+		close(blackhole[1]);
+}
+
+/** \brief Host names are resolved asynchronously, unknown names are cached and abandoned resolutions are cancelled */
+static void check_resolver(void) {
+	char name[120];
+	http_dns_cache_clear();
+	if (!check_report(http_dns_set_resolver(check_dns_resolve, check_dns_free), "resolver replaced", 0))
+		return;
+
+	// A slow resolution only delays its own request
+	struct HttpRequest requests[] = {
+		{HttpCommand_GetHttp, "slow.test", "/size/10"},
+		{HttpCommand_GetHttp, CHECK_HOST, "/size/20"},
+	};
+	struct HttpData results[2];
+	struct HttpBatch *batch = http_batch_start(requests, results, 2, 0, 0);
+	if (check_report(batch != 0, "batch with a slow resolution started", 0)) {
+		size_t first = http_batch_wait_any(batch, -1);
+		check_report(first == 1, "request to another host finished before the slow resolution", 0);
+		http_batch_wait_all(batch, -1);
+		http_batch_free(batch);
+		check_response(&results[0], "request after the slow resolution", 10);
+		check_response(&results[1], "request next to the slow resolution", 20);
+	}
+
+	// An unknown host is asked once, the engine and a synchronous request share the cached failure
+	atomic_store(&check_dns_calls, 0);
+	batch = http_batch_start(&(struct HttpRequest) {HttpCommand_GetHttp, "missing.test", "/size/10"}, results, 1, 0, 0);
+	if (check_report(batch != 0, "batch with an unknown host started", 0)) {
+		http_batch_wait_all(batch, -1);
+		http_batch_free(batch);
+		check_error(&results[0], "unknown host", EError_HostUnknown);
+		results[0] = http_get("missing.test", "/size/10", 0, 0);
+		check_error(&results[0], "unknown host again", EError_HostUnknown);
+		snprintf(name, sizeof(name), "unknown host resolved %u times, once expected", atomic_load(&check_dns_calls));
+		check_report(atomic_load(&check_dns_calls) == 1, name, 0);
+	}
+
+	// Requests given up while resolving leave the resolution behind and cancel its query
+	check_dns_released = false;
+	batch = http_batch_start(&(struct HttpRequest) {HttpCommand_GetHttp, "stuck.test", "/size/10"}, results, 1, 0, 0);
+	if (check_report(batch != 0, "batch with a stuck resolution started", 0)) {
+		check_report(http_batch_wait_any(batch, 100) == HTTP_BATCH_NONE, "stuck resolution still running", 0);
+		http_batch_free(batch);
+		check_error(&results[0], "batch freed during the resolution", EError_Aborted);
+	}
+	struct HttpTimeouts timeouts = http_get_timeouts();
+	http_set_timeouts((struct HttpTimeouts) {.dns_ms = 100});
+	results[0] = http_get("stuck.test", "/size/10", 0, 0);
+	check_error(&results[0], "resolution timed out", EError_Timeout);
+	http_set_timeouts(timeouts);
+	pthread_mutex_lock(&check_dns_lock);
+	check_dns_released = true;
+	pthread_cond_broadcast(&check_dns_cond);
+	pthread_mutex_unlock(&check_dns_lock);
+	for (int waited = 0; waited < CHECK_SERVER_WAIT_MS; waited += 10) {
+		pthread_mutex_lock(&check_dns_lock);
+		unsigned stuck = check_dns_stuck;
+		pthread_mutex_unlock(&check_dns_lock);
+		if (!stuck)
+			break;
+		nanosleep(&(struct timespec) {.tv_nsec = 10000000}, 0);
+	}
+	results[0] = http_get("stuck.test", "/size/30", 0, 0);
+	check_response(&results[0], "request after the cancelled resolutions", 30);
+
+	check_connect_race();
+
+	http_dns_set_resolver(0, 0);
+	http_dns_cache_clear();
+}
+
+/** \brief A missing session file is not an error, an unreadable or truncated one is */
+static void check_session_file(void) {
+	char path[64], name[120];
+	snprintf(path, sizeof(path), "/tmp/check-sessions-%ld", (long) getpid());
+	unlink(path);
+	check_report(https_session_cache_set_file(path), "missing session file accepted", 0);
+	struct HttpData data = https_get(CHECK_HOST, "/size/10", 0, 0);
+	check_response(&data, "https request before saving the sessions", 10);
+	check_report(https_session_cache_save(), "sessions saved", 0);
+	check_report(https_session_cache_set_file(path), "saved session file loaded", 0);
+
+	FILE *file = fopen(path, "rb");
+	long length = file && !fseek(file, 0, SEEK_END) ? ftell(file) : 0;
+	if (file)
+		fclose(file);
+	snprintf(name, sizeof(name), "truncated session file of %ld bytes rejected", length - 1);
+	check_report(length > 1 && !truncate(path, length - 1) && !https_session_cache_set_file(path), name, 0);
+	check_report(!https_session_cache_set_file("/tmp"), "directory as session file rejected", 0);
+	https_session_cache_set_file(0);
+	unlink(path);
+}
+
+/** \brief Returns the number of requests with @p code counted by the metrics registry */
+static unsigned long long check_metrics_requests(int code) {
+	char *text = http_metrics_render(), label[64];
+	snprintf(label, sizeof(label), "simplehttpget_requests_total{code=\"%d\"} ", code);
+	char const *line = text ? strstr(text, label) : 0;
+	unsigned long long count = line ? strtoull(line + strlen(label), 0, 10) : 0;
+	free(text);
+	return count;
+}
+
+/** \brief Every API call is counted once, also a cache hit and a segmented download made of several requests */
+static void check_metrics_calls(void) {
+	static struct {
+		char const *name;
+		enum { Get, Segmented } call;
+		char const *file;
+	} const cases[] = {
+		{"request", Get, "/size/10"},
+		{"cacheable request", Get, "/size/20?maxage=60"},
+		{"memory cache hit", Get, "/size/20?maxage=60"},
+		{"segmented download of HEAD and GET", Segmented, "/size/300000"},
+	};
+	char name[120];
+	http_set_metrics(true);
+	http_cache_configure(1 << 20);
+	for (size_t i = 0; i < sizeof(cases) / sizeof(*cases); i++) {
+		http_metrics_reset();
+		struct HttpData data = cases[i].call == Segmented ? http_get_segmented(CHECK_HOST, cases[i].file, 0, 0, 4)
+				: http_get(CHECK_HOST, cases[i].file, 0, 0);
+		unsigned long long count = check_metrics_requests(200);
+		snprintf(name, sizeof(name), "%s counted %llu times, once expected", cases[i].name, count);
+		check_report(data.error == EError_NoError && count == 1, name, &data);
+		http_data_free(&data);
+	}
+	http_cache_configure(0);
+	http_set_metrics(false);
+}
+
+/** \brief Waits until the server accepts requests
+ *
+ * \return bool true if the server answered in time
+ *
+ */
+static bool check_wait_for_server(void) {
+	for (int waited = 0; waited < CHECK_SERVER_WAIT_MS; waited += 50) {
+		struct HttpData data = http_get(CHECK_HOST, "/size/0", 0, 0);
+		bool ok = data.error == EError_NoError && data.http_code == 200;
+		http_data_free(&data);
+		if (ok)
+			return true;
+		nanosleep(&(struct timespec) {.tv_nsec = 50000000}, 0);
+	}
+	return false;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s <ca file>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	signal(SIGPIPE, SIG_IGN); // Writing to the closed pipe of check_fd_write_failure fails with EPIPE
+	if (!check_wait_for_server()) {
+		fprintf(stderr, "The server on %s is not reachable\n", CHECK_HOST);
+		return EXIT_FAILURE;
+	}
+	check_verification_reuse();
+	if (!https_set_ca_locations(argv[1], 0)) {
+		fprintf(stderr, "Invalid ca file %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	for (int https = 0; https < 2; https++) {
+		check_interim_responses(https);
+		check_chunked(https);
+		check_trailing_garbage(https);
+		check_fd_write_failure(https);
+		check_batch_connections(https);
+	}
+	check_content_length();
+	check_session_file();
+	check_metrics_calls();
+	check_callback_chains();
+	check_resolver();
+
+	http_pool_cleanup();
+	printf("%u checks failed\n", check_failures);
+	return check_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
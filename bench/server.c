@@ -0,0 +1,425 @@
+/*
+ Simple HTTP Get Library
+ Copyright (C) 2021 Ahmet Öztürk
+ Version 0.1
+
+ This program is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ This program is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Loopback HTTP/1.1 and HTTPS server for the benchmarks.
+ *
+ * Usage: server <http port> <https port> <certificate file> <key file>
+ *
+ * Every connection is served by its own thread and kept alive. The response is chosen by the request target:
+ *   /size/<n>          body of n bytes, sent with a Content-Length
+ *   ?chunked[=<n>]     send the body in chunks of n bytes, default 16384, at most 65536
+ *   ?delay=<ms>        wait before responding
+ *   ?close             close the connection after the response
+ *   ?eof               send the body without a Content-Length and close the connection to end it
+ *   ?interim           precede the response by 100 Continue and 103 Early Hints
+ *   ?length=<text>     send <text> as the Content-Length instead of the size
+ *   ?length2=<text>    send a second Content-Length header with <text>
+ *   ?extra=<n>         send n bytes of garbage behind the response, at most 16384
+ *   ?maxage=<s>        allow caching the response for s seconds
+ * Options are combined with '&'. Unknown targets are answered with 404.
+ */
+
+#define _GNU_SOURCE // memmem
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+
+#define SERVER_HEADER_MAX 8192
+#define SERVER_BODY_BLOCK 65536
+#define SERVER_DEFAULT_CHUNK 16384
+#define SERVER_GARBAGE_MAX 16384
+#define SERVER_THREAD_STACK (512 * 1024)
+
+/** \brief A connection accepted by the server */
+struct server_connection {
+	int fd; /**< @brief Socket of the client */
+	SSL *ssl; /**< @brief TLS state, 0 for plain HTTP */
+};
+
+/** \brief A listening socket */
+struct server_listener {
+	int fd; /**< @brief Listening socket */
+	bool is_https; /**< @brief Connections are wrapped in TLS */
+};
+
+static SSL_CTX *server_ctx;
+static char server_body[SERVER_BODY_BLOCK + 26]; /**< @brief Byte i of every body is 'a' + i % 26 */
+
+/** \brief Reads from a connection
+ *
+ * \param conn struct server_connection* connection
+ * \param buffer char* destination
+ * \param size size_t size of @p buffer
+ * \return long number of bytes read, <= 0 on end of stream or error
+ *
+ */
+static long server_read(struct server_connection *conn, char *buffer, size_t size) {
+	if (conn->ssl)
+		return SSL_read(conn->ssl, buffer, size);
+	return recv(conn->fd, buffer, size, 0);
+}
+
+/** \brief Writes a buffer completely to a connection
+ *
+ * \param conn struct server_connection* connection
+ * \param buffer char const* data
+ * \param size size_t length of @p buffer
+ * \return bool true on success
+ *
+ */
+static bool server_write(struct server_connection *conn, char const *buffer, size_t size) {
+	while (size) {
+		long written = conn->ssl ? SSL_write(conn->ssl, buffer, size) : send(conn->fd, buffer, size, MSG_NOSIGNAL);
+		if (written <= 0)
+			return false;
+		buffer += written;
+		size -= written;
+	}
+	return true;
+}
+
+/** \brief Writes @p size bytes of the generated body
+ *
+ * \param conn struct server_connection* connection
+ * \param offset size_t position of the first byte in the body
+ * \param size size_t number of bytes
+ * \return bool true on success
+ *
+ */
+static bool server_write_body(struct server_connection *conn, size_t offset, size_t size) {
+	while (size) {
+		size_t block = size < SERVER_BODY_BLOCK ? size : SERVER_BODY_BLOCK;
+		if (!server_write(conn, server_body + offset % 26, block))
+			return false;
+		offset += block;
+		size -= block;
+	}
+	return true;
+}
+
+/** \brief Writes the end of a response followed by bytes which are not part of any response in a single write
+ * \details The client receives them in the same read, or the same TLS record, as the end of the response.
+ *
+ * \param conn struct server_connection* connection
+ * \param end char const* last bytes of the response
+ * \param length size_t length of @p end, at most SERVER_BODY_BLOCK
+ * \param garbage long number of bytes to append, at most SERVER_GARBAGE_MAX
+ * \return bool true on success
+ *
+ */
+static bool server_write_end(struct server_connection *conn, char const *end, size_t length, long garbage) {
+	char buffer[SERVER_BODY_BLOCK + SERVER_GARBAGE_MAX];
+	if (garbage > SERVER_GARBAGE_MAX)
+		garbage = SERVER_GARBAGE_MAX;
+	if (garbage < 0)
+		garbage = 0;
+	memcpy(buffer, end, length);
+	memset(buffer + length, '#', garbage);
+	return server_write(conn, buffer, length + garbage);
+}
+
+/** \brief Finds an option in the query of a request target
+ *
+ * \param query char const* query string without '?', may be 0
+ * \param name char const* option name
+ * \return char const* end of the option name in @p query, 0 if the option is not present
+ *
+ */
+static char const* server_find_option(char const *query, char const *name) {
+	size_t length = strlen(name);
+	for (char const *option = query; option; option = strchr(option, '&')) {
+		if (*option == '&')
+			option++;
+		if (!strncmp(option, name, length) && (!option[length] || option[length] == '=' || option[length] == '&'))
+			return option + length;
+	}
+	return 0;
+}
+
+/** \brief Looks up a numeric option in the query of a request target
+ *
+ * \param query char const* query string without '?', may be 0
+ * \param name char const* option name
+ * \param value long* receives the value following '=', unchanged if there is none
+ * \return bool true if the option is present
+ *
+ */
+static bool server_option(char const *query, char const *name, long *value) {
+	char const *option = server_find_option(query, name);
+	if (option && *option == '=' && value)
+		*value = strtol(option + 1, 0, 10);
+	return option;
+}
+
+/** \brief Looks up an option in the query of a request target and copies its value verbatim
+ *
+ * \param query char const* query string without '?', may be 0
+ * \param name char const* option name
+ * \param text char* receives the value following '=', empty if there is none
+ * \param size size_t size of @p text
+ * \return bool true if the option is present
+ *
+ */
+static bool server_option_text(char const *query, char const *name, char *text, size_t size) {
+	char const *option = server_find_option(query, name);
+	if (!option)
+		return false;
+	size_t length = *option == '=' ? strcspn(++option, "&") : 0;
+	snprintf(text, size, "%.*s", (int) length, option);
+	return true;
+}
+
+/** \brief Answers a single request
+ *
+ * \param conn struct server_connection* connection
+ * \param request char* request header, NUL terminated, modified
+ * \return bool true if the connection can be kept alive
+ *
+ */
+static bool server_respond(struct server_connection *conn, char *request) {
+	char target[1024] = "";
+	if (sscanf(request, "%*s %1023s", target) != 1)
+		return false;
+	bool head = !strncmp(request, "HEAD ", 5);
+	char *query = strchr(target, '?');
+	if (query)
+		*query++ = 0;
+
+	long delay = 0, chunk = SERVER_DEFAULT_CHUNK;
+	bool chunked = server_option(query, "chunked", &chunk), close_after = server_option(query, "close", 0);
+	bool eof = server_option(query, "eof", 0);
+	if (eof) {
+		chunked = false;
+		close_after = true;
+	}
+	if (server_option(query, "delay", &delay) && delay > 0) {
+		struct timespec wait = {.tv_sec = delay / 1000, .tv_nsec = delay % 1000 * 1000000};
+		nanosleep(&wait, 0);
+	}
+	if (chunk <= 0)
+		chunk = SERVER_DEFAULT_CHUNK;
+
+	char *end = 0;
+	long size = strncmp(target, "/size/", 6) ? -1 : strtol(target + 6, &end, 10);
+	bool found = size >= 0 && end != target + 6 && !*end;
+	if (!found)
+		size = 0;
+
+	if (server_option(query, "interim", 0)) {
+		static char const interim[] = "HTTP/1.1 100 Continue\r\n\r\n"
+				"HTTP/1.1 103 Early Hints\r\nLink: </style.css>; rel=preload\r\n\r\n";
+		if (!server_write(conn, interim, strlen(interim)))
+			return false;
+	}
+
+	char header[512], length_field[256] = "Transfer-Encoding: chunked\r\n", length_text[100];
+	if (server_option_text(query, "length", length_text, sizeof(length_text)))
+		snprintf(length_field, sizeof(length_field), "Content-Length: %s\r\n", length_text);
+	else if (eof)
+		length_field[0] = 0;
+	else if (!chunked)
+		snprintf(length_field, sizeof(length_field), "Content-Length: %ld\r\n", size);
+	if (server_option_text(query, "length2", length_text, sizeof(length_text)))
+		snprintf(length_field + strlen(length_field), sizeof(length_field) - strlen(length_field),
+				"Content-Length: %s\r\n", length_text);
+	long max_age = 0;
+	char cache_field[64] = "";
+	if (server_option(query, "maxage", &max_age))
+		snprintf(cache_field, sizeof(cache_field), "Cache-Control: max-age=%ld\r\n", max_age);
+	int header_length = snprintf(header, sizeof(header), "HTTP/1.1 %s\r\n%s%s%s\r\n",
+			found ? "200 OK" : "404 Not Found", length_field, cache_field, close_after ? "Connection: close\r\n" : "");
+	if (!server_write(conn, header, header_length))
+		return false;
+	if (head)
+		return !close_after;
+
+	long extra = 0;
+	server_option(query, "extra", &extra);
+	if (!chunked && size && extra > 0)
+		return server_write_body(conn, 0, size - 1) && server_write_end(conn, server_body + (size - 1) % 26, 1, extra)
+				&& !close_after;
+	if (!chunked)
+		return server_write_body(conn, 0, size) && server_write_end(conn, "", 0, extra) && !close_after;
+	// Each chunk is sent with a single write, so the client does not wait for small segments
+	if (chunk > SERVER_BODY_BLOCK)
+		chunk = SERVER_BODY_BLOCK;
+	char buffer[SERVER_BODY_BLOCK + 32];
+	for (long sent = 0; sent < size; sent += chunk) {
+		long length = size - sent < chunk ? size - sent : chunk;
+		int line = snprintf(buffer, 32, "%lx\r\n", length);
+		memcpy(buffer + line, server_body + sent % 26, length);
+		memcpy(buffer + line + length, "\r\n", 2);
+		if (!server_write(conn, buffer, line + length + 2))
+			return false;
+	}
+	return server_write_end(conn, "0\r\n\r\n", 5, extra) && !close_after;
+}
+
+/** \brief Serves a connection until the client closes it
+ *
+ * \param arg void* struct server_connection*, released by this function
+ * \return void* 0
+ *
+ */
+static void* server_connection_thread(void *arg) {
+	struct server_connection conn = *(struct server_connection*) arg;
+	free(arg);
+	char buffer[SERVER_HEADER_MAX + 1];
+	size_t length = 0;
+
+	if (conn.ssl && SSL_accept(conn.ssl) <= 0)
+		goto end;
+	for (;;) {
+		char *header_end;
+		while (!(header_end = memmem(buffer, length, "\r\n\r\n", 4))) {
+			if (length == SERVER_HEADER_MAX)
+				goto end;
+			long received = server_read(&conn, buffer + length, SERVER_HEADER_MAX - length);
+			if (received <= 0)
+				goto end;
+			length += received;
+		}
+		size_t request_length = header_end + 4 - buffer;
+		char request[SERVER_HEADER_MAX + 1];
+		memcpy(request, buffer, request_length);
+		request[request_length] = 0;
+		memmove(buffer, buffer + request_length, length - request_length);
+		length -= request_length;
+		if (!server_respond(&conn, request))
+			break;
+	}
+end:
+	if (conn.ssl) {
+		SSL_shutdown(conn.ssl);
+		SSL_free(conn.ssl);
+	}
+	close(conn.fd);
+	return 0;
+}
+
+/** \brief Accepts connections of a listener
+ *
+ * \param arg void* struct server_listener*
+ * \return void* 0
+ *
+ */
+static void* server_accept_thread(void *arg) {
+	struct server_listener *listener = arg;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	pthread_attr_setstacksize(&attr, SERVER_THREAD_STACK);
+
+	for (;;) {
+		int fd = accept(listener->fd, 0, 0), one = 1;
+		if (fd < 0)
+			continue;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		struct server_connection *conn = calloc(1, sizeof(*conn));
+		if (!conn) {
+			close(fd);
+			continue;
+		}
+		conn->fd = fd;
+		if (listener->is_https) {
+			conn->ssl = SSL_new(server_ctx);
+			if (!conn->ssl) {
+				free(conn);
+				close(fd);
+				continue;
+			}
+			SSL_set_fd(conn->ssl, fd);
+		}
+		pthread_t thread;
+		if (pthread_create(&thread, &attr, server_connection_thread, conn)) {
+			SSL_free(conn->ssl);
+			close(fd);
+			free(conn);
+		}
+	}
+	return 0;
+}
+
+/** \brief Opens a listening socket on the IPv4 or IPv6 loopback address
+ *
+ * \param port unsigned short port
+ * \param ipv6 bool listen on ::1 instead of 127.0.0.1
+ * \return int socket, -1 on error
+ *
+ */
+static int server_listen(unsigned short port, bool ipv6) {
+	int fd = socket(ipv6 ? AF_INET6 : AF_INET, SOCK_STREAM, 0), one = 1;
+	if (fd < 0)
+		return -1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in address4 = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+	struct sockaddr_in6 address6 = {.sin6_family = AF_INET6, .sin6_port = htons(port), .sin6_addr = IN6ADDR_LOOPBACK_INIT};
+	if ((ipv6 ? bind(fd, (struct sockaddr*) &address6, sizeof(address6))
+			: bind(fd, (struct sockaddr*) &address4, sizeof(address4))) || listen(fd, SOMAXCONN)) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+int main(int argc, char **argv) {
+	if (argc != 5) {
+		fprintf(stderr, "Usage: %s <http port> <https port> <certificate file> <key file>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	for (size_t i = 0; i < sizeof(server_body); i++)
+		server_body[i] = 'a' + i % 26;
+
+	server_ctx = SSL_CTX_new(TLS_server_method());
+	if (!server_ctx || SSL_CTX_use_certificate_chain_file(server_ctx, argv[3]) != 1
+			|| SSL_CTX_use_PrivateKey_file(server_ctx, argv[4], SSL_FILETYPE_PEM) != 1) {
+		ERR_print_errors_fp(stderr);
+		return EXIT_FAILURE;
+	}
+
+	static struct server_listener listeners[4];
+	size_t count = 0;
+	for (int i = 0; i < 4; i++) {
+		bool is_https = i >= 2, ipv6 = i % 2;
+		int fd = server_listen(atoi(argv[is_https ? 2 : 1]), ipv6);
+		if (fd >= 0)
+			listeners[count++] = (struct server_listener) {.fd = fd, .is_https = is_https};
+		else if (!ipv6) { // The IPv6 loopback is optional
+			perror("Listening on the loopback address");
+			return EXIT_FAILURE;
+		}
+	}
+	for (size_t i = 1; i < count; i++) {
+		pthread_t thread;
+		pthread_create(&thread, 0, server_accept_thread, &listeners[i]);
+	}
+	server_accept_thread(&listeners[0]);
+	return EXIT_SUCCESS;
+}
@@ -53,8 +53,7 @@ void get_and_print(char const *const host, char const *const file,
 
 	print_http_response(host, http_response, response_length);
 
-	if (http_response.data)
-		free(http_response.data);
+	http_data_free(&http_response);
 }
 
 void Callback(pthread_t threadID, struct HttpData response) {
@@ -17,31 +17,93 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#if defined(__linux__)
+#define _GNU_SOURCE // splice
+#elif !defined(_WIN32)
+#define _POSIX_C_SOURCE 200809L
+#endif
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <strings.h>
+#include <ctype.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <unistd.h>
 #include <stdatomic.h>
 #include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <signal.h>
 #ifdef _WIN32
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <openssl/applink.c>
 #else
-#define __USE_XOPEN2K
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
 #include <netdb.h>
+#include <netinet/in.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
+#endif
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #endif
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <zlib.h>
 #include "socket.h"
 
 #define MAX_THREADS 5
+#define THREAD_POOL_DEFAULT_QUEUE 64
+#define THREAD_POOL_MAX_INLINE 8 // Requests a worker makes itself from nested callbacks before rejecting further ones
+#define RESPONSE_INITIAL_BUFFER 4096
+#define RESPONSE_MIN_READ 4096
+#define RESPONSE_MAX_READ (16 * 1024 * 1024)
+#define STREAM_BUFFER_SIZE 16384
+#define SPLICE_BLOCK_SIZE 65536
+#define SEGMENT_DEFAULT_COUNT 4
+#define SEGMENT_MIN_SIZE 65536
+#define CACHE_BUCKETS 256
+#define DISK_CACHE_SAVE_CHANGES 64 // Changes of the disk cache collected before its index is rewritten
+#ifndef HTTP_PORT
+#define HTTP_PORT 80
+#endif
+#ifndef HTTPS_PORT
+#define HTTPS_PORT 443
+#endif
+#define POOL_DEFAULT_IDLE_TIMEOUT 30
+#define POOL_DEFAULT_MAX_IDLE 32
+#define POOL_MAX_HOSTNAME 256
+#define DNS_DEFAULT_TTL 60
+#define DNS_DEFAULT_NEGATIVE_TTL 10
+#define DNS_CACHE_BUCKETS 64
+#define DNS_CACHE_MAX_ENTRIES 256
+#define DNS_MAX_ADDRESSES 16
+#define CONNECT_ATTEMPT_DELAY_MS 250
+#define DNS_RESOLVER_THREADS 4
+#define SESSION_CACHE_SIZE 128
+#define ENGINE_MAX_EVENTS 256
+#define SESSION_MAX_DER 16384
+#define SESSION_KEY_SIZE (POOL_MAX_HOSTNAME + 32)
+#define BATCH_DEFAULT_CONCURRENCY 16
+#define BATCH_MAX_PER_HOST 6
+#define METRICS_SHARDS 16
+#define METRICS_STATUS_CODES 600
+#define METRICS_ERRORS (EError_InvalidArgument + 1)
+#define METRICS_SUB_BUCKET_BITS 3
+#define METRICS_LATENCY_BUCKETS 304 // Up to 2^40 microseconds
 
 enum {
 	SOCK_OK,
@@ -59,6 +121,9 @@ struct socket_thread_data {
 	char const *add_info;
 	time_t		timeout;
 	HttpCallback *callback_func;
+	bool stream; /**< @brief Pass the body to @p callbacks instead of returning it */
+	struct HttpStreamCallbacks callbacks;
+	int64_t queued; /**< @brief Moment in microseconds of clock_now_us the request was queued, 0 if not timed */
 };
 
 #ifdef DIAGNOSTIC
@@ -79,20 +144,6 @@ static void myperror(size_t line, char const *const msg, int error) {
 }
 #endif
 
-/** \brief Checks whether a request is timed out
- *
- * \return true on timeout, false otherwise
- *
- */
-static bool socket_istimedout(time_t timeout) {
-	bool ret = false;
-	time_t now = time(0);
-	if(timeout && now > timeout) {
-		ret = true;
-	}
-	return ret;
-}
-
 /** \brief Initialize socket
  *
  */
@@ -134,6 +185,20 @@ static int get_last_error(void) {
 	return ret;
 }
 
+/** \brief Checks whether an error code means that a non blocking operation has to be retried later
+ *
+ * \param error int error code returned by get_last_error
+ * \return bool true if the operation would block
+ *
+ */
+static bool socket_would_block(int error) {
+#ifdef _WIN32
+	return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS || error == WSAEALREADY;
+#else
+	return error == EAGAIN || error == EWOULDBLOCK || error == EINPROGRESS;
+#endif
+}
+
 /** \brief Closes Socket
  *
  * \param sock_id int socket to be closed
@@ -171,721 +236,5948 @@ bool socket_set_blocking(int fd, bool blocking) {
 #endif
 }
 
-struct SocketFailible {
+struct SocketFallible {
 	enum EError error;
 	int socket;
 };
 
-/** \brief Connect to socket
+/** \brief Waits for events on a set of sockets
  *
- * \param addr char const*const address information
- * \return int socket
+ * \param fds struct pollfd* sockets and requested events
+ * \param nfds size_t number of entries in @p fds
+ * \param timeout_ms int timeout in milliseconds, -1 to wait infinitely
+ * \return int number of sockets with events, 0 on timeout, -1 on error
  *
  */
-static struct SocketFailible socket_connect(char const *const addr) {
-	struct addrinfo hints = { 0 }, *res = 0;
-	hints.ai_family = AF_UNSPEC;
-	hints.ai_socktype = SOCK_STREAM;
+static int socket_poll(struct pollfd *fds, size_t nfds, int timeout_ms) {
+#ifdef _WIN32
+	return WSAPoll(fds, nfds, timeout_ms);
+#else
+	return poll(fds, nfds, timeout_ms);
+#endif
+}
 
-	if (getaddrinfo(addr, "http", &hints, &res)) {
-		int error = get_last_error();
-		myperror(__LINE__, "Error getting addrinfo.", error);
-		return (struct SocketFallible) {.error = EError_AddrInfoError};
-	}
+/** \brief All addresses a host name resolved to, in the order of the resolver with alternating address families */
+struct dns_addresses {
+	enum EError error; /**< @brief EError_NoError or the reason the resolution failed */
+	size_t count;
+	struct sockaddr_storage address[DNS_MAX_ADDRESSES];
+	socklen_t length[DNS_MAX_ADDRESSES];
+};
 
-	int s = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-	if (s == -1) {
-		int error = get_last_error();
-		myperror(__LINE__, "Error creating socket.", error);
-		return (struct SocketFallible) {.error = EError_CreateSocketError};
-	}
+typedef struct dns_cache_entry dns_cache_entry;
 
-	if (connect(s, res->ai_addr, res->ai_addrlen) == -1) {
-		int error = get_last_error();
-		myperror(__LINE__, "Error connecting to socket.", error);
-		return (struct SocketFallible) {.error = EError_ConnectionError};
-	}
-	freeaddrinfo(res);
-	return (struct SocketFallible) {.error = EError_NoError, .socket = s};
-}
+/** \brief A cached resolver result. Failed resolutions are cached as well */
+struct dns_cache_entry {
+	char host[POOL_MAX_HOSTNAME];
+	time_t expires;
+	struct dns_addresses addresses;
+	dns_cache_entry *next;
+};
 
-/** \brief Send data oversocket
- *
- * \param sock_id int id of socket
- * \param msg char const* message to be send
- * \param msg_len size_t length of message
- * \return int
- *
- */
-inline
-static int socket_send(int sock_id, char const *msg, size_t msg_len) {
-	return send(sock_id, msg, msg_len, 0);
-}
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static dns_cache_entry *dns_cache[DNS_CACHE_BUCKETS];
+static size_t dns_cache_count = 0;
+static _Atomic(time_t) dns_ttl = DNS_DEFAULT_TTL;
+static _Atomic(time_t) dns_negative_ttl = DNS_DEFAULT_NEGATIVE_TTL;
+static HttpGetAddrInfo *dns_getaddrinfo = 0; /**< @brief Resolver set by http_dns_set_resolver, 0 for getaddrinfo. Guarded by dns_lock */
+static HttpFreeAddrInfo *dns_freeaddrinfo = 0; /**< @brief Releases the results of dns_getaddrinfo */
 
-/** \brief Send whole message
+/** \brief Hashes a host name case-insensitively (FNV-1a)
  *
- * \param sock_id int id of socket
- * \param msg char const* message to be sent
- * \param msg_len size_t length of message
- * \return int
+ * \param host char const*const host name
+ * \return size_t bucket of the dns cache
  *
  */
-static int socket_sendall(int sock_id, char const *msg, size_t msg_len) {
-	size_t msg_sent = 0;
-	do {
-		msg_sent += socket_send(sock_id, msg, msg_len);
-	} while (msg_sent < msg_len);
-	return msg_sent;
+static size_t dns_cache_bucket(char const *const host) {
+	uint32_t hash = 2166136261u;
+	for (char const *pos = host; *pos; pos++) {
+		char ch = *pos >= 'A' && *pos <= 'Z' ? *pos - 'A' + 'a' : *pos;
+		hash = (hash ^ (unsigned char) ch) * 16777619u;
+	}
+	return hash % DNS_CACHE_BUCKETS;
 }
 
-/** \brief Receive data from socket
+/** \brief Removes every expired entry. Needs to be called with dns_lock held
  *
- * \param sock_id int id of socket
- * \param msg char* destination array
- * \param max_len size_t max length of @p msg
- * \param flags int additional flags
- * \return int
+ * \param now time_t current time
+ * \return void
  *
  */
-inline
-static int socket_receive(int sock_id, char *msg, size_t max_len, int flags) {
-	return recv(sock_id, msg, max_len, flags);
+static void dns_cache_sweep_locked(time_t now) {
+	for (size_t i = 0; i < DNS_CACHE_BUCKETS; i++) {
+		dns_cache_entry **link = &dns_cache[i];
+		while (*link) {
+			dns_cache_entry *entry = *link;
+			if (entry->expires <= now) {
+				*link = entry->next;
+				free(entry);
+				dns_cache_count--;
+			} else {
+				link = &entry->next;
+			}
+		}
+	}
 }
 
-/** \brief Returns HTTP code
+/** \brief Looks up @p host in the dns cache
  *
- * \param http_response char const*const http response to be checked
- * \return int HTTP/1.1 code
+ * \param host char const*const host name
+ * \param addresses struct dns_addresses* receives the cached result
+ * \return bool true if a valid entry was found
  *
  */
-static int http_get_http_code(char const *const http_response) {
-	int ret = 0;
-	if (http_response) {
-		char *header_pos = strstr(http_response, "HTTP/1.1");
-		if (header_pos) {
-			ret = strtoul(header_pos + strlen("HTTP/1.1"), NULL, 10);
+static bool dns_cache_lookup(char const *const host, struct dns_addresses *addresses) {
+	bool ret = false;
+	time_t now = time(0);
+	pthread_mutex_lock(&dns_lock);
+	for (dns_cache_entry *entry = dns_cache[dns_cache_bucket(host)]; entry; entry = entry->next) {
+		if (!strcasecmp(entry->host, host)) {
+			if (entry->expires > now) {
+				*addresses = entry->addresses;
+				ret = true;
+			}
+			break;
 		}
 	}
+	pthread_mutex_unlock(&dns_lock);
 	return ret;
 }
 
-/** \brief Checks http response for validity ("200 OK")
+/** \brief Stores a resolver result in the dns cache
  *
- * \param http_response char const*const http response to be checked
- * \return bool true of OK, false otherwise
+ * \param host char const*const host name
+ * \param addresses struct dns_addresses const*const result of the resolution
+ * \param ttl time_t time to live in seconds
+ * \return void
  *
  */
-static bool http_is_response_ok(char const *const http_response) {
-	return http_get_http_code(http_response) == 200;
+static void dns_cache_store(char const *const host, struct dns_addresses const *const addresses, time_t ttl) {
+	if (ttl <= 0 || strlen(host) >= POOL_MAX_HOSTNAME)
+		return;
+	time_t now = time(0);
+	size_t bucket = dns_cache_bucket(host);
+	pthread_mutex_lock(&dns_lock);
+	dns_cache_entry *entry = dns_cache[bucket];
+	while (entry && strcasecmp(entry->host, host))
+		entry = entry->next;
+	if (!entry) {
+		if (dns_cache_count >= DNS_CACHE_MAX_ENTRIES)
+			dns_cache_sweep_locked(now);
+		if (dns_cache_count < DNS_CACHE_MAX_ENTRIES && (entry = malloc(sizeof(dns_cache_entry)))) {
+			strcpy(entry->host, host);
+			entry->next = dns_cache[bucket];
+			dns_cache[bucket] = entry;
+			dns_cache_count++;
+		}
+	}
+	if (entry) {
+		entry->addresses = *addresses;
+		entry->expires = now + ttl;
+	}
+	pthread_mutex_unlock(&dns_lock);
 }
 
-/** \brief Returns the content length of the http response according to the http header
+/** \brief Reorders resolved addresses so that the address families alternate, starting with the family preferred by the resolver
+ * \details Following RFC 8305, a connection attempt to the other family starts early if the preferred one is unreachable.
  *
- * \param http_response char const*const http response of the server
- * \return size_t length according to http header
+ * \param addresses struct dns_addresses* addresses in the order of the resolver
+ * \return void
  *
  */
-static size_t http_find_content_length(char const *const http_response) {
-	size_t ret = 0;
-	if (http_is_response_ok(http_response)) {            // response valid
-		if (strstr(http_response, "\r\n\r\n")) {         // header complete
-			char *pos_length = strstr(http_response, "Content-Length: ");
-			if (pos_length) {
-				int scan = sscanf(pos_length, "Content-Length: %zu", &ret);
-				assert(scan);
-			}
+static void dns_interleave_families(struct dns_addresses *addresses) {
+	if (addresses->count < 3)
+		return;
+	struct dns_addresses sorted = { .error = addresses->error };
+	int first = addresses->address[0].ss_family;
+	size_t preferred = 0, other = 0;
+	while (sorted.count < addresses->count) {
+		// Take the next address of the family whose turn it is, or of the other family if none is left
+		bool want_preferred = sorted.count % 2 == 0;
+		size_t *next = want_preferred ? &preferred : &other;
+		while (*next < addresses->count && (addresses->address[*next].ss_family == first) != want_preferred)
+			(*next)++;
+		if (*next == addresses->count) {
+			want_preferred = !want_preferred;
+			next = want_preferred ? &preferred : &other;
+			while (*next < addresses->count && (addresses->address[*next].ss_family == first) != want_preferred)
+				(*next)++;
 		}
+		sorted.address[sorted.count] = addresses->address[*next];
+		sorted.length[sorted.count++] = addresses->length[(*next)++];
 	}
-	return ret;
+	*addresses = sorted;
 }
 
-/** \brief Returns whether the http reponse header has content length information
+/** \brief Resolves @p host, using the dns cache if possible
+ * \details Every address returned by getaddrinfo or the resolver set by http_dns_set_resolver is kept. Definite failures (unknown host) are cached with the negative ttl,
+ temporary failures are not cached.
  *
- * \param http_response char const*const http response of the server
- * \return bool
+ * \param host char const*const host name
+ * \param addresses struct dns_addresses* receives the addresses
+ * \return enum EError EError_NoError on success
  *
  */
-static bool http_has_content_information(char const *const http_response) {
-	return http_response && strstr(http_response, "Content-Length: ");
-}
+static enum EError dns_resolve(char const *const host, struct dns_addresses *addresses) {
+	if (dns_cache_lookup(host, addresses))
+		return addresses->error;
 
-/** \brief Return the length of the http header
- *
- * \param http_response char const*const http response of the server
- * \return size_t length of header
- *
- */
-static size_t http_find_header_length(char const *const http_response) {
-	size_t ret = 0;
-	if (http_response) {
-		char *pos_header_end = strstr(http_response, "\r\n\r\n")
-				+ strlen("\r\n\r\n");   // find end of header
-		if (pos_header_end) {
-			ptrdiff_t length = pos_header_end - http_response;
-			ret = length;
+	struct addrinfo hints = { 0 }, *res = 0;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	pthread_mutex_lock(&dns_lock);
+	HttpGetAddrInfo *resolve = dns_getaddrinfo;
+	HttpFreeAddrInfo *release = dns_freeaddrinfo;
+	pthread_mutex_unlock(&dns_lock);
+
+	memset(addresses, 0, sizeof(struct dns_addresses));
+	int gai_error = resolve ? resolve(host, 0, &hints, &res) : getaddrinfo(host, 0, &hints, &res);
+	if (gai_error) {
+		int error = get_last_error();
+		myperror(__LINE__, "Error getting addrinfo.", error);
+		addresses->error = EError_AddrInfoError;
+		if (gai_error == EAI_NONAME) {
+			addresses->error = EError_HostUnknown;
+			dns_cache_store(host, addresses, dns_negative_ttl);
 		}
+		return addresses->error;
 	}
-	return ret;
+	for (struct addrinfo *ai = res; ai && addresses->count < DNS_MAX_ADDRESSES; ai = ai->ai_next) {
+		if (ai->ai_addrlen > sizeof(struct sockaddr_storage))
+			continue;
+		memcpy(&addresses->address[addresses->count], ai->ai_addr, ai->ai_addrlen);
+		addresses->length[addresses->count] = ai->ai_addrlen;
+		addresses->count++;
+	}
+	if (resolve)
+		release(res);
+	else
+		freeaddrinfo(res);
+	dns_interleave_families(addresses);
+	if (!addresses->count)
+		addresses->error = EError_HostUnknown;
+	dns_cache_store(host, addresses, addresses->count ? dns_ttl : dns_negative_ttl);
+	return addresses->error;
 }
 
-/** \brief Generate user agent for http request
+/** \brief Sets the port of a resolved address
  *
- * \param void
- * \return char* string containing user agent, must be freed by user
+ * \param address struct sockaddr_storage* IPv4 or IPv6 address
+ * \param port unsigned short port in host byte order
+ * \return void
  *
  */
-static char* socket_get_useragent(char const *const user_agent) {
-	char *ret = 0;
-	if (user_agent) {
-		ret = malloc(100 * sizeof(char));
-		if (ret) {
-			strcpy(ret, "User-Agent: ");
-			strcat(ret, user_agent);
-			char *new_mem = realloc(ret, (strlen(ret) + 1) * sizeof(char));
-			ret = new_mem ? new_mem : ret;
+static void socket_set_port(struct sockaddr_storage *address, unsigned short port) {
+	if (address->ss_family == AF_INET)
+		((struct sockaddr_in*) address)->sin_port = htons(port);
+	else if (address->ss_family == AF_INET6)
+		((struct sockaddr_in6*) address)->sin6_port = htons(port);
+}
+
+void http_dns_cache_set_ttl(time_t ttl, time_t negative_ttl) {
+	dns_ttl = ttl;
+	dns_negative_ttl = negative_ttl;
+}
+
+bool http_dns_set_resolver(HttpGetAddrInfo *resolve, HttpFreeAddrInfo *release) {
+	if (!resolve != !release)
+		return false;
+	pthread_mutex_lock(&dns_lock);
+	dns_getaddrinfo = resolve;
+	dns_freeaddrinfo = release;
+	pthread_mutex_unlock(&dns_lock);
+	return true;
+}
+
+void http_dns_cache_clear(void) {
+	pthread_mutex_lock(&dns_lock);
+	for (size_t i = 0; i < DNS_CACHE_BUCKETS; i++) {
+		while (dns_cache[i]) {
+			dns_cache_entry *entry = dns_cache[i];
+			dns_cache[i] = entry->next;
+			free(entry);
 		}
 	}
-	return ret;
+	dns_cache_count = 0;
+	pthread_mutex_unlock(&dns_lock);
 }
 
-/** \brief Checks whether the http response is complete.
- * The actual content length must match the content length given in the http header.
+#ifndef _WIN32
+enum dns_query_state {
+	DnsQueryState_Queued,
+	DnsQueryState_Resolving,
+	DnsQueryState_Completed, /**< @brief Waiting in the completed list of the notifier */
+	DnsQueryState_Delivered, /**< @brief Taken from the notifier, owned by the receiver */
+};
+
+typedef struct dns_query dns_query;
+typedef struct dns_notifier dns_notifier;
+
+/** \brief A resolution running on a resolver thread */
+struct dns_query {
+	char host[POOL_MAX_HOSTNAME];
+	struct dns_addresses addresses;
+	enum dns_query_state state;
+	dns_notifier *notifier; /**< @brief Receives the completed query, 0 if the query has been cancelled */
+	void *owner; /**< @brief Passed through for the receiver */
+	dns_query *next;
+};
+
+/** \brief Collects completed queries and makes its file descriptor readable when one arrives */
+struct dns_notifier {
+	int fd[2]; /**< @brief Read and write end, both the same eventfd on Linux. -1 if not available */
+	dns_query *completed;
+};
+
+static pthread_mutex_t dns_resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_resolver_cond = PTHREAD_COND_INITIALIZER;
+static dns_query *dns_resolver_head = 0; /**< @brief Queue of queries waiting for a resolver thread */
+static dns_query *dns_resolver_tail = 0;
+static size_t dns_resolver_threads = 0;
+static size_t dns_resolver_idle = 0;
+
+/** \brief Creates the file descriptor of a notifier
  *
- * \param http_response char const*const http response of the server
- * \return bool true if complete, false otherwise
+ * \param notifier dns_notifier* notifier
+ * \return bool false if no file descriptor is available, resolution then has to be done synchronously
  *
  */
-static bool http_is_response_complete(char const *const http_response) {
-	bool ret = false;
-	if (http_is_response_ok(http_response)) {
-		size_t header_length = http_find_header_length(http_response);
-		size_t resp_setpoint = http_find_content_length(http_response);
-		int actual_resp = strlen(http_response) - header_length;
-		if (actual_resp > 0 && header_length && resp_setpoint
-				&& actual_resp == resp_setpoint) {
-			ret = true;
-		}
+static bool dns_notifier_init(dns_notifier *notifier) {
+	notifier->completed = 0;
+#ifdef __linux__
+	notifier->fd[0] = notifier->fd[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	return notifier->fd[0] >= 0;
+#else
+	if (pipe(notifier->fd)) {
+		notifier->fd[0] = notifier->fd[1] = -1;
+		return false;
 	}
-	return ret;
+	for (int i = 0; i < 2; i++) {
+		fcntl(notifier->fd[i], F_SETFD, FD_CLOEXEC);
+		fcntl(notifier->fd[i], F_SETFL, fcntl(notifier->fd[i], F_GETFL, 0) | O_NONBLOCK);
+	}
+	return true;
+#endif
+}
+
+/** \brief Makes the file descriptor of @p notifier readable. Needs to be called with dns_resolver_lock held */
+static void dns_notifier_signal_locked(dns_notifier *notifier) {
+#ifdef __linux__
+	uint64_t one = 1;
+	ssize_t n = write(notifier->fd[1], &one, sizeof(one));
+#else
+	char one = 1;
+	ssize_t n = write(notifier->fd[1], &one, sizeof(one)); // a full pipe is readable already
+#endif
+	(void) n;
 }
 
-/** \brief Creates http request. needs to be freed by the user
+/** \brief Takes every completed query from @p notifier and resets its file descriptor
  *
- * \param host char const*const host to be connected
- * \param file char const*const file to be requested
- * \param add_info char const*const additional info to be placed into http header
- * \return char* string containing http 1.1 request
+ * \param notifier dns_notifier* notifier
+ * \return dns_query* list of completed queries linked by next, owned by the caller
  *
  */
-static char* http_create_request(char const *const host, char const *const file, char const *const add_info) {
-	char *request = 0;
-	if (host && file) {
-		size_t const header_max = 2000;
-		request = calloc(header_max, sizeof(char));
-		char const *const close = "close";
-		//char const*const keep = "keep-alive";
-		char const *const method = close;
-		if (request) {
-			sprintf(request,
-					"GET %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\nAccept: text/plain\r\n%s\r\n\r\n",
-					file, host, method, add_info ? add_info : "");
-			char *new_req = realloc(request, strlen(request) + 1);
-			if (new_req) {
-				request = new_req;
-			}
+static dns_query* dns_notifier_take(dns_notifier *notifier) {
+	char buffer[64];
+	while (read(notifier->fd[0], buffer, sizeof(buffer)) > 0)
+		;
+	pthread_mutex_lock(&dns_resolver_lock);
+	dns_query *completed = notifier->completed;
+	notifier->completed = 0;
+	for (dns_query *query = completed; query; query = query->next)
+		query->state = DnsQueryState_Delivered;
+	pthread_mutex_unlock(&dns_resolver_lock);
+	return completed;
+}
+
+/** \brief Closes the file descriptor of @p notifier. Its queries have to be cancelled before */
+static void dns_notifier_destroy(dns_notifier *notifier) {
+	if (notifier->fd[0] >= 0)
+		close(notifier->fd[0]);
+	if (notifier->fd[1] != notifier->fd[0] && notifier->fd[1] >= 0)
+		close(notifier->fd[1]);
+	notifier->fd[0] = notifier->fd[1] = -1;
+}
+
+/** \brief Resolves queued queries until the process ends */
+static void* dns_resolver_thread(void *arg) {
+	pthread_mutex_lock(&dns_resolver_lock);
+	while (true) {
+		dns_resolver_idle++;
+		while (!dns_resolver_head)
+			pthread_cond_wait(&dns_resolver_cond, &dns_resolver_lock);
+		dns_resolver_idle--;
+		dns_query *query = dns_resolver_head;
+		dns_resolver_head = query->next;
+		if (!dns_resolver_head)
+			dns_resolver_tail = 0;
+		query->state = DnsQueryState_Resolving;
+		pthread_mutex_unlock(&dns_resolver_lock);
+
+		struct dns_addresses addresses;
+		dns_resolve(query->host, &addresses);
+
+		pthread_mutex_lock(&dns_resolver_lock);
+		if (!query->notifier) {
+			free(query);
+			continue;
 		}
+		query->addresses = addresses;
+		query->state = DnsQueryState_Completed;
+		query->next = query->notifier->completed;
+		query->notifier->completed = query;
+		dns_notifier_signal_locked(query->notifier);
 	}
-	return request;
+	return 0;
 }
 
-/** \brief removes http header from http response
+/** \brief Starts resolving @p host on a resolver thread
+ * \details Resolver threads are started on demand, up to DNS_RESOLVER_THREADS. The completed query is added to
+ @p notifier, unless it is cancelled with dns_query_cancel before.
  *
- * \param http_response char* response of remote computer
- * \return char* containing http body
+ * \param host char const*const host name
+ * \param notifier dns_notifier* receives the completed query
+ * \param owner void* passed through in the query
+ * \return dns_query* query, 0 on error
  *
  */
-static char* http_remove_header(char *http_response) {
-	if (http_is_response_ok(http_response)) {
-		if (strstr(http_response, "\r\n\r\n")) {
-			size_t length = strlen(http_response);
-			size_t header_length = http_find_header_length(http_response);
-			assert(header_length > 0);
-			char buffer[length - header_length + 1];
-			strcpy(buffer, http_response + header_length);
-			http_response = realloc(http_response, length - header_length + 1);
-			if (http_response) {
-				strcpy(http_response, buffer);
-			}
-		}
+static dns_query* dns_resolve_async(char const *const host, dns_notifier *notifier, void *owner) {
+	if (strlen(host) >= POOL_MAX_HOSTNAME)
+		return 0;
+	dns_query *query = calloc(1, sizeof(dns_query));
+	if (!query)
+		return 0;
+	strcpy(query->host, host);
+	query->notifier = notifier;
+	query->owner = owner;
+	pthread_mutex_lock(&dns_resolver_lock);
+	if (!dns_resolver_idle && dns_resolver_threads < DNS_RESOLVER_THREADS) {
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (!pthread_create(&thread, &attr, dns_resolver_thread, 0))
+			dns_resolver_threads++;
+		pthread_attr_destroy(&attr);
 	}
-	return http_response;
+	if (!dns_resolver_threads) {
+		pthread_mutex_unlock(&dns_resolver_lock);
+		free(query);
+		return 0;
+	}
+	if (dns_resolver_tail)
+		dns_resolver_tail->next = query;
+	else
+		dns_resolver_head = query;
+	dns_resolver_tail = query;
+	pthread_cond_signal(&dns_resolver_cond);
+	pthread_mutex_unlock(&dns_resolver_lock);
+	return query;
 }
 
-/** \brief Get error message from http header
+/** \brief Cancels a query which has not been taken from its notifier yet
  *
- * \param http_code int HTTP response code
- * \param http_response char* response of remote computer
- * \return char* containing error message
+ * \param query dns_query* query returned by dns_resolve_async
+ * \return void
  *
  */
-static char* http_get_error_msg(int http_code, char *http_response) {
-	char *ret = 0;
-	switch (http_code) {
-	case 301:
-		if (http_response) {
-			char *new_location = strstr(http_response, "Location: ");
-			if (new_location) {
-				new_location += strlen("Location: ");
-				char *end_location = strstr(new_location, "\r\n");
-				assert(end_location);
-				size_t buff_len = end_location - new_location + 1;
-				assert(buff_len);
-				char buffer[buff_len];
-				strncpy(buffer, new_location, buff_len - 1);
-				buffer[buff_len - 1] = '\0';
-				char *new_pos = realloc(http_response, buff_len * sizeof(char)); // Todo check
-				if (new_pos)
-					http_response = new_pos;
-				//strcpy(new_pos, buffer);
-				memcpy(new_pos, buffer, buff_len);
-				ret = new_pos;
-			}
-		}
+static void dns_query_cancel(dns_query *query) {
+	pthread_mutex_lock(&dns_resolver_lock);
+	dns_query **link = 0;
+	switch (query->state) {
+	case DnsQueryState_Queued: {
+		dns_query *previous = 0;
+		for (link = &dns_resolver_head; *link != query; link = &(*link)->next)
+			previous = *link;
+		*link = query->next;
+		if (dns_resolver_tail == query)
+			dns_resolver_tail = previous;
+		free(query);
 		break;
-	default:
-		// Nothing
-#warning "Currently only HTTP Error code 301 is handled. Every other error code is not handled but rather directly forwarded to the calling context."
-		ret = http_response;
+	}
+	case DnsQueryState_Resolving:
+		query->notifier = 0; // freed by the resolver thread
+		break;
+	case DnsQueryState_Completed:
+		for (link = &query->notifier->completed; *link != query;)
+			link = &(*link)->next;
+		*link = query->next;
+		free(query);
+		break;
+	case DnsQueryState_Delivered:
+		free(query);
 		break;
 	}
-
-	return ret;
+	pthread_mutex_unlock(&dns_resolver_lock);
 }
+#endif
 
-/** \brief Parse http header into struct HttpData
+/** \brief Returns the current time of a monotonic clock
  *
- * \param data char* response of remote computer
- * \param received_bytes total number of received bytes
- * \return struct HttpData
+ * \return int64_t milliseconds since an arbitrary starting point
  *
  */
-struct HttpData http_parse_header(char const *const data, size_t received_bytes) {
-	struct HttpData ret = { 0 };
-	if (data && received_bytes) {
-		ret.http_code = http_get_http_code(data);
-		ret.received_bytes = received_bytes;
-		ret.received_data_length = received_bytes - http_find_header_length(data);
-		ret.content_length = http_find_content_length(data);
-	}
-	return ret;
+static int64_t clock_now_ms(void) {
+#ifdef _WIN32
+	return GetTickCount64();
+#else
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+#endif
 }
 
-/** \brief Receive whole message from host
+/** \brief Returns the current time of a monotonic clock in microseconds
  *
- * \param sock_id int id of socket
- * \param msg char* destination array
- * \param max_len size_t max length of @p msg
- * \param flags int additional flags
- * \param timeout time_t (optional) defines when timeout shall happen
- * \return int
+ * \return int64_t microseconds since an arbitrary starting point
  *
  */
-static struct HttpData http_receiveall(int sock_id, char *msg, size_t max_len, int flags, time_t timeout) {
-	struct HttpData ret = { 0 };
-	int received = 0;
-	int buff_pos = 0;
-	int err_ret = 0;
-
-	do {
-		if(socket_istimedout(timeout)) {
+static int64_t clock_now_us(void) {
 #ifdef _WIN32
-			err_ret = WSAETIMEDOUT;
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return counter.QuadPart / frequency.QuadPart * 1000000
+			+ counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
 #else
-			errno = ETIME;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
 #endif
-			goto ERR_RECV;
-		}
-		received = socket_receive(sock_id, msg + buff_pos, max_len - buff_pos, flags);
-		if (received == -1) {
-			err_ret = get_last_error();
-#ifdef _WIN32
-			switch(err_ret) {
-				case WSAEWOULDBLOCK:
-				case WSAEINPROGRESS:
-				case WSAEALREADY:
-					break;
-					
-				default:
-					goto ERR_RECV;
-			}
-#else
-			switch (err_ret) {
-			case EAGAIN:
-				break;
+}
 
-			case ECONNRESET:
-				goto END;
-				// or goto ERR_RECV?
+static _Atomic(bool) http_timing = false;
 
-			default:
-				goto ERR_RECV;
-			}
-#endif
-		}
-		if (received > 0)
-			buff_pos += received;
-		if (http_is_response_ok(msg)) {
-			if (http_is_response_complete(msg) || received == 0) {
-				break;
-			}
-		}
-		if (buff_pos && !http_is_response_ok(msg)) {
-			ret.http_code = http_get_http_code(msg);
-			ret.received_bytes = buff_pos;
-			ret.data = http_get_error_msg(ret.http_code, msg);
-			goto ERR_RECV;
-		}
-	} while (true);
+void http_set_timing(bool enabled) {
+	http_timing = enabled;
+}
 
-END:
-	ret = http_parse_header(msg, buff_pos);
+/** \brief Counters of the metrics registry. Every thread adds to one shard, so that threads rarely share cache lines */
+struct metrics_shard {
+	_Alignas(64) _Atomic(uint64_t) requests[METRICS_STATUS_CODES]; /**< @brief By status code, 0 without response */
+	_Atomic(uint64_t) errors[METRICS_ERRORS];
+	_Atomic(uint64_t) bytes_received;
+	_Atomic(uint64_t) bytes_sent;
+	_Atomic(uint64_t) connections_opened;
+	_Atomic(uint64_t) connections_closed;
+	_Atomic(uint64_t) latency[METRICS_LATENCY_BUCKETS]; /**< @brief Log-linear histogram of request durations */
+	_Atomic(uint64_t) latency_sum; /**< @brief Sum of all request durations in microseconds */
+};
 
-	return ret;
+static _Atomic(bool) http_metrics = false;
+static struct metrics_shard metrics_shards[METRICS_SHARDS];
+static _Atomic(unsigned) metrics_next_shard = 0;
+static _Thread_local unsigned metrics_thread_shard = 0; /**< @brief Shard of the thread + 1, 0 if not assigned yet */
 
-ERR_RECV:
-#ifdef _WIN32
-    if(!ret.http_code) ret.http_code = err_ret;
+/** \brief Returns the shard of the calling thread, threads are assigned round robin on first use */
+static struct metrics_shard* metrics_shard(void) {
+	if (!metrics_thread_shard)
+		metrics_thread_shard = atomic_fetch_add_explicit(&metrics_next_shard, 1, memory_order_relaxed)
+				% METRICS_SHARDS + 1;
+	return &metrics_shards[metrics_thread_shard - 1];
+}
+
+/** \brief Adds @p value to a counter of the calling thread's shard */
+static inline void metrics_add(_Atomic(uint64_t) *counter, uint64_t value) {
+	atomic_fetch_add_explicit(counter, value, memory_order_relaxed);
+}
+
+/** \brief Returns the latency histogram bucket of @p us
+ * \details Values below 2^(METRICS_SUB_BUCKET_BITS + 1) have a bucket each. Above, every power of two is split into
+ 2^METRICS_SUB_BUCKET_BITS buckets of equal width, so the relative error stays below 12.5 %.
+ *
+ * \param us uint64_t duration in microseconds
+ * \return size_t index of the bucket
+ *
+ */
+static size_t metrics_latency_bucket(uint64_t us) {
+	if (us < 2u << METRICS_SUB_BUCKET_BITS)
+		return us;
+#ifdef __GNUC__
+	unsigned msb = 63 - __builtin_clzll(us);
 #else
-	if (!ret.http_code)
-		ret.http_code = errno;
-#endif // _WIN32
-	char buffer[40];
-	sprintf(buffer, "Error during recv, error msg: %d", ret.http_code);
-	int error = get_last_error();
-	myperror(__LINE__, buffer, error);
-	return ret;
+	unsigned msb = 0;
+	for (uint64_t v = us; v >>= 1;)
+		msb++;
+#endif
+	size_t index = ((size_t) (msb - METRICS_SUB_BUCKET_BITS) << METRICS_SUB_BUCKET_BITS)
+			+ (us >> (msb - METRICS_SUB_BUCKET_BITS));
+	return index < METRICS_LATENCY_BUCKETS ? index : METRICS_LATENCY_BUCKETS - 1;
 }
 
-/** \brief Connect to host and request file using HTTP. Add_info will be sent in request
+/** \brief Returns the first duration which does not belong to bucket @p index any more
  *
- * \param host char const*const address of host
- * \param file char const*const requested file
- * \param add_info char const*const additional info to be sent in header
- * \return char* server response, http header removed. 0 if no valid response
+ * \param index size_t index of a bucket
+ * \return uint64_t exclusive upper bound in microseconds
  *
  */
-struct HttpData http_get(char const *const host, char const *const file, char const *const add_info, time_t timeout) {
-	struct HttpData ret = { 0 };
-	int s = 0;
-	char *http_request = 0, *buffer = 0;
-	if (host && file) {
-		if (socket_init() != SOCK_OK) {
-			int error = get_last_error();
-			myperror(__LINE__, "Error initializing socket", error);
-			return ret;
-		}
-		s = socket_connect(host);
-		http_request = http_create_request(host, file, add_info);
-		if (!http_request)
-			goto ERR_SOCKET;
+static uint64_t metrics_latency_bucket_end(size_t index) {
+	if (index < 2u << METRICS_SUB_BUCKET_BITS)
+		return index + 1;
+	unsigned shift = (index >> METRICS_SUB_BUCKET_BITS) - 1;
+	uint64_t sub_bucket = (index & ((1u << METRICS_SUB_BUCKET_BITS) - 1)) + (1u << METRICS_SUB_BUCKET_BITS);
+	return (sub_bucket + 1) << shift;
+}
 
-		if (!socket_sendall(s, http_request, strlen(http_request) + 1))
-			goto ERR_SEND;
+/** \brief Number of API calls on this thread which are recorded as one request, see metrics_call_begin */
+static _Thread_local unsigned metrics_nested = 0;
 
-		size_t buf_len = 100E3;
-		buffer = calloc(buf_len, sizeof(char));
-		if (!buffer)
-			goto ERR_SEND;
+/** \brief Counts an API call by status code and error and records its duration
+ *
+ * \param data struct HttpData const* result of the call
+ * \param start int64_t moment in microseconds of clock_now_us the call started
+ * \return void
+ *
+ */
+static void metrics_record_call(struct HttpData const *data, int64_t start) {
+	struct metrics_shard *shard = metrics_shard();
+	int64_t duration = clock_now_us() - start;
+	if (duration < 0)
+		duration = 0;
+	int code = data->http_code > 0 && data->http_code < METRICS_STATUS_CODES ? data->http_code : 0;
+	metrics_add(&shard->requests[code], 1);
+	if (data->error != EError_NoError && (unsigned) data->error < METRICS_ERRORS)
+		metrics_add(&shard->errors[data->error], 1);
+	metrics_add(&shard->latency[metrics_latency_bucket(duration)], 1);
+	metrics_add(&shard->latency_sum, duration);
+}
 
-		size_t received_bytes = 0;
-		if (!socket_set_blocking(s, false)) {
-			int error = get_last_error();
-			myperror(__LINE__, "Error setting socket to nonblocking", error);
-			return ret;
-		}
+/** \brief Records a finished request in the metrics registry, if metrics are enabled
+ * \details Inside an API call recorded as a whole, only the bytes of the request are recorded.
+ *
+ * \param data struct HttpData const* result of the request
+ * \param bytes_sent size_t number of request bytes sent
+ * \param start int64_t moment in microseconds of clock_now_us the request started
+ * \return void
+ *
+ */
+static void metrics_record(struct HttpData const *data, size_t bytes_sent, int64_t start) {
+	struct metrics_shard *shard = metrics_shard();
+	metrics_add(&shard->bytes_received, data->received_bytes);
+	metrics_add(&shard->bytes_sent, bytes_sent);
+	if (!metrics_nested)
+		metrics_record_call(data, start);
+}
 
-		ret = http_receiveall(s, buffer + received_bytes, buf_len, 0, timeout);
-		if (!ret.received_bytes)
-			goto ERR_RECV;
+/** \brief Starts an API call which is counted once, however many requests it makes or if it makes none
+ *
+ * \return int64_t start of the call for metrics_call_end, 0 if metrics are disabled
+ *
+ */
+static int64_t metrics_call_begin(void) {
+	metrics_nested++;
+	return http_metrics ? clock_now_us() : 0;
+}
 
-		if (ret.http_code == 200) {
-			if (!http_has_content_information(buffer)
-					|| http_is_response_complete(buffer)) {
-				// Either no content length information or fully received
-				buffer = http_remove_header(buffer);
-				assert(buffer);
-				ret.data = buffer;
-			} else {
-				goto ERR_RECV;
-				// Could not receive fully
+/** \brief Finishes an API call started by metrics_call_begin and records its result */
+static void metrics_call_end(struct HttpData const *data, int64_t start) {
+	if (!--metrics_nested && start)
+		metrics_record_call(data, start);
+}
+
+static _Atomic(unsigned) timeout_dns_ms = 0;
+static _Atomic(unsigned) timeout_connect_ms = 0;
+static _Atomic(unsigned) timeout_tls_ms = 0;
+static _Atomic(unsigned) timeout_transfer_ms = 0;
+static _Atomic(unsigned) timeout_total_ms = 0;
+
+void http_set_timeouts(struct HttpTimeouts timeouts) {
+	timeout_dns_ms = timeouts.dns_ms;
+	timeout_connect_ms = timeouts.connect_ms;
+	timeout_tls_ms = timeouts.tls_ms;
+	timeout_transfer_ms = timeouts.transfer_ms;
+	timeout_total_ms = timeouts.total_ms;
+}
+
+struct HttpTimeouts http_get_timeouts(void) {
+	return (struct HttpTimeouts) { .dns_ms = timeout_dns_ms, .connect_ms = timeout_connect_ms,
+			.tls_ms = timeout_tls_ms, .transfer_ms = timeout_transfer_ms, .total_ms = timeout_total_ms };
+}
+
+/** \brief Converts the timeout moment of a request into its total deadline on the monotonic clock
+ *
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \return int64_t deadline in milliseconds of clock_now_ms, 0 for no deadline
+ *
+ */
+static int64_t socket_deadline(time_t timeout) {
+	int64_t now = clock_now_ms();
+	int64_t deadline = 0;
+	if (timeout) {
+		struct timespec wall;
+		timespec_get(&wall, TIME_UTC);
+		int64_t left = (int64_t) timeout * 1000 - ((int64_t) wall.tv_sec * 1000 + wall.tv_nsec / 1000000);
+		// A deadline of 0 would mean no deadline
+		deadline = left > 0 ? now + left : now - 1;
+	}
+	unsigned total_ms = timeout_total_ms;
+	if (total_ms && (!deadline || now + total_ms < deadline))
+		deadline = now + total_ms;
+	return deadline;
+}
+
+/** \brief Returns the deadline of a phase which starts now
+ *
+ * \param deadline int64_t total deadline of the request, 0 for none
+ * \param phase_ms unsigned limit of the phase in milliseconds, 0 for none
+ * \return int64_t the earlier of both deadlines, 0 for none
+ *
+ */
+static int64_t socket_phase_deadline(int64_t deadline, unsigned phase_ms) {
+	if (!phase_ms)
+		return deadline;
+	int64_t phase_deadline = clock_now_ms() + phase_ms;
+	return deadline && deadline < phase_deadline ? deadline : phase_deadline;
+}
+
+/** \brief Checks whether a request is timed out
+ *
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return true on timeout, false otherwise
+ *
+ */
+static bool socket_istimedout(int64_t deadline) {
+	return deadline && clock_now_ms() >= deadline;
+}
+
+/** \brief Converts a deadline into the number of milliseconds left
+ *
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return int milliseconds until @p deadline, -1 for no deadline
+ *
+ */
+static int socket_timeout_ms(int64_t deadline) {
+	if (!deadline)
+		return -1;
+	int64_t left = deadline - clock_now_ms();
+	return left <= 0 ? 0 : left > INT_MAX ? INT_MAX : (int) left;
+}
+
+/** \brief Blocks until @p sock_id is ready for @p events or @p deadline is reached
+ *
+ * \param sock_id int socket
+ * \param events short POLLIN and / or POLLOUT
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return bool true if the socket is ready
+ *
+ */
+static bool socket_wait(int sock_id, short events, int64_t deadline) {
+	struct pollfd pfd = { .fd = sock_id, .events = events };
+	return socket_poll(&pfd, 1, socket_timeout_ms(deadline)) > 0;
+}
+
+/** \brief Resolves @p host like dns_resolve, but gives up at @p deadline
+ * \details Unless the host is cached, the resolution runs on a resolver thread while the caller waits for its
+ notifier. If the deadline passes first, the query is cancelled.
+ *
+ * \param host char const*const host name
+ * \param addresses struct dns_addresses* receives the addresses
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return enum EError EError_NoError on success, EError_Timeout if @p deadline passed
+ *
+ */
+static enum EError dns_resolve_until(char const *const host, struct dns_addresses *addresses, int64_t deadline) {
+	if (dns_cache_lookup(host, addresses))
+		return addresses->error;
+	if (!deadline)
+		return dns_resolve(host, addresses);
+#ifndef _WIN32
+	dns_notifier notifier;
+	dns_query *query = 0;
+	if (dns_notifier_init(&notifier) && (query = dns_resolve_async(host, &notifier, 0))) {
+		enum EError error = EError_Timeout;
+		while (!socket_istimedout(deadline)) {
+			socket_wait(notifier.fd[0], POLLIN, deadline);
+			dns_query *completed = dns_notifier_take(&notifier);
+			if (completed) {
+				*addresses = completed->addresses;
+				error = addresses->error;
+				query = completed;
+				break;
+			}
+		}
+		dns_query_cancel(query);
+		dns_notifier_destroy(&notifier);
+		return error;
+	}
+	dns_notifier_destroy(&notifier);
+#endif
+	return dns_resolve(host, addresses);
+}
+
+/** \brief Starts a non blocking connect to one resolved address
+ *
+ * \param address struct sockaddr_storage* address, its port is set to @p port
+ * \param length socklen_t length of @p address
+ * \param port unsigned short port to be connected
+ * \param error_code enum EError* receives the reason if the attempt failed at once
+ * \return int non blocking socket with a pending or established connection, -1 on error
+ *
+ */
+static int socket_connect_start(struct sockaddr_storage *address, socklen_t length, unsigned short port,
+		enum EError *error_code) {
+	socket_set_port(address, port);
+	int s = socket(address->ss_family, SOCK_STREAM, 0);
+	if (s == -1) {
+		int error = get_last_error();
+		myperror(__LINE__, "Error creating socket.", error);
+		*error_code = EError_CreateSocketError;
+		return -1;
+	}
+	if (!socket_set_blocking(s, false)
+			|| (connect(s, (struct sockaddr*) address, length) == -1 && !socket_would_block(get_last_error()))) {
+		int error = get_last_error();
+		myperror(__LINE__, "Error connecting to socket.", error);
+		*error_code = EError_ConnectionError;
+		socket_close(s);
+		return -1;
+	}
+	return s;
+}
+
+/** \brief Connect to socket
+ * \details The resolved addresses of @p addr are raced as described in RFC 8305 (Happy Eyeballs): connection attempts
+ start CONNECT_ATTEMPT_DELAY_MS apart, or at once when the previous attempt failed, and the first established
+ connection wins. The other attempts are abandoned.
+ Resolving and connecting are limited by the dns and connect timeouts, both phases together by @p deadline.
+ *
+ * \param addr char const*const address information
+ * \param port unsigned short port to be connected
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \param timing struct HttpTiming* receives the duration of both phases, may be 0
+ * \return struct SocketFallible blocking socket
+ *
+ */
+static struct SocketFallible socket_connect(char const *const addr, unsigned short port, int64_t deadline,
+		struct HttpTiming *timing) {
+	struct dns_addresses addresses;
+	int64_t start = timing ? clock_now_us() : 0;
+	bool cached = dns_cache_lookup(addr, &addresses);
+	enum EError error_code = cached ? addresses.error :
+			dns_resolve_until(addr, &addresses, socket_phase_deadline(deadline, timeout_dns_ms));
+	if (timing) {
+		int64_t now = clock_now_us();
+		timing->dns_cached = cached;
+		timing->dns_us = now - start;
+		start = now;
+	}
+	if (error_code != EError_NoError)
+		return (struct SocketFallible) {.error = error_code};
+
+	deadline = socket_phase_deadline(deadline, timeout_connect_ms);
+	error_code = EError_ConnectionError;
+	struct pollfd attempts[DNS_MAX_ADDRESSES];
+	size_t pending = 0, next = 0;
+	int64_t next_start = 0;
+	int connected = -1;
+	while (connected < 0 && (pending || next < addresses.count)) {
+		int64_t now = clock_now_ms();
+		if (deadline && now >= deadline) {
+			myperror(__LINE__, "Timeout during connect", ETIMEDOUT);
+			error_code = EError_Timeout;
+			break;
+		}
+		if (next < addresses.count && (!pending || now >= next_start)) {
+			int s = socket_connect_start(&addresses.address[next], addresses.length[next], port, &error_code);
+			next++;
+			if (s >= 0) {
+				attempts[pending++] = (struct pollfd) { .fd = s, .events = POLLOUT };
+				next_start = now + CONNECT_ATTEMPT_DELAY_MS;
+			}
+			continue;
+		}
+		int wait_ms = socket_timeout_ms(deadline);
+		if (next < addresses.count && (wait_ms < 0 || next_start - now < wait_ms))
+			wait_ms = (int) (next_start - now);
+		if (socket_poll(attempts, pending, wait_ms) < 0) {
+			int error = get_last_error();
+#ifndef _WIN32
+			if (error == EINTR)
+				continue;
+#endif
+			myperror(__LINE__, "Error waiting for connection.", error);
+			break;
+		}
+		for (size_t i = 0; i < pending && connected < 0;) {
+			if (!attempts[i].revents) {
+				i++;
+				continue;
+			}
+			int error = 0;
+			socklen_t length = sizeof(error);
+			if (getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, (void*) &error, &length) || error) {
+				myperror(__LINE__, "Error connecting to socket.", error);
+				socket_close(attempts[i].fd);
+				attempts[i] = attempts[--pending];
+				// The next address does not have to wait for the delay
+				next_start = now;
+				continue;
+			}
+			connected = attempts[i].fd;
+			attempts[i] = attempts[--pending];
+		}
+	}
+	for (size_t i = 0; i < pending; i++)
+		socket_close(attempts[i].fd);
+	if (timing)
+		timing->connect_us = clock_now_us() - start;
+	if (connected >= 0 && socket_set_blocking(connected, true))
+		return (struct SocketFallible) {.error = EError_NoError, .socket = connected};
+	if (connected >= 0)
+		socket_close(connected);
+	return (struct SocketFallible) {.error = error_code};
+}
+
+/** \brief Send data oversocket
+ *
+ * \param sock_id int id of socket
+ * \param msg char const* message to be send
+ * \param msg_len size_t length of message
+ * \return int
+ *
+ */
+inline
+static int socket_send(int sock_id, char const *msg, size_t msg_len) {
+#ifdef MSG_NOSIGNAL
+	return send(sock_id, msg, msg_len, MSG_NOSIGNAL);
+#else
+	return send(sock_id, msg, msg_len, 0);
+#endif
+}
+
+/** \brief Receive data from socket
+ *
+ * \param sock_id int id of socket
+ * \param msg char* destination array
+ * \param max_len size_t max length of @p msg
+ * \param flags int additional flags
+ * \return int
+ *
+ */
+inline
+static int socket_receive(int sock_id, char *msg, size_t max_len, int flags) {
+	return recv(sock_id, msg, max_len, flags);
+}
+
+typedef struct http_connection http_connection;
+
+/** \brief A connection to a host which can be kept alive and reused by subsequent requests */
+struct http_connection {
+	char host[POOL_MAX_HOSTNAME]; /**< @brief Host the connection is established to */
+	unsigned short port; /**< @brief Port the connection is established to */
+	bool is_https; /**< @brief true if @p bio is used, false if @p socket is used */
+	int socket; /**< @brief Socket of an HTTP connection */
+	BIO *bio; /**< @brief BIO chain of an HTTPS connection */
+	time_t last_used; /**< @brief Moment the connection has been put into the pool */
+	http_connection *next;
+};
+
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static http_connection *pool_idle = 0;
+static size_t pool_idle_count = 0;
+static struct HttpPoolStats pool_stats = { 0 };
+static _Atomic(time_t) pool_idle_timeout = POOL_DEFAULT_IDLE_TIMEOUT;
+static _Atomic(size_t) pool_max_idle = POOL_DEFAULT_MAX_IDLE;
+#ifdef SKIP_VERIFICATION
+#warning "Warning: SSL Verification is being skipped by default. Man in the Middle Attacks can not be discovered"
+static _Atomic(bool) https_verify = false;
+#else
+static _Atomic(bool) https_verify = true;
+#endif // SKIP_VERIFICATION
+
+/** \brief Creates a connection object. Every connection holds a reference to the socket interface
+ *
+ * \param host char const*const host of the connection
+ * \param port unsigned short port of the connection
+ * \param is_https bool true for an HTTPS connection
+ * \return http_connection* new connection, 0 on error
+ *
+ */
+static http_connection* connection_new(char const *const host, unsigned short port, bool is_https) {
+	if (!host || strlen(host) >= POOL_MAX_HOSTNAME)
+		return 0;
+	http_connection *conn = calloc(1, sizeof(http_connection));
+	if (conn) {
+		if (socket_init() != SOCK_OK) {
+			free(conn);
+			return 0;
+		}
+		strcpy(conn->host, host);
+		conn->port = port;
+		conn->is_https = is_https;
+		conn->socket = -1;
+		metrics_add(&metrics_shard()->connections_opened, 1);
+	}
+	return conn;
+}
+
+/** \brief Closes a connection and frees its resources
+ *
+ * \param conn http_connection* connection to be closed
+ * \return void
+ *
+ */
+static void connection_close(http_connection *conn) {
+	if (conn) {
+		if (conn->bio) {
+			// Freeing the BIO would send close_notify, possibly to a peer which has closed the connection already (SIGPIPE)
+			SSL *ssl = 0;
+			BIO_get_ssl(conn->bio, &ssl);
+			if (ssl)
+				SSL_set_quiet_shutdown(ssl, 1);
+			BIO_free_all(conn->bio);
+		}
+		if (conn->socket >= 0)
+			socket_close(conn->socket);
+		free(conn);
+		metrics_add(&metrics_shard()->connections_closed, 1);
+		socket_deinit();
+	}
+}
+
+/** \brief Returns the socket underlying a connection
+ *
+ * \param conn http_connection const*const connection
+ * \return int socket, -1 if not available
+ *
+ */
+static int connection_get_socket(http_connection const *const conn) {
+	int fd = conn->socket;
+	if (conn->bio)
+		BIO_get_fd(conn->bio, &fd);
+	return fd;
+}
+
+/** \brief Checks whether an idle connection has been closed by the server
+ * \details An idle keep-alive connection must not become readable. Readability means EOF, an error or unexpected data.
+ *
+ * \param conn http_connection const*const connection to be checked
+ * \return bool true if the connection can be reused
+ *
+ */
+static bool connection_is_alive(http_connection const *const conn) {
+	struct pollfd pfd = { .fd = connection_get_socket(conn), .events = POLLIN };
+	if (pfd.fd < 0)
+		return false;
+	return socket_poll(&pfd, 1, 0) == 0;
+}
+
+/** \brief Checks whether a connection satisfies the current setting of https_set_verification
+ * \details A connection established while verification was disabled must not be reused once it is enabled.
+ *
+ * \param conn http_connection const*const connection to be checked
+ * \return bool true if the connection can be reused
+ *
+ */
+static bool connection_is_trusted(http_connection const *const conn) {
+	SSL *ssl = 0;
+	if (!conn->bio || !https_verify)
+		return true;
+	BIO_get_ssl(conn->bio, &ssl);
+	return ssl && SSL_get_verify_mode(ssl) != SSL_VERIFY_NONE;
+}
+
+/** \brief Closes every idle connection which exceeded the idle timeout. Needs to be called with pool_lock held
+ *
+ * \param now time_t current time
+ * \return void
+ *
+ */
+static void pool_sweep_locked(time_t now) {
+	http_connection **link = &pool_idle;
+	while (*link) {
+		http_connection *conn = *link;
+		if (now - conn->last_used >= pool_idle_timeout) {
+			*link = conn->next;
+			pool_idle_count--;
+			pool_stats.evictions++;
+			connection_close(conn);
+		} else {
+			link = &conn->next;
+		}
+	}
+}
+
+/** \brief Takes an idle connection to @p host out of the pool
+ *
+ * \param host char const*const host to be connected
+ * \param port unsigned short port to be connected
+ * \param is_https bool scheme of the connection
+ * \return http_connection* idle connection, 0 if none is available
+ *
+ */
+static http_connection* pool_acquire(char const *const host, unsigned short port, bool is_https) {
+	http_connection *ret = 0;
+	pthread_mutex_lock(&pool_lock);
+	pool_sweep_locked(time(0));
+	http_connection **link = &pool_idle;
+	while (*link) {
+		http_connection *conn = *link;
+		if (conn->port == port && conn->is_https == is_https && !strcmp(conn->host, host)) {
+			*link = conn->next;
+			pool_idle_count--;
+			if (connection_is_trusted(conn) && connection_is_alive(conn)) {
+				conn->next = 0;
+				ret = conn;
+				break;
+			}
+			pool_stats.evictions++;
+			connection_close(conn);
+		} else {
+			link = &conn->next;
+		}
+	}
+	if (ret)
+		pool_stats.hits++;
+	else
+		pool_stats.misses++;
+	pthread_mutex_unlock(&pool_lock);
+	return ret;
+}
+
+/** \brief Puts a connection back into the pool. If pooling is disabled, the connection is closed
+ *
+ * \param conn http_connection* connection with no outstanding response
+ * \return void
+ *
+ */
+static void pool_release(http_connection *conn) {
+	if (!conn)
+		return;
+	// Connections are kept in blocking mode, callers which use non blocking sockets switch on acquire
+	if (!pool_idle_timeout || !pool_max_idle || !socket_set_blocking(connection_get_socket(conn), true)) {
+		connection_close(conn);
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	time_t now = time(0);
+	pool_sweep_locked(now);
+	if (pool_idle_count >= pool_max_idle) {
+		// Evict the least recently used connection, which is the last one
+		http_connection **link = &pool_idle;
+		while ((*link)->next)
+			link = &(*link)->next;
+		connection_close(*link);
+		*link = 0;
+		pool_idle_count--;
+		pool_stats.evictions++;
+	}
+	conn->last_used = now;
+	conn->next = pool_idle;
+	pool_idle = conn;
+	pool_idle_count++;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+void http_pool_set_idle_timeout(time_t seconds) {
+	pool_idle_timeout = seconds;
+	if (!seconds)
+		http_pool_cleanup();
+}
+
+void http_pool_set_max_idle(size_t max_idle) {
+	pool_max_idle = max_idle;
+}
+
+struct HttpPoolStats http_pool_get_stats(void) {
+	pthread_mutex_lock(&pool_lock);
+	struct HttpPoolStats ret = pool_stats;
+	ret.idle_connections = pool_idle_count;
+	pthread_mutex_unlock(&pool_lock);
+	return ret;
+}
+
+void http_pool_cleanup(void) {
+	pthread_mutex_lock(&pool_lock);
+	while (pool_idle) {
+		http_connection *conn = pool_idle;
+		pool_idle = conn->next;
+		connection_close(conn);
+	}
+	pool_idle_count = 0;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+enum parser_state {
+	ParserState_Header, /**< @brief Waiting for the end of the http header */
+	ParserState_Body, /**< @brief Header parsed, receiving the body */
+	ParserState_Complete, /**< @brief The whole response has been received */
+	ParserState_Error, /**< @brief The response is malformed or incomplete */
+};
+
+enum content_encoding {
+	ContentEncoding_Identity,
+	ContentEncoding_Gzip, /**< @brief gzip, also used for zlib wrapped deflate */
+	ContentEncoding_Deflate,
+	ContentEncoding_Other,
+};
+
+enum chunk_state {
+	ChunkState_Size, /**< @brief Reading the hexadecimal chunk size */
+	ChunkState_Extension, /**< @brief Skipping chunk extensions up to the end of the size line */
+	ChunkState_Data, /**< @brief Reading chunk data */
+	ChunkState_DataEnd, /**< @brief Reading the line break after the chunk data */
+	ChunkState_Trailer, /**< @brief Skipping trailer fields after the last chunk */
+};
+
+/** \brief Incremental parser of an http response. Every received byte is examined exactly once */
+struct http_parser {
+	enum parser_state state;
+	size_t parsed; /**< @brief Number of bytes of the buffer already processed */
+	unsigned header_match; /**< @brief Number of bytes of the header terminator matched so far */
+	size_t header_length; /**< @brief Length of the header including the terminating empty line */
+	int http_code;
+	bool keep_alive; /**< @brief The server allows the connection to be reused */
+	bool head_request; /**< @brief The response answers a HEAD request and has no body */
+	bool has_content_length;
+	size_t content_length;
+	bool chunked;
+	enum content_encoding encoding;
+	size_t body_length; /**< @brief Number of body bytes received so far, after chunked decoding */
+	size_t decoded; /**< @brief End of the decoded body in the buffer */
+	enum chunk_state chunk_state;
+	size_t chunk_remaining; /**< @brief Size of the current chunk while reading the size line, afterwards the bytes left */
+	unsigned chunk_digits; /**< @brief Number of digits of the current chunk size */
+	size_t trailer_line_length; /**< @brief Length of the current trailer line */
+};
+
+/** \brief Resets a parser for a new response
+ *
+ * \param parser struct http_parser* parser
+ * \return void
+ *
+ */
+static void http_parser_init(struct http_parser *parser) {
+	*parser = (struct http_parser) { .state = ParserState_Header };
+}
+
+/** \brief Checks case-insensitively whether a header line starts with @p name followed by a colon
+ *
+ * \param line char const* header line, not NUL terminated
+ * \param length size_t length of @p line
+ * \param name char const*const header name
+ * \return char const* start of the value with leading spaces skipped, 0 if the name does not match
+ *
+ */
+static char const* http_header_value(char const *line, size_t length, char const *const name) {
+	size_t name_len = strlen(name);
+	if (length <= name_len || line[name_len] != ':' || strncasecmp(line, name, name_len))
+		return 0;
+	char const *value = line + name_len + 1;
+	while (value < line + length && (*value == ' ' || *value == '\t'))
+		value++;
+	return value;
+}
+
+/** \brief Checks case-insensitively whether a header value contains @p token
+ *
+ * \param value char const* header value, not NUL terminated
+ * \param length size_t length of @p value
+ * \param token char const*const token to search for
+ * \return bool true if found
+ *
+ */
+static bool http_header_has_token(char const *value, size_t length, char const *const token) {
+	size_t token_len = strlen(token);
+	for (size_t i = 0; i + token_len <= length; i++) {
+		if (!strncasecmp(value + i, token, token_len))
+			return true;
+	}
+	return false;
+}
+
+/** \brief Parses the value of a Content-Length header
+ *
+ * \param value char const* start of the value, leading spaces skipped
+ * \param end char const* end of the header line
+ * \param content_length size_t* receives the value
+ * \return bool false if the value is empty, not a decimal number or does not fit into size_t
+ *
+ */
+static bool http_parse_content_length(char const *value, char const *end, size_t *content_length) {
+	while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	if (value == end)
+		return false;
+	*content_length = 0;
+	for (; value < end; value++) {
+		if (*value < '0' || *value > '9' || *content_length > (SIZE_MAX - (*value - '0')) / 10)
+			return false;
+		*content_length = *content_length * 10 + *value - '0';
+	}
+	return true;
+}
+
+/** \brief Parses the status line and the header fields once the header is complete
+ *
+ * \param parser struct http_parser* parser
+ * \param header char const* start of the response
+ * \return bool false if the header is malformed
+ *
+ */
+static bool http_parser_parse_header(struct http_parser *parser, char const *header) {
+	char const *end = header + parser->header_length;
+	char const *line_end = memchr(header, '\n', parser->header_length);
+	if (!line_end || parser->header_length < strlen("HTTP/1.1 200") || strncmp(header, "HTTP/1.", strlen("HTTP/1."))
+			|| header[8] != ' ')
+		return false;
+	bool http_1_1 = header[7] != '0';
+	parser->http_code = 0;
+	for (char const *pos = header + 9; pos < header + 12; pos++) {
+		if (*pos < '0' || *pos > '9')
+			return false;
+		parser->http_code = parser->http_code * 10 + *pos - '0';
+	}
+
+	bool close = false, keep_alive = false;
+	for (char const *line = line_end + 1; line < end; line = line_end + 1) {
+		line_end = memchr(line, '\n', end - line);
+		if (!line_end)
+			break;
+		size_t length = line_end - line;
+		if (length && line[length - 1] == '\r')
+			length--;
+		char const *value = 0;
+		if ((value = http_header_value(line, length, "Content-Length"))) {
+			size_t content_length = 0;
+			if (!http_parse_content_length(value, line + length, &content_length)
+					|| (parser->has_content_length && parser->content_length != content_length))
+				return false; // Malformed, too large or conflicting with a previous Content-Length
+			parser->has_content_length = true;
+			parser->content_length = content_length;
+		} else if ((value = http_header_value(line, length, "Content-Encoding"))) {
+			size_t value_length = line + length - value;
+			if (http_header_has_token(value, value_length, "gzip"))
+				parser->encoding = ContentEncoding_Gzip;
+			else if (http_header_has_token(value, value_length, "deflate"))
+				parser->encoding = ContentEncoding_Deflate;
+			else if (value_length && !http_header_has_token(value, value_length, "identity"))
+				parser->encoding = ContentEncoding_Other;
+		} else if ((value = http_header_value(line, length, "Transfer-Encoding"))) {
+			parser->chunked = http_header_has_token(value, line + length - value, "chunked");
+		} else if ((value = http_header_value(line, length, "Connection"))) {
+			close = http_header_has_token(value, line + length - value, "close");
+			keep_alive = http_header_has_token(value, line + length - value, "keep-alive");
+		}
+	}
+	if (parser->chunked)
+		parser->has_content_length = false; // Transfer-Encoding overrides Content-Length
+	parser->keep_alive = http_1_1 ? !close : keep_alive;
+	return true;
+}
+
+/** \brief Checks whether the response is an interim response, which is followed by the final response
+ * \details 101 Switching Protocols is final, the connection is not HTTP anymore afterwards.
+ */
+static bool http_parser_is_interim(struct http_parser const *const parser) {
+	return parser->http_code >= 100 && parser->http_code < 200 && parser->http_code != 101;
+}
+
+/** \brief Checks whether the response has no body according to its status code */
+static bool http_parser_has_no_body(struct http_parser const *const parser) {
+	return parser->head_request || (parser->http_code >= 100 && parser->http_code < 200) || parser->http_code == 204
+			|| parser->http_code == 304;
+}
+
+/** \brief Completes a chunk size line
+ *
+ * \param parser struct http_parser* parser
+ * \return void
+ *
+ */
+static void http_parser_chunk_size_done(struct http_parser *parser) {
+	if (!parser->chunk_digits)
+		parser->state = ParserState_Error;
+	else if (parser->chunk_remaining)
+		parser->chunk_state = ChunkState_Data;
+	else
+		parser->chunk_state = ChunkState_Trailer; // Last chunk
+	parser->trailer_line_length = 0;
+}
+
+/** \brief Decodes a chunked body in place
+ * \details Chunk data is moved down to the end of the body decoded so far, so the body ends up contiguous
+ directly after the header.
+ *
+ * \param parser struct http_parser* parser
+ * \param buffer char* received bytes
+ * \param length size_t number of received bytes
+ * \return size_t end of the decoded body in @p buffer
+ *
+ */
+static size_t http_parser_decode_chunked(struct http_parser *parser, char *buffer, size_t length) {
+	size_t decoded = parser->decoded;
+	while (parser->parsed < length && parser->state == ParserState_Body) {
+		if (parser->chunk_state == ChunkState_Data) {
+			size_t count = length - parser->parsed;
+			if (count > parser->chunk_remaining)
+				count = parser->chunk_remaining;
+			if (decoded != parser->parsed)
+				memmove(buffer + decoded, buffer + parser->parsed, count);
+			decoded += count;
+			parser->parsed += count;
+			parser->body_length += count;
+			parser->chunk_remaining -= count;
+			if (!parser->chunk_remaining)
+				parser->chunk_state = ChunkState_DataEnd;
+			continue;
+		}
+
+		char ch = buffer[parser->parsed++];
+		switch (parser->chunk_state) {
+		case ChunkState_Size:
+			if (isxdigit((unsigned char) ch)) {
+				if (parser->chunk_remaining > SIZE_MAX / 16) {
+					parser->state = ParserState_Error;
+					break;
+				}
+				int digit = isdigit((unsigned char) ch) ? ch - '0' : tolower((unsigned char) ch) - 'a' + 10;
+				parser->chunk_remaining = parser->chunk_remaining * 16 + digit;
+				parser->chunk_digits++;
+			} else if (ch == '\n') {
+				http_parser_chunk_size_done(parser);
+			} else if (ch == ';' || ch == ' ' || ch == '\t' || ch == '\r') {
+				parser->chunk_state = ChunkState_Extension;
+			} else {
+				parser->state = ParserState_Error;
+			}
+			break;
+		case ChunkState_Extension:
+			if (ch == '\n')
+				http_parser_chunk_size_done(parser);
+			break;
+		case ChunkState_DataEnd:
+			if (ch == '\n') {
+				parser->chunk_state = ChunkState_Size;
+				parser->chunk_digits = 0;
+			} else if (ch != '\r') {
+				parser->state = ParserState_Error;
+			}
+			break;
+		case ChunkState_Trailer:
+			if (ch == '\n') {
+				if (!parser->trailer_line_length)
+					parser->state = ParserState_Complete;
+				parser->trailer_line_length = 0;
+			} else if (ch != '\r') {
+				parser->trailer_line_length++;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+	return decoded;
+}
+
+/** \brief Processes the bytes of @p buffer which have not been processed yet
+ * \details @p buffer must contain the whole response received so far. Only bytes after parser->parsed are examined.
+ A chunked body is decoded in place, which shortens the received data. Bytes following a complete response are
+ kept after the body.
+ *
+ * \param parser struct http_parser* parser
+ * \param buffer char* received bytes
+ * \param length size_t* number of received bytes, updated if the buffer has been shortened
+ * \return enum parser_state state after processing
+ *
+ */
+static enum parser_state http_parser_execute(struct http_parser *parser, char *buffer, size_t *length) {
+	static char const terminator[] = "\r\n\r\n";
+	while (parser->parsed < *length && parser->state == ParserState_Header) {
+		char ch = buffer[parser->parsed++];
+		if (ch == terminator[parser->header_match])
+			parser->header_match++;
+		else
+			parser->header_match = ch == '\r' ? 1 : 0;
+		if (parser->header_match == strlen(terminator)) {
+			parser->header_length = parser->parsed;
+			parser->decoded = parser->parsed;
+			if (!http_parser_parse_header(parser, buffer)) {
+				parser->state = ParserState_Error;
+			} else if (http_parser_is_interim(parser)) {
+				// Drop interim responses like 100 Continue or 103 Early Hints and parse the following response
+				bool head_request = parser->head_request;
+				size_t interim = parser->header_length;
+				memmove(buffer, buffer + interim, *length - interim);
+				*length -= interim;
+				http_parser_init(parser);
+				parser->head_request = head_request;
+			} else if (parser->http_code == 101) {
+				parser->keep_alive = false;
+				parser->state = ParserState_Complete;
+			} else if (http_parser_has_no_body(parser) || (parser->has_content_length && !parser->content_length)) {
+				parser->state = ParserState_Complete;
+			} else {
+				parser->state = ParserState_Body;
+			}
+		}
+	}
+	if (parser->state != ParserState_Body || parser->parsed == *length)
+		return parser->state;
+
+	if (parser->chunked) {
+		parser->decoded = http_parser_decode_chunked(parser, buffer, *length);
+		if (parser->decoded < parser->parsed) {
+			memmove(buffer + parser->decoded, buffer + parser->parsed, *length - parser->parsed);
+			*length -= parser->parsed - parser->decoded;
+			parser->parsed = parser->decoded;
+		}
+	} else {
+		size_t received = *length - parser->parsed;
+		if (parser->has_content_length && parser->body_length + received >= parser->content_length) {
+			received = parser->content_length - parser->body_length;
+			parser->state = ParserState_Complete;
+		}
+		parser->body_length += received;
+		parser->parsed += received;
+		parser->decoded = parser->parsed;
+	}
+	return parser->state;
+}
+
+/** \brief Tells the parser that the connection has been closed by the server
+ * \details A response without Content-Length and chunked encoding ends with the connection.
+ *
+ * \param parser struct http_parser* parser
+ * \return enum parser_state ParserState_Complete or ParserState_Error
+ *
+ */
+static enum parser_state http_parser_finish(struct http_parser *parser) {
+	if (parser->state == ParserState_Body && !parser->has_content_length && !parser->chunked) {
+		parser->state = ParserState_Complete;
+		parser->keep_alive = false;
+	} else if (parser->state != ParserState_Complete) {
+		parser->state = ParserState_Error;
+	}
+	return parser->state;
+}
+
+/** \brief Returns how many body bytes can be taken from the connection without being parsed
+ * \details These are the remaining bytes of a Content-Length body, the remaining data of the current chunk or any
+ number of bytes of a body which ends with the connection. All received bytes must have been processed before.
+ *
+ * \param parser struct http_parser const* parser
+ * \param length size_t number of bytes in the buffer
+ * \return size_t number of bytes, 0 if the next bytes need to be parsed
+ *
+ */
+static size_t http_parser_raw_body(struct http_parser const *const parser, size_t length) {
+	if (parser->state != ParserState_Body || parser->parsed != length)
+		return 0;
+	if (parser->chunked)
+		return parser->chunk_state == ChunkState_Data ? parser->chunk_remaining : 0;
+	if (parser->has_content_length)
+		return parser->content_length - parser->body_length;
+	return SIZE_MAX;
+}
+
+/** \brief Accounts for @p count body bytes which have been taken from the connection without being parsed
+ *
+ * \param parser struct http_parser* parser
+ * \param count size_t number of bytes, at most what http_parser_raw_body returned
+ * \return enum parser_state state after processing
+ *
+ */
+static enum parser_state http_parser_skip_body(struct http_parser *parser, size_t count) {
+	parser->body_length += count;
+	if (parser->chunked) {
+		parser->chunk_remaining -= count;
+		if (!parser->chunk_remaining)
+			parser->chunk_state = ChunkState_DataEnd;
+	} else if (parser->has_content_length && parser->body_length == parser->content_length) {
+		parser->state = ParserState_Complete;
+	}
+	return parser->state;
+}
+
+/** \brief Moves the body of a response from the socket into a file descriptor inside the kernel */
+struct http_splice {
+	int fd; /**< @brief Destination */
+	int pipe[2]; /**< @brief Pipe between socket and @p fd, splice needs one end to be a pipe. -1 if not available */
+	bool write_body; /**< @brief The body of the current response is written to @p fd */
+	bool enabled; /**< @brief Splicing is possible for the current response */
+	bool failed; /**< @brief Writing to @p fd failed, the transfer is aborted */
+};
+
+/** \brief A response being received over a connection */
+struct http_response {
+	struct http_parser parser;
+	char *buffer; /**< @brief Received bytes, always NUL terminated */
+	size_t length; /**< @brief Number of received bytes */
+	size_t capacity; /**< @brief Size of @p buffer */
+	size_t received; /**< @brief Number of bytes received over the connection, including chunk framing */
+	struct HttpStreamCallbacks const *stream; /**< @brief Body is passed to these callbacks instead of being collected, may be 0 */
+	struct http_splice *splice; /**< @brief Raw body bytes are moved to a file descriptor, may be 0 */
+	bool headers_delivered; /**< @brief on_headers has been called */
+	bool aborted; /**< @brief A stream callback requested to abort the transfer */
+	struct http_inflate *inflate; /**< @brief Decompresses the body, 0 if it is not compressed */
+	bool timed; /**< @brief Record the arrival of the first byte */
+	int64_t first_byte; /**< @brief Moment in microseconds of clock_now_us the first byte arrived, 0 before */
+};
+
+/** \brief Incremental decompression of a gzip or deflate encoded body */
+struct http_inflate {
+	z_stream stream;
+	bool raw_deflate; /**< @brief Fall back to deflate data without zlib header */
+	bool finished; /**< @brief The end of the compressed data has been reached */
+	size_t input; /**< @brief End of the compressed bytes already decompressed in the receive buffer */
+	size_t compressed_length;
+	size_t decompressed_length;
+	char *output; /**< @brief Header followed by the decompressed body, unless the response is streamed */
+	size_t output_length;
+	size_t output_capacity;
+};
+
+static _Atomic(bool) http_compression = false;
+
+void http_set_compression(bool enable) {
+	http_compression = enable;
+}
+
+/** \brief Frees the decompression state of @p response
+ *
+ * \param response struct http_response* response
+ * \return void
+ *
+ */
+static void http_response_inflate_free(struct http_response *response) {
+	if (response->inflate) {
+		inflateEnd(&response->inflate->stream);
+		free(response->inflate->output);
+		free(response->inflate);
+		response->inflate = 0;
+	}
+}
+
+/** \brief Appends decompressed bytes behind the header in the output buffer */
+static bool http_inflate_collect(char const *data, size_t length, void *user_data) {
+	struct http_inflate *state = user_data;
+	if (state->output_capacity - state->output_length <= length) {
+		size_t capacity = 2 * state->output_capacity;
+		if (capacity <= state->output_length + length)
+			capacity = state->output_length + length + 1;
+		char *output = realloc(state->output, capacity);
+		if (!output)
+			return false;
+		state->output = output;
+		state->output_capacity = capacity;
+	}
+	memcpy(state->output + state->output_length, data, length);
+	state->output_length += length;
+	state->output[state->output_length] = '\0';
+	return true;
+}
+
+/** \brief Decompresses @p length bytes of the body and passes the result to @p sink in blocks
+ *
+ * \param state struct http_inflate* decompression state
+ * \param data char const* compressed bytes
+ * \param length size_t number of compressed bytes
+ * \param sink HttpDataCallback* receives the decompressed bytes
+ * \param user_data void* passed to @p sink
+ * \return int Z_OK, Z_DATA_ERROR if the data is corrupt or Z_ERRNO if @p sink returned false
+ *
+ */
+static int http_inflate_process(struct http_inflate *state, char const *data, size_t length, HttpDataCallback *sink,
+		void *user_data) {
+	char block[STREAM_BUFFER_SIZE];
+	state->compressed_length += length;
+	z_stream *stream = &state->stream;
+	while (length && !state->finished) {
+		uInt input = length > UINT_MAX ? UINT_MAX : (uInt) length;
+		stream->next_in = (Bytef*) data;
+		stream->avail_in = input;
+		do {
+			stream->next_out = (Bytef*) block;
+			stream->avail_out = sizeof(block);
+			int status = inflate(stream, Z_NO_FLUSH);
+			if (status == Z_DATA_ERROR && !state->raw_deflate && !stream->total_out) {
+				// Some servers send deflate data without the zlib header
+				state->raw_deflate = true;
+				if (inflateReset2(stream, -MAX_WBITS) != Z_OK)
+					return Z_DATA_ERROR;
+				stream->next_in = (Bytef*) data;
+				stream->avail_in = input;
+				continue;
+			}
+			if (status != Z_OK && status != Z_STREAM_END && status != Z_BUF_ERROR)
+				return Z_DATA_ERROR;
+			size_t produced = sizeof(block) - stream->avail_out;
+			state->decompressed_length += produced;
+			if (produced && sink && !sink(block, produced, user_data))
+				return Z_ERRNO;
+			if (status == Z_STREAM_END) {
+				state->finished = true;
+				break;
+			}
+		} while (stream->avail_in || !stream->avail_out);
+		data += input - stream->avail_in;
+		length -= input - stream->avail_in;
+		if (stream->avail_in && !state->finished)
+			return Z_DATA_ERROR;
+	}
+	return Z_OK;
+}
+
+/** \brief Sets up decompression once the header of @p response is complete
+ *
+ * \param response struct http_response* response
+ * \return bool false if out of memory
+ *
+ */
+static bool http_response_inflate_init(struct http_response *response) {
+	struct http_parser const *parser = &response->parser;
+	if (!http_compression || (parser->encoding != ContentEncoding_Gzip && parser->encoding != ContentEncoding_Deflate))
+		return true;
+	struct http_inflate *state = calloc(1, sizeof(struct http_inflate));
+	if (!state)
+		return false;
+	// 32 lets zlib detect gzip and zlib headers
+	if (inflateInit2(&state->stream, MAX_WBITS + 32) != Z_OK) {
+		free(state);
+		return false;
+	}
+	state->input = parser->header_length;
+	response->inflate = state;
+	if (!response->stream) {
+		state->output_capacity = parser->header_length + RESPONSE_INITIAL_BUFFER;
+		state->output = malloc(state->output_capacity);
+		if (!state->output) {
+			http_response_inflate_free(response);
+			return false;
+		}
+		memcpy(state->output, response->buffer, parser->header_length);
+		state->output_length = parser->header_length;
+		state->output[state->output_length] = '\0';
+	}
+	return true;
+}
+
+/** \brief Makes room for at least @p needed more bytes plus the terminating NUL in the buffer of @p response
+ * \details The buffer grows geometrically, so receiving a response of unknown length costs amortized linear time.
+ The new memory is not initialized.
+ *
+ * \param response struct http_response* response
+ * \param needed size_t number of bytes to be appended
+ * \return bool false if out of memory
+ *
+ */
+static bool http_response_reserve(struct http_response *response, size_t needed) {
+	if (response->capacity - response->length > needed)
+		return true;
+	size_t capacity = response->capacity ? 2 * response->capacity : RESPONSE_INITIAL_BUFFER;
+	if (capacity < response->length + needed + 1)
+		capacity = response->length + needed + 1;
+	char *buffer = realloc(response->buffer, capacity);
+	if (!buffer)
+		return false;
+	response->buffer = buffer;
+	response->capacity = capacity;
+	return true;
+}
+
+/** \brief Returns how many bytes should be read next for @p response
+ * \details Once the header announced a Content-Length the buffer grows towards it, but by at most the size of the
+ data received so far and RESPONSE_MAX_READ per step. A bogus Content-Length can not make it allocate more than
+ twice the memory of what actually arrived.
+ *
+ * \param response struct http_response const* response
+ * \return size_t number of bytes
+ *
+ */
+static size_t http_response_next_read(struct http_response const *const response) {
+	struct http_parser const *parser = &response->parser;
+	if (parser->state == ParserState_Body && response->stream)
+		return 1; // A streamed body is read into the fixed buffer, which is emptied after every read
+	if (parser->state == ParserState_Body && parser->has_content_length
+			&& parser->content_length > parser->body_length) {
+		size_t remaining = parser->content_length - parser->body_length;
+		size_t step = response->length < RESPONSE_MIN_READ ? RESPONSE_MIN_READ : response->length;
+		if (step > RESPONSE_MAX_READ)
+			step = RESPONSE_MAX_READ;
+		return remaining < step ? remaining : step;
+	}
+	return RESPONSE_MIN_READ;
+}
+
+/** \brief Passes header and decoded body bytes of a streamed response to the callbacks and removes them from the buffer
+ *
+ * \param response struct http_response* response
+ * \return void
+ *
+ */
+static void http_response_deliver(struct http_response *response) {
+	struct http_parser *parser = &response->parser;
+	struct HttpStreamCallbacks const *stream = response->stream;
+	if (parser->state == ParserState_Header || parser->state == ParserState_Error)
+		return;
+	size_t start = 0;
+	if (!response->headers_delivered) {
+		response->headers_delivered = true;
+		if (stream->on_headers && !stream->on_headers(parser->http_code, response->buffer, parser->header_length,
+				stream->user_data)) {
+			response->aborted = true;
+			return;
+		}
+		start = parser->header_length;
+	}
+	if (parser->decoded > start && response->inflate) {
+		int status = http_inflate_process(response->inflate, response->buffer + start, parser->decoded - start,
+				stream->on_data, stream->user_data);
+		if (status != Z_OK) {
+			response->aborted = status == Z_ERRNO;
+			parser->state = ParserState_Error;
+			return;
+		}
+	} else if (parser->decoded > start && stream->on_data
+			&& !stream->on_data(response->buffer + start, parser->decoded - start, stream->user_data)) {
+		response->aborted = true;
+		return;
+	}
+	// Keep only the bytes which have not been parsed yet
+	memmove(response->buffer, response->buffer + parser->decoded, response->length - parser->decoded);
+	response->length -= parser->decoded;
+	parser->parsed -= parser->decoded;
+	parser->decoded = 0;
+}
+
+/** \brief Appends @p count bytes read into the free space of the buffer of @p response and parses them
+ *
+ * \param response struct http_response* response
+ * \param count size_t number of bytes read
+ * \return enum parser_state state of the parser
+ *
+ */
+static enum parser_state http_response_append(struct http_response *response, size_t count) {
+	response->received += count;
+	response->length += count;
+	bool in_header = response->parser.state == ParserState_Header;
+	enum parser_state state = http_parser_execute(&response->parser, response->buffer, &response->length);
+	if (in_header && state != ParserState_Header && state != ParserState_Error
+			&& !http_response_inflate_init(response)) {
+		response->parser.state = state = ParserState_Error;
+	}
+	if (response->stream) {
+		http_response_deliver(response);
+		if (response->aborted || response->parser.state == ParserState_Error)
+			state = ParserState_Error;
+	} else if (response->inflate && response->parser.decoded > response->inflate->input) {
+		struct http_inflate *decompress = response->inflate;
+		int status = http_inflate_process(decompress, response->buffer + decompress->input,
+				response->parser.decoded - decompress->input, http_inflate_collect, decompress);
+		decompress->input = response->parser.decoded;
+		if (status != Z_OK)
+			response->parser.state = state = ParserState_Error;
+	}
+	response->buffer[response->length] = '\0';
+	return state;
+}
+
+/** \brief Checks whether the connection of a complete response can be reused for the next request
+ * \details The server must allow it and must not have sent anything behind the response. Such bytes would be taken
+ as the start of the next response.
+ *
+ * \param response struct http_response const* complete response
+ * \return bool true if the connection can be released into the pool
+ *
+ */
+static bool http_response_reusable(struct http_response const *const response) {
+	return response->parser.keep_alive && response->length == response->parser.parsed;
+}
+
+/** \brief Moves bytes received behind the end of a complete response into a new response
+ * \details Pipelined responses can arrive in the same read as the end of the previous response.
+ *
+ * \param from struct http_response* complete response
+ * \param to struct http_response* receives the following bytes, its parser is not initialized
+ * \return bool false if out of memory
+ *
+ */
+static bool http_response_take_leftover(struct http_response *from, struct http_response *to) {
+	size_t leftover = from->length - from->parser.decoded;
+	*to = (struct http_response) { 0 };
+	if (!leftover)
+		return true;
+	if (!http_response_reserve(to, leftover))
+		return false;
+	memcpy(to->buffer, from->buffer + from->parser.decoded, leftover);
+	to->length = leftover;
+	to->received = leftover;
+	from->length = from->parser.decoded;
+	from->received -= leftover;
+	return true;
+}
+
+/** \brief Generate user agent for http request
+ *
+ * \param void
+ * \return char* string containing user agent, must be freed by user
+ *
+ */
+static char* socket_get_useragent(char const *const user_agent) {
+	char *ret = 0;
+	if (user_agent) {
+		ret = malloc(100 * sizeof(char));
+		if (ret) {
+			strcpy(ret, "User-Agent: ");
+			strcat(ret, user_agent);
+			char *new_mem = realloc(ret, (strlen(ret) + 1) * sizeof(char));
+			ret = new_mem ? new_mem : ret;
+		}
+	}
+	return ret;
+}
+
+/** \brief Creates http request with the given method. needs to be freed by the user
+ *
+ * \param method char const*const request method, e.g. "GET"
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const additional info to be placed into http header
+ * \param accept_encoding bool true to ask for a compressed response
+ * \return char* string containing http 1.1 request
+ *
+ */
+static char* http_build_request(char const *const method, char const *const host, char const *const file,
+		char const *const add_info, bool accept_encoding) {
+	char *request = 0;
+	if (host && file) {
+		size_t const header_max = 2000;
+		request = calloc(header_max, sizeof(char));
+		char const *const close = "close";
+		char const *const keep = "keep-alive";
+		char const *const connection = pool_idle_timeout ? keep : close;
+		if (request) {
+			// Each header line must end with CRLF, an additional empty line would be read as the next request
+			size_t info_len = add_info ? strlen(add_info) : 0;
+			bool info_terminated = info_len >= 2 && !strcmp(add_info + info_len - 2, "\r\n");
+			snprintf(request, header_max,
+					"%s %s HTTP/1.1\r\nHost: %s\r\nConnection: %s\r\nAccept: text/plain\r\n%s%s%s\r\n",
+					method, file, host, connection, accept_encoding ? "Accept-Encoding: gzip, deflate\r\n" : "",
+					info_len ? add_info : "",
+					info_len && !info_terminated ? "\r\n" : "");
+			char *new_req = realloc(request, strlen(request) + 1);
+			if (new_req) {
+				request = new_req;
+			}
+		}
+	}
+	return request;
+}
+
+/** \brief Creates http GET request. needs to be freed by the user
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const additional info to be placed into http header
+ * \return char* string containing http 1.1 request
+ *
+ */
+static char* http_create_request(char const *const host, char const *const file, char const *const add_info) {
+	return http_build_request("GET", host, file, add_info, http_compression);
+}
+
+/** \brief Appends a header line to the additional header info. Needs to be freed by the user
+ *
+ * \param add_info char const*const additional info to be placed into http header, or 0
+ * \param line char const*const header line to be appended
+ * \return char* header lines, 0 on error
+ *
+ */
+static char* http_join_header_line(char const *const add_info, char const *const line) {
+	size_t info_len = add_info ? strlen(add_info) : 0;
+	char *ret = malloc(info_len + strlen("\r\n") + strlen(line) + 1);
+	if (ret) {
+		strcpy(ret, info_len ? add_info : "");
+		if (info_len && (info_len < 2 || strcmp(add_info + info_len - 2, "\r\n")))
+			strcat(ret, "\r\n");
+		strcat(ret, line);
+	}
+	return ret;
+}
+
+/** \brief Finds a header field in a complete http header
+ *
+ * \param header char const* http header
+ * \param header_length size_t length of @p header
+ * \param name char const*const header name, compared case-insensitively
+ * \param value_length size_t* receives the length of the value
+ * \return size_t offset of the value in @p header, 0 if the header has no such field
+ *
+ */
+static size_t http_header_find(char const *header, size_t header_length, char const *const name,
+		size_t *value_length) {
+	char const *end = header + header_length;
+	for (char const *line = header; line < end;) {
+		char const *line_end = memchr(line, '\n', end - line);
+		if (!line_end)
+			break;
+		size_t length = line_end - line;
+		if (length && line[length - 1] == '\r')
+			length--;
+		char const *value = http_header_value(line, length, name);
+		if (value) {
+			*value_length = line + length - value;
+			return value - header;
+		}
+		line = line_end + 1;
+	}
+	return 0;
+}
+
+/** \brief Finds a header field of a parsed response
+ *
+ * \param response struct http_response const* response with a complete header
+ * \param name char const*const header name, compared case-insensitively
+ * \param value_length size_t* receives the length of the value
+ * \return size_t offset of the value in the buffer, 0 if the header has no such field
+ *
+ */
+static size_t http_response_find_header(struct http_response const *const response, char const *const name,
+		size_t *value_length) {
+	return http_header_find(response->buffer, response->parser.header_length, name, value_length);
+}
+
+/** \brief Get error message from http header
+ * \details For a 301 response the new location is appended behind the response, so header and body stay untouched.
+ *
+ * \param http_code int http code of the response
+ * \param response struct http_response* complete response, its buffer may be reallocated
+ * \return char* error message pointing into the buffer of @p response
+ *
+ */
+static char* http_get_error_msg(int http_code, struct http_response *response) {
+	char *ret = 0;
+	switch (http_code) {
+	case 301: {
+		size_t value_length = 0;
+		size_t value_offset = http_response_find_header(response, "Location", &value_length);
+		if (value_offset) {
+			size_t end = response->parser.decoded + 1;
+			response->length = end;
+			if (http_response_reserve(response, value_length)) {
+				memcpy(response->buffer + end, response->buffer + value_offset, value_length);
+				response->buffer[end + value_length] = '\0';
+				ret = response->buffer + end;
+			}
+		}
+		break;
+	}
+	default:
+		// Nothing
+#warning "Currently only HTTP Error code 301 is handled. Every other error code is not handled but rather directly forwarded to the calling context."
+		ret = response->buffer;
+		break;
+	}
+
+	return ret;
+}
+
+/** \brief Reads from a connection
+ *
+ * \param conn http_connection* connection
+ * \param buffer char* destination
+ * \param length size_t size of @p buffer
+ * \param wait_events short* set to the events to wait for if the operation has to be retried, 0 otherwise
+ * \return int number of bytes read, 0 on end of stream, -1 on error or if the operation has to be retried
+ *
+ */
+static int connection_read(http_connection *conn, char *buffer, size_t length, short *wait_events) {
+	*wait_events = 0;
+	if (conn->bio) {
+		int n = BIO_read(conn->bio, buffer, length);
+		if (n <= 0 && BIO_should_retry(conn->bio)) {
+			*wait_events = BIO_should_write(conn->bio) ? POLLOUT : POLLIN;
+			return -1;
+		}
+		return n < 0 ? -1 : n;
+	}
+	int n = socket_receive(conn->socket, buffer, length, 0);
+	if (n < 0) {
+		int error = get_last_error();
+		if (socket_would_block(error))
+			*wait_events = POLLIN;
+#ifndef _WIN32
+		else if (error == ECONNRESET)
+			return 0;
+#endif
+	}
+	return n;
+}
+
+/** \brief Writes all of @p data to a blocking file descriptor
+ *
+ * \param fd int file descriptor
+ * \param data char const* data to be written
+ * \param length size_t length of @p data
+ * \return bool false on error
+ *
+ */
+static bool fd_write_all(int fd, char const *data, size_t length) {
+	while (length) {
+		ssize_t n = write(fd, data, length);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		length -= n;
+	}
+	return true;
+}
+
+#ifndef _WIN32
+/** \brief Writes all of @p data to a file at @p offset without moving the file position
+ *
+ * \param fd int file descriptor of a seekable file
+ * \param data char const* data to be written
+ * \param length size_t length of @p data
+ * \param offset off_t position in the file
+ * \return bool false on error
+ *
+ */
+static bool fd_pwrite_all(int fd, char const *data, size_t length, off_t offset) {
+	while (length) {
+		ssize_t n = pwrite(fd, data, length, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		data += n;
+		length -= n;
+		offset += n;
+	}
+	return true;
+}
+#endif
+
+#ifdef __linux__
+/** \brief Moves up to @p length bytes from a plain connection into the destination of @p sink without copying them to user space
+ * \details If the destination does not support splice, the bytes are copied through user space and splicing is disabled.
+ *
+ * \param conn http_connection* plain, non blocking connection
+ * \param sink struct http_splice* destination
+ * \param length size_t maximum number of bytes
+ * \param wait_events short* set to the events to wait for if the operation has to be retried, 0 otherwise
+ * \return ssize_t number of bytes moved, 0 on EOF, -1 on error or if the operation has to be retried. A failed write to
+ the destination sets failed of @p sink
+ *
+ */
+static ssize_t connection_splice(http_connection *conn, struct http_splice *sink, size_t length, short *wait_events) {
+	*wait_events = 0;
+	if (length > SPLICE_BLOCK_SIZE)
+		length = SPLICE_BLOCK_SIZE;
+	ssize_t n = splice(conn->socket, 0, sink->pipe[1], 0, length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n < 0) {
+		if (errno == EAGAIN)
+			*wait_events = POLLIN;
+		else if (errno == ECONNRESET)
+			return 0;
+		return -1;
+	}
+	for (ssize_t moved = 0; moved < n;) {
+		ssize_t m = splice(sink->pipe[0], 0, sink->fd, 0, n - moved, SPLICE_F_MOVE);
+		if (m < 0 && errno == EINTR)
+			continue;
+		if (m < 0 && errno == EINVAL) {
+			// The destination does not support splice, empty the pipe through user space
+			sink->enabled = false;
+			char buffer[SPLICE_BLOCK_SIZE / 16];
+			while (moved < n) {
+				ssize_t r = read(sink->pipe[0], buffer, sizeof(buffer));
+				if (r <= 0 || !fd_write_all(sink->fd, buffer, r)) {
+					sink->failed = true;
+					return -1;
+				}
+				moved += r;
+			}
+			break;
+		}
+		if (m <= 0) {
+			sink->failed = true;
+			return -1;
+		}
+		moved += m;
+	}
+	return n;
+}
+#endif
+
+/** \brief Writes to a connection
+ * \details SIGPIPE is suppressed, so writing to a connection the server has closed only fails.
+ *
+ * \param conn http_connection* connection
+ * \param data char const* data to be written
+ * \param length size_t length of @p data
+ * \param wait_events short* set to the events to wait for if the operation has to be retried, 0 otherwise
+ * \return int number of bytes written, -1 on error or if the operation has to be retried
+ *
+ */
+static int connection_write(http_connection *conn, char const *data, size_t length, short *wait_events) {
+	*wait_events = 0;
+	if (conn->bio) {
+#ifndef _WIN32
+		// The socket BIO uses write(), block SIGPIPE for this thread and discard it if it was raised
+		sigset_t sigpipe, old_mask, pending;
+		sigemptyset(&sigpipe);
+		sigaddset(&sigpipe, SIGPIPE);
+		sigpending(&pending);
+		bool was_pending = sigismember(&pending, SIGPIPE);
+		pthread_sigmask(SIG_BLOCK, &sigpipe, &old_mask);
+#endif
+		int n = BIO_write(conn->bio, data, length);
+		if (n <= 0 && BIO_should_retry(conn->bio))
+			*wait_events = BIO_should_read(conn->bio) ? POLLIN : POLLOUT;
+#ifndef _WIN32
+		sigpending(&pending);
+		if (!was_pending && sigismember(&pending, SIGPIPE)) {
+			struct timespec no_wait = { 0 };
+			sigtimedwait(&sigpipe, 0, &no_wait);
+		}
+		pthread_sigmask(SIG_SETMASK, &old_mask, 0);
+#endif
+		return n <= 0 ? -1 : n;
+	}
+	int n = socket_send(conn->socket, data, length);
+	if (n < 0 && socket_would_block(get_last_error()))
+		*wait_events = POLLOUT;
+	return n;
+}
+
+/** \brief Returns the number of bytes read from and written to the socket of an HTTPS connection since it was established
+ *
+ * \param conn http_connection* connection
+ * \param read uint64_t* receives the number of bytes read, including TLS framing
+ * \param written uint64_t* receives the number of bytes written, including TLS framing
+ * \return void
+ *
+ */
+static void connection_wire_bytes(http_connection *conn, uint64_t *read, uint64_t *written) {
+	BIO *socket_bio = conn->bio ? BIO_next(conn->bio) : 0;
+	if (socket_bio) {
+		*read = BIO_number_read(socket_bio);
+		*written = BIO_number_written(socket_bio);
+	}
+}
+
+/** \brief Writes all of @p data to a non blocking connection
+ *
+ * \param conn http_connection* connection
+ * \param data char const* data to be written
+ * \param length size_t length of @p data
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return enum EError EError_NoError on success
+ *
+ */
+static enum EError connection_write_all(http_connection *conn, char const *data, size_t length, int64_t deadline) {
+	size_t sent = 0;
+	while (sent < length) {
+		short wait_events = 0;
+		int n = connection_write(conn, data + sent, length - sent, &wait_events);
+		if (n < 0 && wait_events) {
+			if (socket_istimedout(deadline))
+				return EError_Timeout;
+			socket_wait(connection_get_socket(conn), wait_events, deadline);
+			continue;
+		}
+		if (n <= 0)
+			return EError_ConnectionError;
+		sent += n;
+	}
+	return EError_NoError;
+}
+
+/** \brief Receives a whole response from a non blocking connection
+ *
+ * \param conn http_connection* connection
+ * \param response struct http_response* receives the response, the buffer grows as needed
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return enum EError EError_NoError if the response is complete
+ *
+ */
+static enum EError connection_receive(http_connection *conn, struct http_response *response, int64_t deadline) {
+	while (true) {
+		if (socket_istimedout(deadline)) {
+			myperror(__LINE__, "Timeout during recv", ETIMEDOUT);
+			return EError_Timeout;
+		}
+		short wait_events = 0;
+		ssize_t n = -1;
+#ifdef __linux__
+		size_t raw = response->splice && response->splice->enabled && !conn->bio && !response->inflate ?
+				http_parser_raw_body(&response->parser, response->length) : 0;
+		if (raw) {
+			n = connection_splice(conn, response->splice, raw, &wait_events);
+			if (n > 0) {
+				if (response->timed && !response->first_byte)
+					response->first_byte = clock_now_us();
+				response->received += n;
+				if (http_parser_skip_body(&response->parser, n) == ParserState_Complete)
+					return EError_NoError;
+				continue;
+			}
+			if (response->splice->failed) {
+				response->aborted = true;
+				return EError_Aborted;
+			}
+		} else
+#endif
+		{
+			if (!http_response_reserve(response, http_response_next_read(response)))
+				return EError_OutOfMemory;
+			n = connection_read(conn, response->buffer + response->length,
+					response->capacity - response->length - 1, &wait_events);
+		}
+		if (n < 0 && wait_events) {
+			socket_wait(connection_get_socket(conn), wait_events, deadline);
+			continue;
+		}
+		if (n <= 0) {
+			// Connection closed by server
+			if (!response->received) {
+				int error = get_last_error();
+				myperror(__LINE__, "Error during recv", error);
+				return EError_ConnectionError;
+			}
+			return http_parser_finish(&response->parser) == ParserState_Complete ?
+					EError_NoError : EError_IncompleteResponse;
+		}
+		if (response->timed && !response->first_byte)
+			response->first_byte = clock_now_us();
+		switch (http_response_append(response, n)) {
+		case ParserState_Complete:
+			return EError_NoError;
+		case ParserState_Error:
+			return response->aborted ? EError_Aborted : EError_InvalidResponse;
+		default:
+			break;
+		}
+	}
+}
+
+/** \brief Converts a received response into struct HttpData. The buffer of @p response is handed over to the result
+ * \details On success the data of a 200 response points to the body behind the http header, nothing is copied.
+ Other responses are passed to http_get_error_msg.
+ A streamed response has already been passed to its callbacks and returns no data.
+ *
+ * \param response struct http_response* received response
+ * \param error enum EError result of receiving the response
+ * \return struct HttpData
+ *
+ */
+static struct HttpData http_response_to_data(struct http_response *response, enum EError error) {
+	struct http_parser *parser = &response->parser;
+	struct HttpData ret = { .error = error, .http_code = parser->http_code, .received_bytes = response->received,
+			.received_data_length = parser->body_length, .content_length = parser->content_length };
+	struct http_inflate *inflate = response->inflate;
+	if (inflate) {
+		ret.compressed_length = inflate->compressed_length;
+		ret.received_data_length = inflate->decompressed_length;
+		if (error == EError_NoError && inflate->compressed_length && !inflate->finished)
+			ret.error = error = EError_IncompleteResponse;
+		if (error == EError_NoError && !response->stream) {
+			// Continue with the header followed by the decompressed body
+			free(response->buffer);
+			response->buffer = inflate->output;
+			response->length = parser->decoded = inflate->output_length;
+			response->capacity = inflate->output_capacity;
+			inflate->output = 0;
+		}
+		http_response_inflate_free(response);
+	}
+	if (error == EError_NoError && !response->stream) {
+		// Drop bytes following the response
+		response->buffer[parser->decoded] = '\0';
+		if (ret.http_code == 200)
+			ret.data = response->buffer + parser->header_length;
+		else
+			ret.data = http_get_error_msg(ret.http_code, response);
+		ret.response = response->buffer;
+		ret.header_length = parser->header_length;
+	} else {
+		free(response->buffer);
+	}
+	response->buffer = 0;
+	return ret;
+}
+
+void http_data_free(struct HttpData *data) {
+	if (data) {
+#ifndef _WIN32
+		if (data->mapped_length)
+			munmap(data->response, data->mapped_length);
+		else
+#endif
+		free(data->response);
+		data->response = 0;
+		data->mapped_length = 0;
+		data->data = 0;
+	}
+}
+
+/** \brief Opens a new HTTP connection to host
+ *
+ * \param host char const*const host to be connected
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \param timing struct HttpTiming* receives the duration of the phases, may be 0
+ * \param error enum EError* receives the error code on failure
+ * \return http_connection* connection, 0 on error
+ *
+ */
+static http_connection* http_connection_open(char const *const host, int64_t deadline, struct HttpTiming *timing,
+		enum EError *error) {
+	http_connection *conn = connection_new(host, HTTP_PORT, false);
+	if (!conn) {
+		*error = EError_CreateSocketError;
+		return 0;
+	}
+	struct SocketFallible sock = socket_connect(host, HTTP_PORT, deadline, timing);
+	if (sock.error != EError_NoError) {
+		*error = sock.error;
+		connection_close(conn);
+		return 0;
+	}
+	conn->socket = sock.socket;
+	return conn;
+}
+
+static struct HttpData http_fetch(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, bool is_https, struct HttpStreamCallbacks const *stream,
+		struct http_splice *splice);
+static struct HttpData http_fetch_cached(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, bool is_https);
+
+/** \brief Connect to host and request file using HTTP. Add_info will be sent in request
+ *
+ * \param host char const*const address of host
+ * \param file char const*const requested file
+ * \param add_info char const*const additional info to be sent in header
+ * \return char* server response, http header removed. 0 if no valid response
+ *
+ */
+struct HttpData http_get(char const *const host, char const *const file, char const *const add_info, time_t timeout) {
+	return http_fetch_cached(host, file, add_info, timeout, false);
+}
+
+bool socket_check_connection(void) // This is not a good solution, but it should work.
+{
+	struct HttpData ret = http_get("www.google.com", "/", 0, 0);
+	bool connected = ret.data;
+	http_data_free(&ret);
+	return connected;
+}
+
+/** \brief Reports error message from openSSL library
+ *
+ */
+static void report_ssl_error(const char *msg) {
+	int error = get_last_error();
+	myperror(__LINE__, msg, error);
+#ifdef DIAGNOSTIC
+	ERR_print_errors_fp(stderr);
+#endif
+	ERR_clear_error();
+}
+
+typedef struct session_cache_entry session_cache_entry;
+
+/** \brief A TLS session which can be used to resume a handshake with a host */
+struct session_cache_entry {
+	char key[SESSION_KEY_SIZE]; /**< @brief host:port, see session_cache_key */
+	SSL_SESSION *session;
+	size_t last_used; /**< @brief Sequence number of the last store, used for replacement */
+};
+
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+static session_cache_entry session_cache[SESSION_CACHE_SIZE];
+static size_t session_sequence = 0;
+static char *session_file = 0;
+
+/** \brief Creates the key of the session cache for a TLS connection
+ * \details The key consists of the server name and the port of the peer. Sessions of connections which do not verify
+ the certificate get the suffix " unverified". Resuming a session skips the verification of the certificate chain, so
+ such a session must never be resumed by a connection which verifies.
+ *
+ * \param key char* destination, at least SESSION_KEY_SIZE bytes
+ * \param ssl SSL* connection with server name, verify mode and a connected socket
+ * \return bool false if the key can not be determined
+ *
+ */
+static bool session_cache_key(char *key, SSL *ssl) {
+	char const *host = SSL_get_servername(ssl, TLSEXT_NAMETYPE_host_name);
+	struct sockaddr_storage peer;
+	socklen_t length = sizeof(peer);
+	if (!host || strlen(host) >= POOL_MAX_HOSTNAME || getpeername(SSL_get_fd(ssl), (struct sockaddr*) &peer, &length))
+		return false;
+	unsigned short port = ntohs(peer.ss_family == AF_INET6 ? ((struct sockaddr_in6*) &peer)->sin6_port
+			: ((struct sockaddr_in*) &peer)->sin_port);
+	sprintf(key, "%s:%u%s", host, port, SSL_get_verify_mode(ssl) == SSL_VERIFY_NONE ? " unverified" : "");
+	return true;
+}
+
+/** \brief Stores a session for @p key. The cache takes ownership of @p session. Needs to be called with session_lock held
+ *
+ * \param key char const*const host:port
+ * \param session SSL_SESSION* session to be stored
+ * \return void
+ *
+ */
+static void session_cache_put_locked(char const *const key, SSL_SESSION *session) {
+	session_cache_entry *slot = 0;
+	for (size_t i = 0; i < SESSION_CACHE_SIZE; i++) {
+		session_cache_entry *entry = &session_cache[i];
+		if (entry->session && !strcmp(entry->key, key)) {
+			slot = entry;
+			break;
+		}
+		if (!slot || (slot->session && (!entry->session || entry->last_used < slot->last_used)))
+			slot = entry;
+	}
+	if (slot->session)
+		SSL_SESSION_free(slot->session);
+	strcpy(slot->key, key);
+	slot->session = session;
+	slot->last_used = ++session_sequence;
+}
+
+/** \brief Returns the session stored for a connection
+ *
+ * \param ssl SSL* connection, see session_cache_key
+ * \return SSL_SESSION* session which needs to be freed with SSL_SESSION_free, 0 if none is available
+ *
+ */
+static SSL_SESSION* session_cache_get(SSL *ssl) {
+	char key[SESSION_KEY_SIZE];
+	SSL_SESSION *ret = 0;
+	if (!session_cache_key(key, ssl))
+		return 0;
+	pthread_mutex_lock(&session_lock);
+	for (size_t i = 0; i < SESSION_CACHE_SIZE; i++) {
+		session_cache_entry *entry = &session_cache[i];
+		if (entry->session && !strcmp(entry->key, key)) {
+			if (SSL_SESSION_is_resumable(entry->session)) {
+				SSL_SESSION_up_ref(entry->session);
+				ret = entry->session;
+			}
+			break;
+		}
+	}
+	pthread_mutex_unlock(&session_lock);
+	return ret;
+}
+
+/** \brief Called by openSSL whenever the server issued a new session or session ticket
+ *
+ * \param ssl SSL* connection which received the session
+ * \param session SSL_SESSION* new session
+ * \return int 1 if the cache took ownership of @p session
+ *
+ */
+static int session_cache_new_cb(SSL *ssl, SSL_SESSION *session) {
+	char key[SESSION_KEY_SIZE];
+	if (!session_cache_key(key, ssl))
+		return 0;
+	pthread_mutex_lock(&session_lock);
+	session_cache_put_locked(key, session);
+	pthread_mutex_unlock(&session_lock);
+	return 1;
+}
+
+/** \brief Checks whether a session is expired
+ *
+ * \param session SSL_SESSION const* session to be checked
+ * \return bool true if expired
+ *
+ */
+static bool session_is_expired(SSL_SESSION const *session) {
+	return SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) < time(0);
+}
+
+/** \brief Reads the sessions stored in @p path into the cache
+ * \details The file consists of records of a NUL terminated host:port key, followed by the 4 byte big endian length and the DER encoding of the session.
+ *
+ * \param path char const*const session file
+ * \return bool true if the file has been read or does not exist yet, false if it is unreadable or damaged
+ *
+ */
+static bool session_cache_load(char const *const path) {
+	FILE *file = fopen(path, "rb");
+	if (!file)
+		return errno == ENOENT;
+	unsigned char der[SESSION_MAX_DER];
+	char key[SESSION_KEY_SIZE];
+	bool complete = false;
+	pthread_mutex_lock(&session_lock);
+	while (true) {
+		size_t key_len = 0;
+		int ch = 0;
+		while ((ch = fgetc(file)) > 0 && key_len < sizeof(key) - 1)
+			key[key_len++] = ch;
+		if (ch == EOF && !key_len) {
+			complete = !ferror(file);
+			break;
+		}
+		if (ch != 0)
+			break;
+		key[key_len] = '\0';
+		unsigned char len_bytes[4];
+		if (fread(len_bytes, 1, 4, file) != 4)
+			break;
+		size_t der_len = (size_t) len_bytes[0] << 24 | len_bytes[1] << 16 | len_bytes[2] << 8 | len_bytes[3];
+		if (der_len > sizeof(der) || fread(der, 1, der_len, file) != der_len)
+			break;
+		unsigned char const *pos = der;
+		SSL_SESSION *session = d2i_SSL_SESSION(0, &pos, der_len);
+		if (!session)
+			continue;
+		if (session_is_expired(session))
+			SSL_SESSION_free(session);
+		else
+			session_cache_put_locked(key, session);
+	}
+	pthread_mutex_unlock(&session_lock);
+	fclose(file);
+	return complete;
+}
+
+/** \brief Opens a file only accessible by the current user, since it contains secret key material
+ *
+ * \param path char const*const file to be created or truncated
+ * \return FILE* opened file, 0 on error
+ *
+ */
+static FILE* session_file_create(char const *const path) {
+#ifdef _WIN32
+	return fopen(path, "wb");
+#else
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return 0;
+	FILE *file = fdopen(fd, "wb");
+	if (!file)
+		close(fd);
+	return file;
+#endif
+}
+
+bool https_session_cache_set_file(char const *const path) {
+	char *copy = 0;
+	if (path) {
+		copy = malloc(strlen(path) + 1);
+		if (!copy)
+			return false;
+		strcpy(copy, path);
+	}
+	pthread_mutex_lock(&session_lock);
+	free(session_file);
+	session_file = copy;
+	pthread_mutex_unlock(&session_lock);
+	return !path || session_cache_load(path);
+}
+
+bool https_session_cache_save(void) {
+	bool ret = false;
+	pthread_mutex_lock(&session_lock);
+	char *tmp_path = session_file ? malloc(strlen(session_file) + strlen(".tmp") + 1) : 0;
+	FILE *file = 0;
+	if (tmp_path) {
+		sprintf(tmp_path, "%s.tmp", session_file);
+		file = session_file_create(tmp_path);
+	}
+	if (file) {
+		unsigned char der[SESSION_MAX_DER];
+		ret = true;
+		for (size_t i = 0; i < SESSION_CACHE_SIZE && ret; i++) {
+			session_cache_entry *entry = &session_cache[i];
+			if (!entry->session || !SSL_SESSION_is_resumable(entry->session) || session_is_expired(entry->session))
+				continue;
+			int der_len = i2d_SSL_SESSION(entry->session, 0);
+			if (der_len <= 0 || der_len > SESSION_MAX_DER)
+				continue;
+			unsigned char *pos = der;
+			i2d_SSL_SESSION(entry->session, &pos);
+			unsigned char len_bytes[4] = { der_len >> 24, der_len >> 16, der_len >> 8, der_len };
+			size_t key_len = strlen(entry->key) + 1;
+			ret = fwrite(entry->key, 1, key_len, file) == key_len
+					&& fwrite(len_bytes, 1, 4, file) == 4
+					&& fwrite(der, 1, der_len, file) == (size_t) der_len;
+		}
+		ret = !fclose(file) && ret;
+		ret = ret && !rename(tmp_path, session_file);
+		if (!ret)
+			remove(tmp_path);
+	}
+	pthread_mutex_unlock(&session_lock);
+	free(tmp_path);
+	return ret;
+}
+
+static pthread_once_t https_once = PTHREAD_ONCE_INIT;
+static SSL_CTX *https_ctx = 0;
+
+/** \brief Initializes openSSL and creates the SSL context shared by every HTTPS connection. Called exactly once
+ *
+ * \return void
+ *
+ */
+static void https_init_once(void) {
+	SSL_load_error_strings();
+	SSL_library_init();
+
+	const SSL_METHOD *method = TLS_client_method();
+	if (NULL == method) {
+		report_ssl_error("TLS_client_method...");
+		return;
+	}
+
+	SSL_CTX *ctx = SSL_CTX_new(method);
+	if (NULL == ctx) {
+		report_ssl_error("SSL_CTX_new...");
+		return;
+	}
+	SSL_CTX_set_mode(ctx, SSL_MODE_AUTO_RETRY); /* robustness */
+	/* sessions are kept per host by the library, see session_cache_new_cb */
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(ctx, session_cache_new_cb);
+
+	/* load truststore once, it is shared by every connection */
+	if (!SSL_CTX_load_verify_locations(ctx,
+			"/etc/ssl/certs/ca-certificates.crt", /* truststore */
+			"/etc/ssl/certs/") /* more truststore */
+			&& !SSL_CTX_set_default_verify_paths(ctx))
+		report_ssl_error("SSL_CTX_load_verify_locations...");
+	ERR_clear_error();
+
+	https_ctx = ctx;
+}
+
+/** \brief Initialize openSSL and HTTPS
+ *
+ * \return SSL_CTX* shared SSL context, 0 on error
+ *
+ */
+static SSL_CTX* https_init() {
+	pthread_once(&https_once, https_init_once);
+	return https_ctx;
+}
+
+void https_set_verification(bool verify) {
+	https_verify = verify;
+}
+
+bool https_set_ca_locations(char const *const ca_file, char const *const ca_path) {
+	SSL_CTX *ctx = https_init();
+	if (!ctx || (!ca_file && !ca_path))
+		return false;
+	if (!SSL_CTX_load_verify_locations(ctx, ca_file, ca_path)) {
+		report_ssl_error("SSL_CTX_load_verify_locations...");
+		return false;
+	}
+	return true;
+}
+
+/** \brief Creates the SSL BIO chain on top of a connected socket. The handshake is not yet performed
+ * \details The chain uses the shared SSL context and resumes a cached session if available.
+ Unless disabled with https_set_verification, the certificate chain and the host name of the server are verified during the handshake.
+ *
+ * \param hostname const char* hostname the socket is connected to
+ * \param sock_id int connected socket, closed on error and owned by the BIO chain on success
+ * \param error enum EError* receives the error code on failure
+ * \return BIO* BIO chain, 0 on error
+ *
+ */
+static BIO* https_wrap_socket(const char *hostname, int sock_id, enum EError *error) {
+	SSL_CTX *ctx = https_init();
+	BIO *bio = ctx ? BIO_new_ssl(ctx, 1) : NULL;
+	BIO *socket_bio = bio ? BIO_new_socket(sock_id, BIO_CLOSE) : NULL;
+	if (NULL == bio || NULL == socket_bio) {
+		report_ssl_error("BIO_new_ssl...");
+		if (bio)
+			BIO_free(bio);
+		socket_close(sock_id);
+		*error = EError_TlsError;
+		return NULL;
+	}
+	BIO_push(bio, socket_bio);
+
+	SSL *ssl = NULL;
+	BIO_get_ssl(bio, &ssl); /* session */
+	SSL_set_tlsext_host_name(ssl, hostname); /* SNI */
+	if (https_verify) {
+		SSL_set_verify(ssl, SSL_VERIFY_PEER, NULL);
+		SSL_set1_host(ssl, hostname);
+	} else {
+		SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
+	}
+
+	SSL_SESSION *session = session_cache_get(ssl);
+	if (session) {
+		SSL_set_session(ssl, session); /* resume handshake */
+		SSL_SESSION_free(session);
+	}
+	return bio;
+}
+
+/** \brief Returns the error code of a failed handshake
+ *
+ * \param bio BIO* BIO chain created by https_wrap_socket
+ * \return enum EError EError_CertificateError or EError_TlsError
+ *
+ */
+static enum EError https_handshake_error(BIO *bio) {
+	SSL *ssl = NULL;
+	BIO_get_ssl(bio, &ssl);
+	report_ssl_error("BIO_do_handshake...");
+	return ssl && SSL_get_verify_result(ssl) != X509_V_OK ?
+			EError_CertificateError : EError_TlsError;
+}
+
+/** \brief Performs the TLS handshake on a non blocking socket
+ *
+ * \param bio BIO* BIO chain created by https_wrap_socket
+ * \param sock_id int socket of @p bio
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return enum EError EError_NoError on success, the socket is blocking again
+ *
+ */
+static enum EError https_handshake(BIO *bio, int sock_id, int64_t deadline) {
+	if (!socket_set_blocking(sock_id, false))
+		return EError_ConnectionError;
+	while (BIO_do_handshake(bio) <= 0) {
+		if (!BIO_should_retry(bio))
+			return https_handshake_error(bio);
+		if (socket_istimedout(deadline)) {
+			myperror(__LINE__, "Timeout during TLS handshake", ETIMEDOUT);
+			return EError_Timeout;
+		}
+		socket_wait(sock_id, BIO_should_write(bio) ? POLLOUT : POLLIN, deadline);
+	}
+	return socket_set_blocking(sock_id, true) ? EError_NoError : EError_ConnectionError;
+}
+
+/** \brief Connect via HTTP to host
+ * \details The TCP connection is established by socket_connect, so that the dns cache is used.
+ The handshake is limited by the tls timeout and @p deadline.
+ *
+ * \param hostname const char* hostname to be connected to
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \param timing struct HttpTiming* receives the duration of the phases, may be 0
+ * \param error enum EError* receives the error code on failure
+ * \return BIO* connected BIO chain, 0 on error
+ *
+ */
+static BIO* https_connect(const char *hostname, int64_t deadline, struct HttpTiming *timing, enum EError *error) {
+	if (NULL == https_init()) {
+		*error = EError_TlsError;
+		return NULL;
+	}
+
+	struct SocketFallible sock = socket_connect(hostname, HTTPS_PORT, deadline, timing);
+	if (sock.error != EError_NoError) {
+		*error = sock.error;
+		return NULL;
+	}
+
+	BIO *bio = https_wrap_socket(hostname, sock.socket, error);
+	if (NULL == bio)
+		return NULL;
+
+	/* try to connect */
+	int64_t start = timing ? clock_now_us() : 0;
+	*error = https_handshake(bio, sock.socket, socket_phase_deadline(deadline, timeout_tls_ms));
+	if (timing) {
+		SSL *ssl = NULL;
+		BIO_get_ssl(bio, &ssl);
+		timing->tls_us = clock_now_us() - start;
+		timing->tls_session_reused = ssl && SSL_session_reused(ssl);
+	}
+	if (*error != EError_NoError) {
+		BIO_free_all(bio);
+		return NULL;
+	}
+
+	return bio;
+}
+
+/** \brief Opens a new HTTPS connection to host
+ *
+ * \param host char const*const host to be connected
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \param timing struct HttpTiming* receives the duration of the phases, may be 0
+ * \param error enum EError* receives the error code on failure
+ * \return http_connection* connection, 0 on error
+ *
+ */
+static http_connection* https_connection_open(char const *const host, int64_t deadline, struct HttpTiming *timing,
+		enum EError *error) {
+	http_connection *conn = connection_new(host, HTTPS_PORT, true);
+	if (!conn) {
+		*error = EError_CreateSocketError;
+		return 0;
+	}
+	conn->bio = https_connect(host, deadline, timing, error);
+	if (!conn->bio) {
+		connection_close(conn);
+		return 0;
+	}
+	return conn;
+}
+
+/** \brief Sends a complete request to @p host and receives the response
+ * \details An idle keep-alive connection to @p host is reused if available. If the server closed it in the meantime,
+ the request is repeated once over a new connection.
+ *
+ * \param host char const*const host to be connected
+ * \param http_request char const* complete http request
+ * \param head bool true if @p http_request is a HEAD request, whose response has no body
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param is_https bool true to use HTTPS
+ * \param stream struct HttpStreamCallbacks const* callbacks receiving the response through a fixed size buffer,
+ 0 to return the whole body in struct HttpData
+ * \param splice struct http_splice* moves the body of a plain http response to a file descriptor, may be 0
+ * \return struct HttpData
+ *
+ */
+static struct HttpData http_fetch_request(char const *const host, char const *http_request, bool head, time_t timeout,
+		bool is_https, struct HttpStreamCallbacks const *stream, struct http_splice *splice) {
+	struct HttpData ret = { 0 };
+	if (socket_init() != SOCK_OK) {
+		int error = get_last_error();
+		myperror(__LINE__, "Error initializing socket", error);
+		ret.error = EError_CreateSocketError;
+		return ret;
+	}
+
+	struct http_response response = { .stream = stream, .splice = splice };
+	if (stream && (response.buffer = malloc(STREAM_BUFFER_SIZE)))
+		response.capacity = STREAM_BUFFER_SIZE;
+	enum EError error = EError_OutOfMemory;
+	http_connection *conn = 0;
+	unsigned short port = is_https ? HTTPS_PORT : HTTP_PORT;
+	int64_t deadline = socket_deadline(timeout);
+	struct HttpTiming timing = { 0 };
+	bool timed = http_timing, metered = http_metrics;
+	int64_t start = timed || metered ? clock_now_us() : 0;
+	response.timed = timed;
+	for (int attempt = 0; attempt < 2 && http_request && (!stream || response.buffer); attempt++) {
+		timing = (struct HttpTiming) { .measured = timed };
+		conn = pool_acquire(host, port, is_https);
+		bool pooled = conn;
+		if (!conn)
+			conn = is_https ? https_connection_open(host, deadline, timed ? &timing : 0, &error) :
+					http_connection_open(host, deadline, timed ? &timing : 0, &error);
+		if (!conn)
+			break;
+		int64_t transfer_deadline = socket_phase_deadline(deadline, timeout_transfer_ms);
+		uint64_t wire_read = 0, wire_written = 0;
+		int64_t request_start = 0;
+		if (timed) {
+			// A new TLS connection counts its handshake
+			timing.connection_reused = pooled;
+			if (pooled)
+				connection_wire_bytes(conn, &wire_read, &wire_written);
+			request_start = clock_now_us();
+		}
+
+		http_parser_init(&response.parser);
+		response.parser.head_request = head;
+		response.length = 0;
+		response.received = 0;
+		response.first_byte = 0;
+		error = EError_ConnectionError;
+		if (socket_set_blocking(connection_get_socket(conn), false))
+			error = connection_write_all(conn, http_request, strlen(http_request), transfer_deadline);
+		if (error == EError_NoError)
+			error = connection_receive(conn, &response, transfer_deadline);
+		if (timed) {
+			uint64_t read = response.received, written = strlen(http_request);
+			if (conn->bio)
+				connection_wire_bytes(conn, &read, &written);
+			timing.bytes_received = read - wire_read;
+			timing.bytes_sent = written - wire_written;
+			if (response.first_byte) {
+				timing.ttfb_us = response.first_byte - request_start;
+				timing.transfer_us = clock_now_us() - response.first_byte;
+			}
+		}
+		if (error == EError_NoError || error == EError_Timeout || !pooled || response.received)
+			break;
+		// The pooled connection has been closed by the server, retry with a new connection
+		connection_close(conn);
+		conn = 0;
+	}
+	if (error == EError_NoError && http_response_reusable(&response)) {
+		pool_release(conn);
+	} else {
+		connection_close(conn);
+		if (error != EError_NoError) {
+			int last_error = get_last_error();
+			myperror(__LINE__, "Error during receive", last_error);
+		}
+	}
+	ret = http_response_to_data(&response, error);
+	if (timed) {
+		timing.total_us = clock_now_us() - start;
+		ret.timing = timing;
+	}
+	if (metered)
+		metrics_record(&ret, http_request ? strlen(http_request) : 0, start);
+
+	socket_deinit();
+	return ret;
+}
+
+/** \brief Requests @p file from @p host and receives the whole response
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const requested file
+ * \param add_info char const*const additional info to be sent in header
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param is_https bool true to use HTTPS
+ * \param stream struct HttpStreamCallbacks const* callbacks receiving the response through a fixed size buffer,
+ 0 to return the whole body in struct HttpData
+ * \param splice struct http_splice* moves the body of a plain http response to a file descriptor, may be 0
+ * \return struct HttpData
+ *
+ */
+static struct HttpData http_fetch(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, bool is_https, struct HttpStreamCallbacks const *stream,
+		struct http_splice *splice) {
+	struct HttpData ret = { 0 };
+	if (!host || !file)
+		return ret;
+	char *http_request = http_create_request(host, file, add_info);
+	if (!http_request) {
+		ret.error = EError_OutOfMemory;
+		return ret;
+	}
+	ret = http_fetch_request(host, http_request, false, timeout, is_https, stream, splice);
+	free(http_request);
+	return ret;
+}
+
+typedef struct cache_entry cache_entry;
+
+/** \brief A cached 200 response */
+struct cache_entry {
+	char *key; /**< @brief Scheme, host, file and additional header info of the request */
+	char *response; /**< @brief Header followed by the body, 0 for a disk cache entry */
+	unsigned long long id; /**< @brief Number of the body file of a disk cache entry */
+	size_t header_length;
+	size_t body_length;
+	size_t size; /**< @brief Memory or disk space accounted for the entry */
+	time_t fresh_until; /**< @brief The response may be used without revalidation until this moment */
+	char *etag; /**< @brief Value of the ETag header, or 0 */
+	char *last_modified; /**< @brief Value of the Last-Modified header, or 0 */
+	cache_entry *next; /**< @brief Next entry in the same bucket */
+	cache_entry *newer; /**< @brief LRU list */
+	cache_entry *older;
+};
+
+/** \brief Entries of a cache, found by key and ordered by their last use */
+struct cache_list {
+	cache_entry *buckets[CACHE_BUCKETS];
+	cache_entry *newest;
+	cache_entry *oldest;
+	size_t entries;
+	size_t size; /**< @brief Sum of the sizes of the entries */
+};
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_list memory_cache = { 0 };
+static size_t cache_max_size = 0;
+static struct HttpCacheStats cache_stats = { 0 };
+
+/** \brief Hashes a cache key into a bucket index
+ *
+ * \param key char const*const cache key
+ * \return size_t bucket index
+ *
+ */
+static size_t cache_bucket(char const *const key) {
+	uint32_t hash = 2166136261u;
+	for (char const *c = key; *c; c++)
+		hash = (hash ^ (unsigned char) *c) * 16777619u;
+	return hash % CACHE_BUCKETS;
+}
+
+/** \brief Builds the cache key of a request. Needs to be freed by the user */
+static char* cache_key(char const *const host, char const *const file, char const *const add_info, bool is_https) {
+	size_t length = strlen("https://") + strlen(host) + strlen(file) + 1 + (add_info ? strlen(add_info) : 0) + 1;
+	char *key = malloc(length);
+	if (key)
+		snprintf(key, length, "%s://%s%s\n%s", is_https ? "https" : "http", host, file, add_info ? add_info : "");
+	return key;
+}
+
+/** \brief Frees an entry which is not part of a cache list */
+static void cache_entry_free(cache_entry *entry) {
+	if (entry) {
+		free(entry->key);
+		free(entry->response);
+		free(entry->etag);
+		free(entry->last_modified);
+		free(entry);
+	}
+}
+
+/** \brief Finds the entry of @p key. Needs to be called with the lock of @p list held */
+static cache_entry* cache_find_locked(struct cache_list *list, char const *const key) {
+	for (cache_entry *entry = list->buckets[cache_bucket(key)]; entry; entry = entry->next) {
+		if (!strcmp(entry->key, key))
+			return entry;
+	}
+	return 0;
+}
+
+/** \brief Unlinks @p entry from the LRU list. Needs to be called with the lock of @p list held */
+static void cache_lru_unlink_locked(struct cache_list *list, cache_entry *entry) {
+	if (entry->newer)
+		entry->newer->older = entry->older;
+	else
+		list->newest = entry->older;
+	if (entry->older)
+		entry->older->newer = entry->newer;
+	else
+		list->oldest = entry->newer;
+	entry->newer = entry->older = 0;
+}
+
+/** \brief Marks @p entry as most recently used. Needs to be called with the lock of @p list held */
+static void cache_lru_touch_locked(struct cache_list *list, cache_entry *entry) {
+	if (list->newest == entry)
+		return;
+	if (entry->newer || entry->older || list->oldest == entry)
+		cache_lru_unlink_locked(list, entry);
+	entry->older = list->newest;
+	if (list->newest)
+		list->newest->newer = entry;
+	list->newest = entry;
+	if (!list->oldest)
+		list->oldest = entry;
+}
+
+/** \brief Adds @p entry as most recently used entry. Needs to be called with the lock of @p list held */
+static void cache_insert_locked(struct cache_list *list, cache_entry *entry) {
+	size_t bucket = cache_bucket(entry->key);
+	entry->next = list->buckets[bucket];
+	list->buckets[bucket] = entry;
+	cache_lru_touch_locked(list, entry);
+	list->entries++;
+	list->size += entry->size;
+}
+
+/** \brief Removes and frees @p entry. Needs to be called with the lock of @p list held */
+static void cache_remove_locked(struct cache_list *list, cache_entry *entry) {
+	for (cache_entry **link = &list->buckets[cache_bucket(entry->key)]; *link; link = &(*link)->next) {
+		if (*link == entry) {
+			*link = entry->next;
+			break;
+		}
+	}
+	cache_lru_unlink_locked(list, entry);
+	list->entries--;
+	list->size -= entry->size;
+	cache_entry_free(entry);
+}
+
+/** \brief Copies the response of @p entry into a result
+ *
+ * \param entry cache_entry const* cached response
+ * \return struct HttpData result like http_get, EError_OutOfMemory if the copy failed
+ *
+ */
+static struct HttpData cache_entry_to_data(cache_entry const *entry) {
+	struct HttpData ret = { .error = EError_OutOfMemory };
+	size_t length = entry->header_length + entry->body_length;
+	ret.response = malloc(length + 1);
+	if (ret.response) {
+		memcpy(ret.response, entry->response, length + 1);
+		ret.error = EError_NoError;
+		ret.http_code = 200;
+		ret.header_length = entry->header_length;
+		ret.data = ret.response + entry->header_length;
+		ret.received_data_length = ret.content_length = entry->body_length;
+	}
+	return ret;
+}
+
+/** \brief Writes the header line revalidating @p entry into @p line, or an empty string if it has no validator */
+static void cache_validator(cache_entry const *entry, char *line, size_t size) {
+	line[0] = '\0';
+	if (entry->etag)
+		snprintf(line, size, "If-None-Match: %s", entry->etag);
+	else if (entry->last_modified)
+		snprintf(line, size, "If-Modified-Since: %s", entry->last_modified);
+}
+
+/** \brief Parses an HTTP date in the preferred format, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+ *
+ * \param value char const* header value, not NUL terminated
+ * \param length size_t length of @p value
+ * \param date time_t* receives the date
+ * \return bool false if @p value is no valid date
+ *
+ */
+static bool http_parse_date(char const *value, size_t length, time_t *date) {
+	static char const months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	char text[64], month_name[4] = "";
+	if (length >= sizeof(text))
+		return false;
+	memcpy(text, value, length);
+	text[length] = '\0';
+	int day, year, hour, minute, second;
+	if (sscanf(text, "%*3s, %2d %3s %4d %2d:%2d:%2d GMT", &day, month_name, &year, &hour, &minute, &second) != 6)
+		return false;
+	char const *month_pos = strstr(months, month_name);
+	if (strlen(month_name) != 3 || !month_pos || (month_pos - months) % 3)
+		return false;
+	int month = (month_pos - months) / 3 + 1;
+	// Days since 1970-01-01 of the proleptic Gregorian calendar
+	int y = year - (month <= 2);
+	int era = (y >= 0 ? y : y - 399) / 400;
+	int year_of_era = y - era * 400;
+	int day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+	int day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+	long long days = era * 146097LL + day_of_era - 719468;
+	*date = (time_t) (days * 86400 + hour * 3600 + minute * 60 + second);
+	return true;
+}
+
+/** \brief Finds the numeric value of a Cache-Control directive like max-age
+ *
+ * \param value char const* value of the Cache-Control header
+ * \param length size_t length of @p value
+ * \param directive char const*const directive name including the '=', e.g. "max-age="
+ * \param seconds long* receives the value
+ * \return bool false if the directive is missing
+ *
+ */
+static bool cache_control_seconds(char const *value, size_t length, char const *const directive, long *seconds) {
+	size_t directive_length = strlen(directive);
+	for (size_t i = 0; i + directive_length < length; i++) {
+		if ((!i || value[i - 1] == ',' || value[i - 1] == ' ') && !strncasecmp(value + i, directive, directive_length)
+				&& isdigit((unsigned char) value[i + directive_length])) {
+			*seconds = strtol(value + i + directive_length, 0, 10);
+			return true;
+		}
+	}
+	return false;
+}
+
+/** \brief Determines until when a response may be used without revalidation
+ *
+ * \param header char const* http header of the response
+ * \param header_length size_t length of @p header
+ * \param now time_t current time
+ * \param fresh_until time_t* receives the end of the freshness lifetime
+ * \return bool false if the response must not be stored
+ *
+ */
+static bool cache_freshness(char const *header, size_t header_length, time_t now, time_t *fresh_until) {
+	size_t length = 0;
+	size_t value = http_header_find(header, header_length, "Vary", &length);
+	if (value && memchr(header + value, '*', length))
+		return false;
+	*fresh_until = now;
+	value = http_header_find(header, header_length, "Cache-Control", &length);
+	if (value) {
+		char const *directives = header + value;
+		long max_age = 0;
+		if (http_header_has_token(directives, length, "no-store"))
+			return false;
+		if (http_header_has_token(directives, length, "no-cache"))
+			return true;
+		if (cache_control_seconds(directives, length, "max-age=", &max_age)) {
+			long age = 0;
+			if ((value = http_header_find(header, header_length, "Age", &length)))
+				age = strtol(header + value, 0, 10);
+			if (max_age > age)
+				*fresh_until = now + (max_age - age);
+			return true;
+		}
+	}
+	time_t expires, date;
+	if ((value = http_header_find(header, header_length, "Expires", &length))) {
+		// An invalid date means the response has already expired
+		if (http_parse_date(header + value, length, &expires)) {
+			// Compare with the date of the server, so clocks need not be synchronized
+			if ((value = http_header_find(header, header_length, "Date", &length))
+					&& http_parse_date(header + value, length, &date))
+				expires = now + (expires - date);
+			if (expires > now)
+				*fresh_until = expires;
+		}
+	}
+	return true;
+}
+
+/** \brief Copies the value of a header field. Needs to be freed by the user
+ *
+ * \param header char const* http header
+ * \param header_length size_t length of @p header
+ * \param name char const*const header name
+ * \return char* value, 0 if missing or out of memory
+ *
+ */
+static char* cache_copy_header(char const *header, size_t header_length, char const *const name) {
+	size_t length = 0;
+	size_t value = http_header_find(header, header_length, name, &length);
+	char *copy = value ? malloc(length + 1) : 0;
+	if (copy) {
+		memcpy(copy, header + value, length);
+		copy[length] = '\0';
+	}
+	return copy;
+}
+
+/** \brief Creates an entry without response for a 200 response if its headers allow it to be cached
+ *
+ * \param key char const*const cache key of the request
+ * \param data struct HttpData const*const successful 200 response
+ * \return cache_entry* new entry, 0 if the response is not cacheable or out of memory
+ *
+ */
+static cache_entry* cache_entry_create(char const *const key, struct HttpData const *const data) {
+	time_t now = time(0);
+	time_t fresh_until;
+	if (!cache_freshness(data->response, data->header_length, now, &fresh_until))
+		return 0;
+	cache_entry *entry = calloc(1, sizeof(cache_entry));
+	if (!entry)
+		return 0;
+	entry->etag = cache_copy_header(data->response, data->header_length, "ETag");
+	entry->last_modified = cache_copy_header(data->response, data->header_length, "Last-Modified");
+	entry->key = strdup(key);
+	entry->header_length = data->header_length;
+	entry->body_length = data->received_data_length;
+	entry->fresh_until = fresh_until;
+	// Responses without freshness and validators would never be used
+	if (!entry->key || (fresh_until <= now && !entry->etag && !entry->last_modified)) {
+		cache_entry_free(entry);
+		return 0;
+	}
+	return entry;
+}
+
+/** \brief Stores a copy of a 200 response in the memory cache if its headers allow it
+ *
+ * \param key char const*const cache key of the request
+ * \param data struct HttpData const*const successful 200 response
+ * \return void
+ *
+ */
+static void cache_store(char const *const key, struct HttpData const *const data) {
+	cache_entry *entry = cache_entry_create(key, data);
+	if (!entry)
+		return;
+	size_t length = data->header_length + data->received_data_length;
+	entry->size = sizeof(cache_entry) + strlen(key) + length;
+	if (!(entry->response = malloc(length + 1))) {
+		cache_entry_free(entry);
+		return;
+	}
+	memcpy(entry->response, data->response, length);
+	entry->response[length] = '\0';
+
+	pthread_mutex_lock(&cache_lock);
+	cache_entry *old = cache_find_locked(&memory_cache, key);
+	if (old)
+		cache_remove_locked(&memory_cache, old);
+	while (memory_cache.oldest && memory_cache.size + entry->size > cache_max_size) {
+		cache_remove_locked(&memory_cache, memory_cache.oldest);
+		cache_stats.evictions++;
+	}
+	if (entry->size <= cache_max_size) {
+		cache_insert_locked(&memory_cache, entry);
+		cache_stats.stores++;
+		entry = 0;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	cache_entry_free(entry);
+}
+
+/** \brief Looks up @p key in the memory cache
+ *
+ * \param key char const*const cache key of the request
+ * \param fresh struct HttpData* receives a copy of a fresh response
+ * \param stale struct HttpData* receives a copy of a stale response
+ * \param validator char* receives the header line revalidating a stale response
+ * \param size size_t size of @p validator
+ * \return bool true if the key has been found
+ *
+ */
+static bool cache_lookup(char const *const key, struct HttpData *fresh, struct HttpData *stale, char *validator,
+		size_t size) {
+	pthread_mutex_lock(&cache_lock);
+	cache_entry *entry = cache_find_locked(&memory_cache, key);
+	if (entry) {
+		cache_lru_touch_locked(&memory_cache, entry);
+		if (entry->fresh_until > time(0)) {
+			*fresh = cache_entry_to_data(entry);
+		} else {
+			// A copy of the stale response is kept, since the entry may be evicted during the request
+			*stale = cache_entry_to_data(entry);
+			cache_validator(entry, validator, size);
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return entry;
+}
+
+/** \brief Updates the freshness of a memory cache entry after a 304 response */
+static void cache_refresh(char const *const key, time_t fresh_until) {
+	pthread_mutex_lock(&cache_lock);
+	cache_entry *entry = cache_find_locked(&memory_cache, key);
+	if (entry)
+		entry->fresh_until = fresh_until;
+	pthread_mutex_unlock(&cache_lock);
+}
+
+#ifndef _WIN32
+static pthread_mutex_t disk_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cache_list disk_cache = { 0 };
+static char *disk_cache_directory = 0;
+static size_t disk_cache_max_size = 0;
+static unsigned long long disk_cache_next_id = 1;
+static size_t disk_cache_changes = 0; /**< @brief Changes not written to the index file yet */
+
+/** \brief Builds the path of a file in the disk cache directory. Needs to be called with disk_cache_lock held
+ *
+ * \param id unsigned long long number of the body file, 0 for the index file
+ * \param suffix char const*const appended to the file name, e.g. ".tmp"
+ * \return char* path, needs to be freed by the user. 0 if out of memory
+ *
+ */
+static char* disk_cache_path_locked(unsigned long long id, char const *const suffix) {
+	size_t length = strlen(disk_cache_directory) + strlen("/0123456789abcdef.body") + strlen(suffix) + 1;
+	char *path = malloc(length);
+	if (path && id)
+		snprintf(path, length, "%s/%016llx.body%s", disk_cache_directory, id, suffix);
+	else if (path)
+		snprintf(path, length, "%s/index%s", disk_cache_directory, suffix);
+	return path;
+}
+
+/** \brief Removes @p entry and its body file. Needs to be called with disk_cache_lock held */
+static void disk_cache_remove_locked(cache_entry *entry) {
+	char *path = disk_cache_path_locked(entry->id, "");
+	if (path)
+		unlink(path);
+	free(path);
+	cache_remove_locked(&disk_cache, entry);
+}
+
+/** \brief Writes a number as 8 bytes big endian */
+static bool disk_cache_write_number(FILE *file, unsigned long long number) {
+	unsigned char bytes[8];
+	for (int i = 0; i < 8; i++)
+		bytes[i] = number >> (56 - 8 * i);
+	return fwrite(bytes, 1, sizeof(bytes), file) == sizeof(bytes);
+}
+
+/** \brief Reads a number written by disk_cache_write_number */
+static bool disk_cache_read_number(FILE *file, unsigned long long *number) {
+	unsigned char bytes[8];
+	if (fread(bytes, 1, sizeof(bytes), file) != sizeof(bytes))
+		return false;
+	*number = 0;
+	for (int i = 0; i < 8; i++)
+		*number = *number << 8 | bytes[i];
+	return true;
+}
+
+/** \brief Reads a NUL terminated string. Needs to be freed by the user
+ *
+ * \param file FILE* index file
+ * \param optional bool true if an empty string is returned as 0
+ * \param string char** receives the string
+ * \return bool false at the end of the file or on error
+ *
+ */
+static bool disk_cache_read_string(FILE *file, bool optional, char **string) {
+	size_t length = 0, capacity = 64;
+	char *buffer = malloc(capacity);
+	int ch = 0;
+	while (buffer && (ch = fgetc(file)) > 0) {
+		if (length + 1 == capacity) {
+			char *larger = realloc(buffer, capacity *= 2);
+			if (!larger) {
+				free(buffer);
+				return false;
+			}
+			buffer = larger;
+		}
+		buffer[length++] = ch;
+	}
+	if (!buffer || ch != 0) {
+		free(buffer);
+		return false;
+	}
+	buffer[length] = '\0';
+	if (optional && !length) {
+		free(buffer);
+		buffer = 0;
+	}
+	*string = buffer;
+	return true;
+}
+
+/** \brief Rewrites the index file of the disk cache. Needs to be called with disk_cache_lock held
+ * \details The file consists of records of the NUL terminated key, ETag and Last-Modified values followed by the
+ file number, header length, body length and end of freshness as 8 byte big endian numbers, least recently used first.
+ The index is replaced atomically. An index missing recent changes is consistent as well: entries whose body file
+ has been removed are skipped when it is read, body files without entry are removed.
+ *
+ * \return bool false on error
+ *
+ */
+static bool disk_cache_save_locked(void) {
+	char *path = disk_cache_path_locked(0, "");
+	char *tmp_path = disk_cache_path_locked(0, ".tmp");
+	// The keys may contain credentials of the additional header info
+	int fd = path && tmp_path ? open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : -1;
+	FILE *file = fd >= 0 ? fdopen(fd, "wb") : 0;
+	if (fd >= 0 && !file)
+		close(fd);
+	bool ret = file;
+	for (cache_entry *entry = disk_cache.oldest; entry && ret; entry = entry->newer) {
+		char const *etag = entry->etag ? entry->etag : "";
+		char const *last_modified = entry->last_modified ? entry->last_modified : "";
+		ret = fwrite(entry->key, 1, strlen(entry->key) + 1, file) == strlen(entry->key) + 1
+				&& fwrite(etag, 1, strlen(etag) + 1, file) == strlen(etag) + 1
+				&& fwrite(last_modified, 1, strlen(last_modified) + 1, file) == strlen(last_modified) + 1
+				&& disk_cache_write_number(file, entry->id)
+				&& disk_cache_write_number(file, entry->header_length)
+				&& disk_cache_write_number(file, entry->body_length)
+				&& disk_cache_write_number(file, (unsigned long long) entry->fresh_until);
+	}
+	if (file) {
+		ret = !fclose(file) && ret;
+		ret = ret && !rename(tmp_path, path);
+		if (!ret)
+			unlink(tmp_path);
+	}
+	free(path);
+	free(tmp_path);
+	if (ret)
+		disk_cache_changes = 0;
+	return ret;
+}
+
+/** \brief Records a change of the disk cache. Needs to be called with disk_cache_lock held
+ * \details Rewriting the index costs a write of every entry, so it is only done every DISK_CACHE_SAVE_CHANGES changes
+ and by http_disk_cache_flush.
+ */
+static void disk_cache_changed_locked(void) {
+	if (++disk_cache_changes >= DISK_CACHE_SAVE_CHANGES)
+		disk_cache_save_locked();
+}
+
+/** \brief Evicts least recently used entries until @p needed more bytes fit. Needs to be called with disk_cache_lock held */
+static void disk_cache_evict_locked(size_t needed) {
+	while (disk_cache.oldest && disk_cache.size + needed > disk_cache_max_size) {
+		disk_cache_remove_locked(disk_cache.oldest);
+		pthread_mutex_lock(&cache_lock);
+		cache_stats.evictions++;
+		pthread_mutex_unlock(&cache_lock);
+	}
+}
+
+/** \brief Reads the index file and removes body files without index entry. Needs to be called with disk_cache_lock held
+ *
+ * \return void
+ *
+ */
+static void disk_cache_load_locked(void) {
+	char *path = disk_cache_path_locked(0, "");
+	FILE *file = path ? fopen(path, "rb") : 0;
+	free(path);
+	while (file) {
+		cache_entry *entry = calloc(1, sizeof(cache_entry));
+		unsigned long long id, header_length, body_length, fresh_until;
+		if (!entry || !disk_cache_read_string(file, false, &entry->key)
+				|| !disk_cache_read_string(file, true, &entry->etag)
+				|| !disk_cache_read_string(file, true, &entry->last_modified)
+				|| !disk_cache_read_number(file, &id) || !disk_cache_read_number(file, &header_length)
+				|| !disk_cache_read_number(file, &body_length) || !disk_cache_read_number(file, &fresh_until)) {
+			cache_entry_free(entry);
+			break;
+		}
+		entry->id = id;
+		entry->header_length = header_length;
+		entry->body_length = body_length;
+		entry->fresh_until = (time_t) fresh_until;
+		entry->size = header_length + body_length + 1;
+		if (id >= disk_cache_next_id)
+			disk_cache_next_id = id + 1;
+		// Only entries whose body file is complete are used
+		struct stat body_stat;
+		char *body_path = disk_cache_path_locked(id, "");
+		if (body_path && !stat(body_path, &body_stat) && (size_t) body_stat.st_size == entry->size
+				&& !cache_find_locked(&disk_cache, entry->key))
+			cache_insert_locked(&disk_cache, entry);
+		else
+			cache_entry_free(entry);
+		free(body_path);
+	}
+	if (file)
+		fclose(file);
+
+	DIR *directory = opendir(disk_cache_directory);
+	struct dirent *item;
+	while (directory && (item = readdir(directory))) {
+		unsigned long long id = 0;
+		int length = 0;
+		if (sscanf(item->d_name, "%16llx.body%n", &id, &length) != 1 || (size_t) length < strlen(".body"))
+			continue;
+		bool used = false;
+		for (cache_entry *entry = disk_cache.oldest; entry && !used; entry = entry->newer)
+			used = entry->id == id && !item->d_name[length];
+		if (!used) {
+			char *stray = malloc(strlen(disk_cache_directory) + strlen(item->d_name) + 2);
+			if (stray) {
+				sprintf(stray, "%s/%s", disk_cache_directory, item->d_name);
+				unlink(stray);
+			}
+			free(stray);
+		}
+		if (id >= disk_cache_next_id)
+			disk_cache_next_id = id + 1;
+	}
+	if (directory)
+		closedir(directory);
+}
+
+/** \brief Stores a 200 response in the disk cache if its headers allow it
+ * \details The response is written to a new body file, which is renamed into place before the index refers to it.
+ *
+ * \param key char const*const cache key of the request
+ * \param data struct HttpData const*const successful 200 response
+ * \return void
+ *
+ */
+static void disk_cache_store(char const *const key, struct HttpData const *const data) {
+	cache_entry *entry = cache_entry_create(key, data);
+	if (!entry)
+		return;
+	// The terminating NUL is stored as well, so a mapped body is a valid string
+	entry->size = data->header_length + data->received_data_length + 1;
+	pthread_mutex_lock(&disk_cache_lock);
+	entry->id = disk_cache_next_id++;
+	char const *directory = disk_cache_directory;
+	char *path = directory && entry->size <= disk_cache_max_size ? disk_cache_path_locked(entry->id, "") : 0;
+	char *tmp_path = path ? disk_cache_path_locked(entry->id, ".tmp") : 0;
+	pthread_mutex_unlock(&disk_cache_lock);
+	// The body is written without holding the lock
+	int fd = tmp_path ? open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600) : -1;
+	bool written = fd >= 0 && fd_write_all(fd, data->response, entry->size);
+	if (fd >= 0 && (close(fd) || !written || rename(tmp_path, path))) {
+		unlink(tmp_path);
+		written = false;
+	}
+
+	pthread_mutex_lock(&disk_cache_lock);
+	// The cache may have been reconfigured meanwhile
+	if (written && disk_cache_directory == directory) {
+		cache_entry *old = cache_find_locked(&disk_cache, key);
+		if (old)
+			disk_cache_remove_locked(old);
+		disk_cache_evict_locked(entry->size);
+		cache_insert_locked(&disk_cache, entry);
+		entry = 0;
+		disk_cache_changed_locked();
+		pthread_mutex_lock(&cache_lock);
+		cache_stats.stores++;
+		pthread_mutex_unlock(&cache_lock);
+	} else if (written) {
+		unlink(path);
+	}
+	pthread_mutex_unlock(&disk_cache_lock);
+	cache_entry_free(entry);
+	free(path);
+	free(tmp_path);
+}
+
+/** \brief Maps the body file of @p entry read-only into memory. Needs to be called with disk_cache_lock held
+ *
+ * \param entry cache_entry const* disk cache entry
+ * \return struct HttpData result like http_get whose response is the mapping, EError_CreateSocketError if the file is unusable
+ *
+ */
+static struct HttpData disk_cache_map_locked(cache_entry const *entry) {
+	struct HttpData ret = { .error = EError_CreateSocketError };
+	char *path = disk_cache_path_locked(entry->id, "");
+	int fd = path ? open(path, O_RDONLY | O_CLOEXEC) : -1;
+	free(path);
+	if (fd < 0)
+		return ret;
+	void *map = mmap(0, entry->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return ret;
+	ret.error = EError_NoError;
+	ret.http_code = 200;
+	ret.response = map;
+	ret.mapped_length = entry->size;
+	ret.header_length = entry->header_length;
+	ret.data = ret.response + entry->header_length;
+	ret.received_data_length = ret.content_length = entry->body_length;
+	return ret;
+}
+
+/** \brief Looks up @p key in the disk cache, see cache_lookup. The responses are mapped instead of copied */
+static bool disk_cache_lookup(char const *const key, struct HttpData *fresh, struct HttpData *stale, char *validator,
+		size_t size) {
+	pthread_mutex_lock(&disk_cache_lock);
+	cache_entry *entry = disk_cache_directory ? cache_find_locked(&disk_cache, key) : 0;
+	if (entry) {
+		cache_lru_touch_locked(&disk_cache, entry);
+		struct HttpData data = disk_cache_map_locked(entry);
+		if (data.error != EError_NoError) {
+			disk_cache_remove_locked(entry);
+			entry = 0;
+		} else if (entry->fresh_until > time(0)) {
+			*fresh = data;
+		} else {
+			*stale = data;
+			cache_validator(entry, validator, size);
+		}
+	}
+	pthread_mutex_unlock(&disk_cache_lock);
+	return entry;
+}
+
+/** \brief Updates the freshness of a disk cache entry after a 304 response */
+static void disk_cache_refresh(char const *const key, time_t fresh_until) {
+	pthread_mutex_lock(&disk_cache_lock);
+	cache_entry *entry = disk_cache_directory ? cache_find_locked(&disk_cache, key) : 0;
+	if (entry) {
+		entry->fresh_until = fresh_until;
+		disk_cache_changed_locked();
+	}
+	pthread_mutex_unlock(&disk_cache_lock);
+}
+
+/** \brief Checks whether the disk cache is enabled */
+static bool disk_cache_enabled(void) {
+	pthread_mutex_lock(&disk_cache_lock);
+	bool enabled = disk_cache_directory;
+	pthread_mutex_unlock(&disk_cache_lock);
+	return enabled;
+}
+#else
+static bool disk_cache_lookup(char const *const key, struct HttpData *fresh, struct HttpData *stale, char *validator,
+		size_t size) {
+	return false;
+}
+
+static void disk_cache_store(char const *const key, struct HttpData const *const data) {
+}
+
+static void disk_cache_refresh(char const *const key, time_t fresh_until) {
+}
+
+static bool disk_cache_enabled(void) {
+	return false;
+}
+#endif
+
+/** \brief Requests @p file like http_fetch, but answers from the response caches where possible
+ * \details A fresh cached response is returned without any request. A stale response with validators is
+ revalidated with If-None-Match or If-Modified-Since, and a 304 answer returns the cached body.
+ The memory cache is consulted before the disk cache.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const requested file
+ * \param add_info char const*const additional info to be sent in header
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param is_https bool true to use HTTPS
+ * \return struct HttpData
+ *
+ */
+static struct HttpData http_fetch_cached(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, bool is_https) {
+	pthread_mutex_lock(&cache_lock);
+	bool memory = cache_max_size;
+	pthread_mutex_unlock(&cache_lock);
+	bool disk = disk_cache_enabled();
+	char *key = (memory || disk) && host && file ? cache_key(host, file, add_info, is_https) : 0;
+	if (!key)
+		return http_fetch(host, file, add_info, timeout, is_https, 0, 0);
+	// Hits and revalidations are counted like the request they replace
+	int64_t start = metrics_call_begin();
+
+	struct HttpData ret = { 0 }, stale = { 0 };
+	char validator[512] = "";
+	bool found = memory && cache_lookup(key, &ret, &stale, validator, sizeof(validator));
+	bool from_disk = !found && disk && disk_cache_lookup(key, &ret, &stale, validator, sizeof(validator));
+	pthread_mutex_lock(&cache_lock);
+	if (ret.response) {
+		cache_stats.hits++;
+		cache_stats.disk_hits += from_disk;
+		cache_stats.bytes_saved += ret.received_data_length;
+	} else {
+		cache_stats.misses++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	if (ret.response) {
+		free(key);
+		metrics_call_end(&ret, start);
+		return ret;
+	}
+
+	char *header = stale.response && validator[0] ? http_join_header_line(add_info, validator) : 0;
+	if (!header)
+		http_data_free(&stale);
+	ret = http_fetch(host, file, header ? header : add_info, timeout, is_https, 0, 0);
+	if (header && ret.error == EError_NoError && ret.http_code == 304) {
+		time_t fresh_until = time(0);
+		cache_freshness(ret.response, ret.header_length, fresh_until, &fresh_until);
+		pthread_mutex_lock(&cache_lock);
+		cache_stats.misses--;
+		cache_stats.revalidations++;
+		cache_stats.bytes_saved += stale.received_data_length;
+		pthread_mutex_unlock(&cache_lock);
+		if (from_disk)
+			disk_cache_refresh(key, fresh_until);
+		else
+			cache_refresh(key, fresh_until);
+		size_t received = ret.received_bytes;
+		struct HttpTiming timing = ret.timing;
+		http_data_free(&ret);
+		ret = stale;
+		ret.received_bytes = received;
+		ret.timing = timing;
+		stale = (struct HttpData) { 0 };
+	} else if (ret.error == EError_NoError && ret.http_code == 200) {
+		if (memory)
+			cache_store(key, &ret);
+		if (disk)
+			disk_cache_store(key, &ret);
+	}
+	http_data_free(&stale);
+	free(header);
+	free(key);
+	metrics_call_end(&ret, start);
+	return ret;
+}
+
+void http_cache_configure(size_t max_size) {
+	pthread_mutex_lock(&cache_lock);
+	cache_max_size = max_size;
+	while (memory_cache.oldest && memory_cache.size > cache_max_size) {
+		cache_remove_locked(&memory_cache, memory_cache.oldest);
+		cache_stats.evictions++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+bool http_disk_cache_configure(char const *const directory, size_t max_size) {
+#ifdef _WIN32
+	return !directory;
+#else
+	char *copy = 0;
+	if (directory && !(copy = strdup(directory)))
+		return false;
+	pthread_mutex_lock(&disk_cache_lock);
+	if (disk_cache_directory && disk_cache_changes)
+		disk_cache_save_locked();
+	while (disk_cache.oldest)
+		cache_remove_locked(&disk_cache, disk_cache.oldest);
+	free(disk_cache_directory);
+	disk_cache_directory = copy;
+	disk_cache_max_size = max_size;
+	bool ret = true;
+	if (copy) {
+		mkdir(copy, 0700);
+		struct stat directory_stat;
+		ret = !stat(copy, &directory_stat) && S_ISDIR(directory_stat.st_mode);
+		if (ret) {
+			disk_cache_load_locked();
+			disk_cache_evict_locked(0);
+			disk_cache_save_locked();
+		} else {
+			free(disk_cache_directory);
+			disk_cache_directory = 0;
+		}
+	}
+	pthread_mutex_unlock(&disk_cache_lock);
+	return ret;
+#endif
+}
+
+bool http_disk_cache_flush(void) {
+#ifdef _WIN32
+	return true;
+#else
+	pthread_mutex_lock(&disk_cache_lock);
+	bool ret = !disk_cache_directory || !disk_cache_changes || disk_cache_save_locked();
+	pthread_mutex_unlock(&disk_cache_lock);
+	return ret;
+#endif
+}
+
+struct HttpCacheStats http_cache_get_stats(void) {
+	pthread_mutex_lock(&cache_lock);
+	struct HttpCacheStats stats = cache_stats;
+	stats.entries = memory_cache.entries;
+	stats.size = memory_cache.size;
+	pthread_mutex_unlock(&cache_lock);
+#ifndef _WIN32
+	pthread_mutex_lock(&disk_cache_lock);
+	stats.disk_entries = disk_cache.entries;
+	stats.disk_size = disk_cache.size;
+	pthread_mutex_unlock(&disk_cache_lock);
+#endif
+	return stats;
+}
+
+void http_cache_clear(void) {
+	pthread_mutex_lock(&cache_lock);
+	while (memory_cache.oldest)
+		cache_remove_locked(&memory_cache, memory_cache.oldest);
+	pthread_mutex_unlock(&cache_lock);
+#ifndef _WIN32
+	pthread_mutex_lock(&disk_cache_lock);
+	while (disk_cache.oldest)
+		disk_cache_remove_locked(disk_cache.oldest);
+	if (disk_cache_directory)
+		disk_cache_save_locked();
+	pthread_mutex_unlock(&disk_cache_lock);
+#endif
+}
+
+struct HttpData https_get(char const *const host, char const *const file, char const *const add_info, time_t timeout) {
+	return http_fetch_cached(host, file, add_info, timeout, true);
+}
+
+struct HttpData http_get_stream(char const *const host, char const *const file, char const *const add_info,
+		time_t timeout, struct HttpStreamCallbacks callbacks) {
+	return http_fetch(host, file, add_info, timeout, false, &callbacks, 0);
+}
+
+struct HttpData https_get_stream(char const *const host, char const *const file, char const *const add_info,
+		time_t timeout, struct HttpStreamCallbacks callbacks) {
+	return http_fetch(host, file, add_info, timeout, true, &callbacks, 0);
+}
+
+/** \brief Decides whether the body of a response is written to the file descriptor. Only the body of a 200 response is written */
+static bool fd_stream_headers(int http_code, char const *header, size_t header_length, void *user_data) {
+	struct http_splice *splice = user_data;
+	splice->write_body = http_code == 200;
+	splice->enabled = splice->write_body && splice->pipe[0] >= 0;
+	return true;
+}
+
+/** \brief Writes a received block of the body to the file descriptor */
+static bool fd_stream_data(char const *data, size_t length, void *user_data) {
+	struct http_splice *splice = user_data;
+	return !splice->write_body || fd_write_all(splice->fd, data, length);
+}
+
+/** \brief Requests @p file from @p host and writes the body of the response to @p fd
+ * \details The body of a plain http response is spliced from the socket to @p fd where possible.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const requested file
+ * \param add_info char const*const additional info to be sent in header
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param is_https bool true to use HTTPS
+ * \param fd int destination
+ * \return struct HttpData
+ *
+ */
+static struct HttpData http_fetch_to_fd(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, bool is_https, int fd) {
+	struct http_splice splice = { .fd = fd, .pipe = { -1, -1 } };
+#ifdef __linux__
+	if (!is_https && pipe2(splice.pipe, O_CLOEXEC))
+		splice.pipe[0] = splice.pipe[1] = -1;
+#endif
+	struct HttpStreamCallbacks callbacks = { fd_stream_headers, fd_stream_data, &splice };
+	struct HttpData ret = http_fetch(host, file, add_info, timeout, is_https, &callbacks,
+			splice.pipe[0] >= 0 ? &splice : 0);
+	if (splice.pipe[0] >= 0) {
+		close(splice.pipe[0]);
+		close(splice.pipe[1]);
+	}
+	return ret;
+}
+
+struct HttpData http_get_to_fd(char const *const host, char const *const file, char const *const add_info,
+		time_t timeout, int fd) {
+	return http_fetch_to_fd(host, file, add_info, timeout, false, fd);
+}
+
+struct HttpData https_get_to_fd(char const *const host, char const *const file, char const *const add_info,
+		time_t timeout, int fd) {
+	return http_fetch_to_fd(host, file, add_info, timeout, true, fd);
+}
+
+/** \brief Appends the user agent to the additional header info. Needs to be freed by the user
+ *
+ * \param add_info char const*const additional info to be placed into http header, or 0
+ * \param user_agent char const*const string containing application name
+ * \return char* header lines, 0 on error
+ *
+ */
+static char* http_join_user_agent(char const *const add_info, char const *const user_agent) {
+	char *http_useragent = socket_get_useragent(user_agent);
+	if (!http_useragent)
+		return 0;
+	char *ret = http_join_header_line(add_info, http_useragent);
+	free(http_useragent);
+	return ret;
+}
+
+struct HttpData https_get_with_useragent(char const *const host,
+		char const *const file, char const *const user_agent,
+		char const *const add_info, time_t timeout) {
+	struct HttpData ret = { 0 };
+	if (user_agent) {
+		char *header = http_join_user_agent(add_info, user_agent);
+		if (header) {
+			ret = https_get(host, file, header, timeout);
+			free(header);
+		}
+	}
+	return ret;
+}
+
+/** \brief One byte range of a segmented download */
+struct http_segment {
+	char const *host;
+	bool is_https;
+	time_t timeout;
+	char *request; /**< @brief GET request with the Range header of this segment */
+	size_t offset; /**< @brief Position of the range in the body */
+	size_t length; /**< @brief Number of bytes of the range */
+	size_t written; /**< @brief Number of bytes received so far */
+	char *buffer; /**< @brief Start of the body in the result, 0 when writing to @p fd */
+	int fd;
+	off_t fd_offset; /**< @brief Position of the body in @p fd */
+	bool range_ignored; /**< @brief The server answered with the whole body instead of the range */
+	bool started; /**< @brief The segment runs on its own thread */
+	pthread_t thread;
+	struct HttpData result;
+};
+
+/** \brief Accepts only a 206 response carrying exactly the requested range */
+static bool segment_headers(int http_code, char const *header, size_t header_length, void *user_data) {
+	struct http_segment *segment = user_data;
+	if (http_code == 200)
+		segment->range_ignored = true;
+	if (http_code != 206)
+		return false;
+	size_t value_length = 0;
+	size_t value = http_header_find(header, header_length, "Content-Range", &value_length);
+	unsigned long long first = 0, last = 0;
+	return value && sscanf(header + value, "bytes %llu-%llu", &first, &last) == 2 && first == segment->offset
+			&& last + 1 == segment->offset + segment->length;
+}
+
+/** \brief Copies a received block of the range to its place in the result */
+static bool segment_data(char const *data, size_t length, void *user_data) {
+	struct http_segment *segment = user_data;
+	if (length > segment->length - segment->written)
+		return false;
+	size_t position = segment->offset + segment->written;
+	if (segment->buffer)
+		memcpy(segment->buffer + position, data, length);
+#ifndef _WIN32
+	else if (!fd_pwrite_all(segment->fd, data, length, segment->fd_offset + position))
+		return false;
+#endif
+	segment->written += length;
+	return true;
+}
+
+/** \brief Thread function receiving one segment */
+static void* segment_thread(void *arg) {
+	struct http_segment *segment = arg;
+	struct HttpStreamCallbacks callbacks = { segment_headers, segment_data, segment };
+	metrics_nested++; // Part of the download recorded by http_fetch_segmented
+	segment->result = http_fetch_request(segment->host, segment->request, false, segment->timeout, segment->is_https,
+			&callbacks, 0);
+	metrics_nested--;
+	return 0;
+}
+
+/** \brief Downloads @p file in byte ranges over parallel connections
+ * \details A HEAD request provides the size of the body. If the server does not announce byte ranges, the body is
+ too small or the server answers a range with the whole body, the file is requested with a single GET request.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const requested file
+ * \param add_info char const*const additional info to be sent in header
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param is_https bool true to use HTTPS
+ * \param segments size_t maximum number of parallel connections, 0 for the default
+ * \param fd int destination of the body, -1 to return it in struct HttpData
+ * \return struct HttpData
+ *
+ */
+static struct HttpData http_fetch_ranges(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, bool is_https, size_t segments, int fd) {
+	struct HttpData ret = { 0 };
+	if (!host || !file)
+		return ret;
+	char *head_request = http_build_request("HEAD", host, file, add_info, false);
+	if (!head_request) {
+		ret.error = EError_OutOfMemory;
+		return ret;
+	}
+	struct HttpData head = http_fetch_request(host, head_request, true, timeout, is_https, 0, 0);
+	free(head_request);
+
+	size_t length = head.content_length;
+	size_t value_length = 0;
+	size_t value = head.error == EError_NoError && head.http_code == 200 ?
+			http_header_find(head.response, head.header_length, "Accept-Ranges", &value_length) : 0;
+	if (!value || !http_header_has_token(head.response + value, value_length, "bytes"))
+		length = 0;
+	if (!segments)
+		segments = SEGMENT_DEFAULT_COUNT;
+	if (segments > length / SEGMENT_MIN_SIZE)
+		segments = length / SEGMENT_MIN_SIZE;
+	off_t fd_offset = 0;
+#ifdef _WIN32
+	if (fd >= 0)
+		segments = 0;
+#else
+	// Ranges are written at their position, which needs a seekable file
+	if (fd >= 0 && (fd_offset = lseek(fd, 0, SEEK_CUR)) < 0)
+		segments = 0;
+#endif
+	struct http_segment *segment = segments > 1 ? calloc(segments, sizeof(struct http_segment)) : 0;
+	char *buffer = 0;
+	if (segment && fd < 0) {
+		// The body is assembled behind the header of the HEAD response
+		buffer = realloc(head.response, head.header_length + length + 1);
+		if (buffer)
+			head.response = buffer;
+		else {
+			free(segment);
+			segment = 0;
+		}
+	}
+	if (!segment) {
+		http_data_free(&head);
+		return fd >= 0 ? http_fetch_to_fd(host, file, add_info, timeout, is_https, fd) :
+				http_fetch(host, file, add_info, timeout, is_https, 0, 0);
+	}
+#ifndef _WIN32
+	struct stat file_stat;
+	// Preallocate the file, so ranges can be written in any order
+	if (fd >= 0 && !fstat(fd, &file_stat) && S_ISREG(file_stat.st_mode)
+			&& file_stat.st_size < fd_offset + (off_t) length)
+		if (ftruncate(fd, fd_offset + length)) {
+			int error = errno;
+			myperror(__LINE__, "Error preallocating file", error);
+		}
+#endif
+
+	ret.error = EError_NoError;
+	size_t segment_length = length / segments;
+	for (size_t i = 0; i < segments; i++) {
+		segment[i] = (struct http_segment) { .host = host, .is_https = is_https, .timeout = timeout, .fd = fd,
+				.fd_offset = fd_offset, .offset = i * segment_length, .length = segment_length,
+				.buffer = buffer ? buffer + head.header_length : 0 };
+		if (i == segments - 1)
+			segment[i].length = length - segment[i].offset;
+		char range[64];
+		snprintf(range, sizeof(range), "Range: bytes=%zu-%zu", segment[i].offset,
+				segment[i].offset + segment[i].length - 1);
+		char *header = http_join_header_line(add_info, range);
+		segment[i].request = header ? http_build_request("GET", host, file, header, false) : 0;
+		free(header);
+		if (!segment[i].request)
+			ret.error = EError_OutOfMemory;
+	}
+	// The first segment is received by the calling thread
+	for (size_t i = 1; i < segments && ret.error == EError_NoError; i++)
+		segment[i].started = !pthread_create(&segment[i].thread, 0, segment_thread, &segment[i]);
+	for (size_t i = 0; i < segments && ret.error == EError_NoError; i++)
+		if (!segment[i].started)
+			segment_thread(&segment[i]);
+
+	bool range_ignored = false;
+	ret.received_bytes = head.received_bytes;
+	for (size_t i = 0; i < segments; i++) {
+		if (segment[i].started)
+			pthread_join(segment[i].thread, 0);
+		range_ignored |= segment[i].range_ignored;
+		ret.received_bytes += segment[i].result.received_bytes;
+		if (ret.error == EError_NoError && segment[i].result.error != EError_NoError) {
+			ret.error = segment[i].result.error;
+			ret.http_code = segment[i].result.http_code;
+		} else if (ret.error == EError_NoError && segment[i].written != segment[i].length)
+			ret.error = EError_IncompleteResponse;
+		http_data_free(&segment[i].result);
+		free(segment[i].request);
+	}
+	free(segment);
+	if (range_ignored) {
+		http_data_free(&head);
+		return fd >= 0 ? http_fetch_to_fd(host, file, add_info, timeout, is_https, fd) :
+				http_fetch(host, file, add_info, timeout, is_https, 0, 0);
+	}
+	if (ret.error != EError_NoError) {
+		http_data_free(&head);
+		return ret;
+	}
+	ret.http_code = head.http_code;
+	ret.received_data_length = length;
+	ret.content_length = length;
+	if (buffer) {
+		buffer[head.header_length + length] = '\0';
+		ret.response = buffer;
+		ret.data = buffer + head.header_length;
+		ret.header_length = head.header_length;
+	} else {
+		http_data_free(&head);
+#ifndef _WIN32
+		// Leave the file position behind the body, as a sequential download would
+		lseek(fd, fd_offset + length, SEEK_SET);
+#endif
+	}
+	return ret;
+}
+
+/** \brief Downloads @p file like http_fetch_ranges, the HEAD and range requests are recorded as one request
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const requested file
+ * \param add_info char const*const additional info to be sent in header
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param is_https bool true to use HTTPS
+ * \param segments size_t maximum number of parallel connections, 0 for the default
+ * \param fd int destination of the body, -1 to return it in struct HttpData
+ * \return struct HttpData
+ *
+ */
+static struct HttpData http_fetch_segmented(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, bool is_https, size_t segments, int fd) {
+	int64_t start = metrics_call_begin();
+	struct HttpData ret = http_fetch_ranges(host, file, add_info, timeout, is_https, segments, fd);
+	metrics_call_end(&ret, start);
+	return ret;
+}
+
+struct HttpData http_get_segmented(char const *const host, char const *const file, char const *const add_info,
+		time_t timeout, size_t segments) {
+	return http_fetch_segmented(host, file, add_info, timeout, false, segments, -1);
+}
+
+struct HttpData https_get_segmented(char const *const host, char const *const file, char const *const add_info,
+		time_t timeout, size_t segments) {
+	return http_fetch_segmented(host, file, add_info, timeout, true, segments, -1);
+}
+
+struct HttpData http_get_segmented_to_fd(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, size_t segments, int fd) {
+	return http_fetch_segmented(host, file, add_info, timeout, false, segments, fd);
+}
+
+struct HttpData https_get_segmented_to_fd(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, size_t segments, int fd) {
+	return http_fetch_segmented(host, file, add_info, timeout, true, segments, fd);
+}
+
+enum engine_state {
+	EngineState_Resolving,
+	EngineState_Connecting,
+	EngineState_Handshake,
+	EngineState_Sending,
+	EngineState_Receiving,
+};
+
+typedef struct engine_request engine_request;
+
+/** \brief A request driven by an HttpEngine */
+struct engine_request {
+	struct HttpEngine *engine;
+	enum engine_state state;
+	char host[POOL_MAX_HOSTNAME];
+	unsigned short port;
+	bool is_https;
+	http_connection *conn;
+	bool pooled; /**< @brief The connection has been taken from the pool and may have been closed by the server */
+	struct dns_addresses addresses;
+#ifndef _WIN32
+	dns_query *query; /**< @brief Pending resolution of the host, 0 if none */
+#endif
+	size_t next_address; /**< @brief Next address to be tried */
+	int attempts[DNS_MAX_ADDRESSES]; /**< @brief Sockets with a pending connect, raced until one is established */
+	size_t attempt_count;
+	int fd; /**< @brief Socket registered for events, -1 if none */
+	short events; /**< @brief Registered events, POLLIN and / or POLLOUT */
+	char *request;
+	size_t request_length;
+	size_t sent;
+	struct http_response response;
+	int64_t started; /**< @brief Moment in microseconds of clock_now_us the request was submitted, 0 without metrics */
+	int64_t total_deadline; /**< @brief Monotonic time in ms at which the request times out, 0 for none */
+	int64_t deadline; /**< @brief Monotonic time in ms at which the current phase times out, 0 for none */
+	int64_t next_attempt; /**< @brief Monotonic time in ms at which the next address is tried, 0 for none */
+	int64_t timer; /**< @brief Earliest of @p deadline and @p next_attempt, 0 if the request is not in the timer heap */
+	size_t timer_index; /**< @brief Position in the timer heap of the engine */
+	HttpEngineCallback *callback;
+	void *user_data;
+	engine_request *prev;
+	engine_request *next;
+};
+
+/** \brief Drives many requests on non blocking sockets from a single thread */
+struct HttpEngine {
+#ifdef __linux__
+	int epoll_fd;
+#endif
+	engine_request *requests; /**< @brief Every request in flight */
+	size_t pending;
+#ifndef _WIN32
+	dns_notifier notifier; /**< @brief Reports resolutions finished by the resolver threads */
+#endif
+	engine_request **timers; /**< @brief Min heap of requests with a deadline or a pending connection attempt */
+	size_t timer_count;
+	size_t timer_capacity;
+};
+
+/** \brief Swaps two entries of the timer heap */
+static void engine_timer_swap(struct HttpEngine *engine, size_t a, size_t b) {
+	engine_request *tmp = engine->timers[a];
+	engine->timers[a] = engine->timers[b];
+	engine->timers[b] = tmp;
+	engine->timers[a]->timer_index = a;
+	engine->timers[b]->timer_index = b;
+}
+
+/** \brief Restores the heap property for the entry at @p index */
+static void engine_timer_fix(struct HttpEngine *engine, size_t index) {
+	while (index > 0 && engine->timers[index]->timer < engine->timers[(index - 1) / 2]->timer) {
+		engine_timer_swap(engine, index, (index - 1) / 2);
+		index = (index - 1) / 2;
+	}
+	while (true) {
+		size_t smallest = index, left = 2 * index + 1, right = left + 1;
+		if (left < engine->timer_count && engine->timers[left]->timer < engine->timers[smallest]->timer)
+			smallest = left;
+		if (right < engine->timer_count && engine->timers[right]->timer < engine->timers[smallest]->timer)
+			smallest = right;
+		if (smallest == index)
+			break;
+		engine_timer_swap(engine, index, smallest);
+		index = smallest;
+	}
+}
+
+/** \brief Makes room in the timer heap for @p count requests
+ *
+ * \return bool false on allocation error
+ *
+ */
+static bool engine_timer_reserve(struct HttpEngine *engine, size_t count) {
+	if (count > engine->timer_capacity) {
+		size_t capacity = engine->timer_capacity ? 2 * engine->timer_capacity : 64;
+		engine_request **timers = realloc(engine->timers, capacity * sizeof(engine_request*));
+		if (!timers)
+			return false;
+		engine->timers = timers;
+		engine->timer_capacity = capacity;
+	}
+	return true;
+}
+
+/** \brief Removes a request from the timer heap */
+static void engine_timer_remove(struct HttpEngine *engine, engine_request *req) {
+	if (!req->timer)
+		return;
+	size_t index = req->timer_index;
+	engine->timer_count--;
+	if (index != engine->timer_count) {
+		engine_timer_swap(engine, index, engine->timer_count);
+		engine_timer_fix(engine, index);
+	}
+	req->timer = 0;
+}
+
+/** \brief Moves @p req in the timer heap after its deadline or next attempt changed
+ * \details Room for every request has been reserved with engine_timer_reserve.
+ */
+static void engine_timer_update(engine_request *req) {
+	struct HttpEngine *engine = req->engine;
+	int64_t timer = req->deadline;
+	if (req->next_attempt && (!timer || req->next_attempt < timer))
+		timer = req->next_attempt;
+	if (!timer) {
+		engine_timer_remove(engine, req);
+	} else if (req->timer) {
+		req->timer = timer;
+		engine_timer_fix(engine, req->timer_index);
+	} else {
+		req->timer = timer;
+		req->timer_index = engine->timer_count++;
+		engine->timers[req->timer_index] = req;
+		engine_timer_fix(engine, req->timer_index);
+	}
+}
+
+/** \brief Starts the next phase of @p req, whose deadline replaces the one of the previous phase
+ *
+ * \param req engine_request* request
+ * \param phase_ms unsigned limit of the phase in milliseconds, 0 for none
+ * \return void
+ *
+ */
+static void engine_phase(engine_request *req, unsigned phase_ms) {
+	req->deadline = socket_phase_deadline(req->total_deadline, phase_ms);
+	engine_timer_update(req);
+}
+
+/** \brief Registers the interest of @p req in @p events on socket @p fd
+ *
+ * \return bool false if the socket could not be registered
+ *
+ */
+static bool engine_watch(engine_request *req, int fd, short events) {
+#ifdef __linux__
+	struct epoll_event ev = { .events = (events & POLLIN ? EPOLLIN : 0) | (events & POLLOUT ? EPOLLOUT : 0),
+			.data.ptr = req };
+	if (req->fd == fd && req->events == events)
+		return true;
+	int op = req->fd == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	if (req->fd >= 0 && req->fd != fd)
+		epoll_ctl(req->engine->epoll_fd, EPOLL_CTL_DEL, req->fd, 0);
+	if (epoll_ctl(req->engine->epoll_fd, op, fd, &ev)) {
+		req->fd = -1;
+		return false;
+	}
+#endif
+	req->fd = fd;
+	req->events = events;
+	return true;
+}
+
+/** \brief Removes the socket of @p req from the engine. Needs to be called before the socket is closed */
+static void engine_unwatch(engine_request *req) {
+#ifdef __linux__
+	if (req->fd >= 0)
+		epoll_ctl(req->engine->epoll_fd, EPOLL_CTL_DEL, req->fd, 0);
+#endif
+	req->fd = -1;
+	req->events = 0;
+}
+
+/** \brief Registers a socket with a pending connect as attempt of @p req
+ *
+ * \return bool false if the socket could not be registered
+ *
+ */
+static bool engine_attempt_add(engine_request *req, int fd) {
+#ifdef __linux__
+	struct epoll_event ev = { .events = EPOLLOUT, .data.ptr = req };
+	if (epoll_ctl(req->engine->epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+		return false;
+#endif
+	req->attempts[req->attempt_count++] = fd;
+	return true;
+}
+
+/** \brief Removes the attempt at @p index of @p req. Its socket is closed unless @p keep is set
+ *
+ * \return int socket of the attempt
+ *
+ */
+static int engine_attempt_remove(engine_request *req, size_t index, bool keep) {
+	int fd = req->attempts[index];
+	req->attempts[index] = req->attempts[--req->attempt_count];
+	if (!keep) {
+#ifdef __linux__
+		epoll_ctl(req->engine->epoll_fd, EPOLL_CTL_DEL, fd, 0);
+#endif
+		socket_close(fd);
+	}
+	return fd;
+}
+
+/** \brief Abandons every pending connection attempt of @p req */
+static void engine_attempts_close(engine_request *req) {
+	while (req->attempt_count)
+		engine_attempt_remove(req, 0, false);
+	req->next_attempt = 0;
+}
+
+/** \brief Finishes a request, hands its connection back to the pool or closes it and calls the callback
+ *
+ * \param req engine_request* request to be finished, freed by this function
+ * \param error enum EError EError_NoError if the response has been received
+ * \return void
+ *
+ */
+static void engine_complete(engine_request *req, enum EError error) {
+	struct HttpEngine *engine = req->engine;
+	struct HttpData ret = { 0 };
+	engine_unwatch(req);
+	engine_attempts_close(req);
+	engine_timer_remove(engine, req);
+#ifndef _WIN32
+	if (req->query)
+		dns_query_cancel(req->query);
+#endif
+
+	if (error == EError_NoError && http_response_reusable(&req->response))
+		pool_release(req->conn);
+	else
+		connection_close(req->conn);
+	ret = http_response_to_data(&req->response, error);
+	if (req->started)
+		metrics_record(&ret, req->sent, req->started);
+
+	if (req->prev)
+		req->prev->next = req->next;
+	else
+		engine->requests = req->next;
+	if (req->next)
+		req->next->prev = req->prev;
+	engine->pending--;
+
+	HttpEngineCallback *callback = req->callback;
+	void *user_data = req->user_data;
+	free(req->request);
+	free(req);
+	callback(ret, user_data);
+}
+
+static void engine_connect_next(engine_request *req);
+static void engine_resolved(engine_request *req, enum EError error);
+static void engine_send(engine_request *req);
+
+/** \brief Opens a new connection for @p req
+ *
+ * \return void
+ *
+ */
+static void engine_connect_start(engine_request *req) {
+	req->pooled = false;
+	req->conn = connection_new(req->host, req->port, req->is_https);
+	if (!req->conn) {
+		engine_complete(req, EError_CreateSocketError);
+		return;
+	}
+	engine_phase(req, timeout_dns_ms);
+	enum EError error = EError_NoError;
+	if (dns_cache_lookup(req->host, &req->addresses)) {
+		error = req->addresses.error;
+#ifndef _WIN32
+	} else if (req->engine->notifier.fd[0] >= 0
+			&& (req->query = dns_resolve_async(req->host, &req->engine->notifier, req))) {
+		// Continued by engine_resolved, the engine keeps serving other requests meanwhile
+		req->state = EngineState_Resolving;
+		return;
+#endif
+	} else {
+		error = dns_resolve(req->host, &req->addresses);
+	}
+	engine_resolved(req, error);
+}
+
+/** \brief Continues @p req once the addresses of its host are known
+ *
+ * \param req engine_request* request
+ * \param error enum EError result of the resolution
+ * \return void
+ *
+ */
+static void engine_resolved(engine_request *req, enum EError error) {
+	if (error != EError_NoError) {
+		engine_complete(req, error);
+		return;
+	}
+	engine_phase(req, timeout_connect_ms);
+	req->next_address = 0;
+	engine_connect_next(req);
+}
+
+#ifndef _WIN32
+/** \brief Continues the requests whose resolution has been finished by a resolver thread
+ *
+ * \param engine struct HttpEngine* engine
+ * \return void
+ *
+ */
+static void engine_process_resolved(struct HttpEngine *engine) {
+	dns_query *completed = dns_notifier_take(&engine->notifier);
+	for (dns_query *query = completed; query; query = query->next)
+		((engine_request*) query->owner)->query = 0;
+	while (completed) {
+		dns_query *query = completed;
+		completed = query->next;
+		engine_request *req = query->owner;
+		req->addresses = query->addresses;
+		free(query);
+		engine_resolved(req, req->addresses.error);
+	}
+}
+#endif
+
+/** \brief Handles a failure of a request. A request over a pooled connection the server closed is restarted on a new connection
+ *
+ * \return void
+ *
+ */
+static void engine_fail(engine_request *req, enum EError error) {
+	if (req->pooled && !req->response.received) {
+		engine_unwatch(req);
+		connection_close(req->conn);
+		req->conn = 0;
+		req->sent = 0;
+		engine_connect_start(req);
+	} else {
+		engine_complete(req, error);
+	}
+}
+
+/** \brief Continues the TLS handshake
+ *
+ * \return void
+ *
+ */
+static void engine_handshake(engine_request *req) {
+	BIO *bio = req->conn->bio;
+	if (BIO_do_handshake(bio) > 0) {
+		req->state = EngineState_Sending;
+		engine_phase(req, timeout_transfer_ms);
+		engine_send(req);
+	} else if (BIO_should_retry(bio)) {
+		if (!engine_watch(req, req->fd, BIO_should_write(bio) ? POLLOUT : POLLIN))
+			engine_complete(req, EError_ConnectionError);
+	} else {
+		engine_complete(req, https_handshake_error(bio));
+	}
+}
+
+/** \brief Called as soon as the TCP connection of @p req is established
+ *
+ * \return void
+ *
+ */
+static void engine_connected(engine_request *req) {
+	if (req->is_https) {
+		enum EError error = EError_NoError;
+		int fd = req->conn->socket;
+		req->conn->socket = -1; // owned by the BIO chain from now on
+		req->conn->bio = https_wrap_socket(req->host, fd, &error);
+		if (!req->conn->bio) {
+			engine_unwatch(req);
+			engine_complete(req, error);
+			return;
+		}
+		req->state = EngineState_Handshake;
+		engine_phase(req, timeout_tls_ms);
+		engine_handshake(req);
+	} else {
+		req->state = EngineState_Sending;
+		engine_phase(req, timeout_transfer_ms);
+		engine_send(req);
+	}
+}
+
+/** \brief Starts a non blocking connect to the next resolved address of the host
+ * \details The addresses are raced like in socket_connect: while earlier attempts are pending, the next address is
+ tried after CONNECT_ATTEMPT_DELAY_MS, driven by the timer of the request. The request fails once no attempt is left.
+ *
+ * \return void
+ *
+ */
+static void engine_connect_next(engine_request *req) {
+	req->next_attempt = 0;
+	while (req->next_address < req->addresses.count) {
+		size_t index = req->next_address++;
+		enum EError error = EError_NoError;
+		int s = socket_connect_start(&req->addresses.address[index], req->addresses.length[index], req->port,
+				&error);
+		if (s < 0)
+			continue;
+		if (!engine_attempt_add(req, s)) {
+			socket_close(s);
+			continue;
+		}
+		req->state = EngineState_Connecting;
+		if (req->next_address < req->addresses.count)
+			req->next_attempt = clock_now_ms() + CONNECT_ATTEMPT_DELAY_MS;
+		break;
+	}
+	engine_timer_update(req);
+	if (!req->attempt_count)
+		engine_complete(req, EError_ConnectionError);
+}
+
+/** \brief Called when a pending connect of @p req finished. The first established connection wins
+ *
+ * \return void
+ *
+ */
+static void engine_connect_done(engine_request *req) {
+	struct pollfd fds[DNS_MAX_ADDRESSES];
+	for (size_t i = 0; i < req->attempt_count; i++)
+		fds[i] = (struct pollfd) { .fd = req->attempts[i], .events = POLLOUT };
+	if (socket_poll(fds, req->attempt_count, 0) <= 0)
+		return;
+	bool failed = false;
+	// Backwards, removing an attempt moves the last one into its place
+	for (size_t i = req->attempt_count; i-- > 0;) {
+		if (!fds[i].revents)
+			continue;
+		int error = 0;
+		socklen_t length = sizeof(error);
+		if (getsockopt(req->attempts[i], SOL_SOCKET, SO_ERROR, (void*) &error, &length) || error) {
+			myperror(__LINE__, "Error connecting to socket.", error);
+			engine_attempt_remove(req, i, false);
+			failed = true;
+			continue;
+		}
+		// Still registered for POLLOUT, which engine_watch takes over
+		req->conn->socket = engine_attempt_remove(req, i, true);
+		req->fd = req->conn->socket;
+		req->events = POLLOUT;
+		engine_attempts_close(req);
+		engine_timer_update(req);
+		engine_connected(req);
+		return;
+	}
+	// The next address does not have to wait for the delay
+	if (failed)
+		engine_connect_next(req);
+}
+
+/** \brief Sends as much of the request as the socket accepts
+ *
+ * \return void
+ *
+ */
+static void engine_send(engine_request *req) {
+	int fd = connection_get_socket(req->conn);
+	while (req->sent < req->request_length) {
+		short wait_events = 0;
+		int n = connection_write(req->conn, req->request + req->sent, req->request_length - req->sent, &wait_events);
+		if (n < 0 && wait_events) {
+			if (!engine_watch(req, fd, wait_events))
+				engine_complete(req, EError_ConnectionError);
+			return;
+		}
+		if (n <= 0) {
+			engine_fail(req, EError_ConnectionError);
+			return;
+		}
+		req->sent += n;
+	}
+	req->state = EngineState_Receiving;
+	http_parser_init(&req->response.parser);
+	if (!engine_watch(req, fd, POLLIN))
+		engine_complete(req, EError_ConnectionError);
+}
+
+/** \brief Reads everything available from the connection of @p req
+ *
+ * \return void
+ *
+ */
+static void engine_receive(engine_request *req) {
+	struct http_response *response = &req->response;
+	while (true) {
+		if (!http_response_reserve(response, http_response_next_read(response))) {
+			engine_complete(req, EError_OutOfMemory);
+			return;
+		}
+		short wait_events = 0;
+		int n = connection_read(req->conn, response->buffer + response->length,
+				response->capacity - response->length - 1, &wait_events);
+		if (n < 0 && wait_events) {
+			if (!engine_watch(req, req->fd, wait_events))
+				engine_complete(req, EError_ConnectionError);
+			return;
+		}
+		if (n <= 0) {
+			// Connection closed, the end of the response is the end of the connection
+			if (!response->received)
+				engine_fail(req, EError_ConnectionError);
+			else if (http_parser_finish(&response->parser) == ParserState_Complete)
+				engine_complete(req, EError_NoError);
+			else
+				engine_complete(req, EError_IncompleteResponse);
+			return;
+		}
+		switch (http_response_append(response, n)) {
+		case ParserState_Complete:
+			engine_complete(req, EError_NoError);
+			return;
+		case ParserState_Error:
+			engine_complete(req, response->aborted ? EError_Aborted : EError_InvalidResponse);
+			return;
+		default:
+			break;
+		}
+	}
+}
+
+/** \brief Continues @p req after its socket became ready
+ *
+ * \return void
+ *
+ */
+static void engine_dispatch(engine_request *req) {
+	switch (req->state) {
+	case EngineState_Resolving:
+		break;
+	case EngineState_Connecting:
+		engine_connect_done(req);
+		break;
+	case EngineState_Handshake:
+		engine_handshake(req);
+		break;
+	case EngineState_Sending:
+		engine_send(req);
+		break;
+	case EngineState_Receiving:
+		engine_receive(req);
+		break;
+	}
+}
+
+/** \brief Takes an idle connection from the pool or starts connecting
+ *
+ * \return void
+ *
+ */
+static void engine_start(engine_request *req) {
+	req->conn = pool_acquire(req->host, req->port, req->is_https);
+	if (req->conn && socket_set_blocking(connection_get_socket(req->conn), false)) {
+		req->pooled = true;
+		req->state = EngineState_Sending;
+		engine_phase(req, timeout_transfer_ms);
+		engine_send(req);
+	} else {
+		connection_close(req->conn);
+		engine_connect_start(req);
+	}
+}
+
+struct HttpEngine* http_engine_create(void) {
+	struct HttpEngine *engine = calloc(1, sizeof(struct HttpEngine));
+	if (!engine)
+		return 0;
+	if (socket_init() != SOCK_OK) {
+		free(engine);
+		return 0;
+	}
+#ifdef __linux__
+	engine->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (engine->epoll_fd < 0) {
+		int error = get_last_error();
+		myperror(__LINE__, "Error creating epoll instance", error);
+		free(engine);
+		socket_deinit();
+		return 0;
+	}
+#endif
+#ifndef _WIN32
+	// Without notifier hosts are resolved synchronously
+	if (dns_notifier_init(&engine->notifier)) {
+#ifdef __linux__
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = 0 };
+		if (epoll_ctl(engine->epoll_fd, EPOLL_CTL_ADD, engine->notifier.fd[0], &ev))
+			dns_notifier_destroy(&engine->notifier);
+#endif
+	}
+#endif
+	return engine;
+}
+
+bool http_engine_submit(struct HttpEngine *engine, enum HttpCommand command,
+		char const *const host, char const *const file, char const *const user_agent,
+		char const *const add_info, time_t timeout, HttpEngineCallback *callback_func,
+		void *user_data) {
+	if (!engine || !host || !file || !callback_func || strlen(host) >= POOL_MAX_HOSTNAME)
+		return false;
+	if (command == HttpCommand_GetHttpsUserAgent && !user_agent)
+		return false;
+	engine_request *req = calloc(1, sizeof(engine_request));
+	if (!req)
+		return false;
+	char *header = 0;
+	if (command == HttpCommand_GetHttpsUserAgent) {
+		header = http_join_user_agent(add_info, user_agent);
+		if (!header) {
+			free(req);
+			return false;
+		}
+	}
+	req->request = http_create_request(host, file, header ? header : add_info);
+	free(header);
+	if (!req->request) {
+		free(req);
+		return false;
+	}
+	req->engine = engine;
+	req->request_length = strlen(req->request);
+	strcpy(req->host, host);
+	req->is_https = command != HttpCommand_GetHttp;
+	req->port = req->is_https ? HTTPS_PORT : HTTP_PORT;
+	req->fd = -1;
+	req->callback = callback_func;
+	req->user_data = user_data;
+	// Every request may hold one timer, so that starting a phase never fails
+	if (!engine_timer_reserve(engine, engine->pending + 1)) {
+		free(req->request);
+		free(req);
+		return false;
+	}
+	req->total_deadline = socket_deadline(timeout);
+	req->started = http_metrics ? clock_now_us() : 0;
+	req->next = engine->requests;
+	if (req->next)
+		req->next->prev = req;
+	engine->requests = req;
+	engine->pending++;
+
+	engine_start(req);
+	return true;
+}
+
+size_t http_engine_run(struct HttpEngine *engine, int timeout_ms) {
+	if (!engine || !engine->pending)
+		return 0;
+	int wait_ms = timeout_ms;
+	if (engine->timer_count) {
+		int64_t until = engine->timers[0]->timer - clock_now_ms();
+		if (until < 0)
+			until = 0;
+		if (wait_ms < 0 || until < wait_ms)
+			wait_ms = until;
+	}
+
+#ifdef __linux__
+	struct epoll_event events[ENGINE_MAX_EVENTS];
+	int n = epoll_wait(engine->epoll_fd, events, ENGINE_MAX_EVENTS, wait_ms);
+	for (int i = 0; i < n; i++) {
+		// A connecting request may report several sockets, it is dispatched once as it may finish meanwhile
+		bool dispatched = false;
+		for (int j = 0; j < i && !dispatched; j++)
+			dispatched = events[j].data.ptr == events[i].data.ptr;
+		if (dispatched)
+			continue;
+		if (events[i].data.ptr)
+			engine_dispatch(events[i].data.ptr);
+		else
+			engine_process_resolved(engine);
+	}
+#else
+	size_t count = 1;
+	for (engine_request *req = engine->requests; req; req = req->next)
+		count += req->attempt_count ? req->attempt_count : 1;
+	struct pollfd *fds = malloc(count * sizeof(struct pollfd));
+	engine_request **reqs = malloc(count * sizeof(engine_request*));
+	count = 0;
+	if (fds && reqs) {
+#ifndef _WIN32
+		if (engine->notifier.fd[0] >= 0) {
+			fds[count] = (struct pollfd) { .fd = engine->notifier.fd[0], .events = POLLIN };
+			reqs[count++] = 0;
+		}
+#endif
+		for (engine_request *req = engine->requests; req; req = req->next) {
+			for (size_t i = 0; i < req->attempt_count; i++) {
+				fds[count] = (struct pollfd) { .fd = req->attempts[i], .events = POLLOUT };
+				reqs[count++] = req;
+			}
+			if (req->fd >= 0) {
+				fds[count] = (struct pollfd) { .fd = req->fd, .events = req->events };
+				reqs[count++] = req;
 			}
-		} else if (ret.http_code && ret.http_code != 200) {
-			ret.data = buffer;
 		}
+		int n = socket_poll(fds, count, wait_ms);
+		engine_request *dispatched = 0;
+		for (size_t i = 0; n > 0 && i < count; i++) {
+			// The sockets of a request are adjacent, it is dispatched once as it may finish meanwhile
+			if (fds[i].revents && reqs[i] && reqs[i] != dispatched) {
+				dispatched = reqs[i];
+				engine_dispatch(reqs[i]);
+			}
+#ifndef _WIN32
+			else if (fds[i].revents && !reqs[i])
+				engine_process_resolved(engine);
+#endif
+		}
+	}
+	free(fds);
+	free(reqs);
+#endif
 
-		socket_close(s);
-		free(http_request);
-		socket_deinit();
+	int64_t now = clock_now_ms();
+	while (engine->timer_count && engine->timers[0]->timer <= now) {
+		engine_request *req = engine->timers[0];
+		if (req->deadline && req->deadline <= now)
+			engine_complete(req, EError_Timeout);
+		else
+			engine_connect_next(req);
 	}
-	return ret;
+	return engine->pending;
+}
 
-ERR_RECV:
-	(void) ret;
-	int error = get_last_error();
-	myperror(__LINE__, "Error during receive", error);
-	free(ret.data);
-	ret.data = 0;
-	ERR_SEND: free(http_request);
-	ERR_SOCKET: socket_close(s);
-	return ret;
+size_t http_engine_pending(struct HttpEngine const *const engine) {
+	return engine ? engine->pending : 0;
 }
 
-bool socket_check_connection(void) // This is not a good solution, but it should work.
-{
-	struct HttpData ret = http_get("www.google.com", "/", 0, 0);
-	if (ret.data) {
-		free(ret.data);
-		return true;
+void http_engine_destroy(struct HttpEngine *engine) {
+	if (!engine)
+		return;
+	while (engine->requests) {
+		engine_request *req = engine->requests;
+		engine->requests = req->next;
+		engine_unwatch(req);
+		engine_attempts_close(req);
+#ifndef _WIN32
+		if (req->query)
+			dns_query_cancel(req->query);
+#endif
+		connection_close(req->conn);
+		http_response_inflate_free(&req->response);
+		free(req->response.buffer);
+		free(req->request);
+		free(req);
 	}
-	return false;
+#ifndef _WIN32
+	dns_notifier_destroy(&engine->notifier);
+#endif
+#ifdef __linux__
+	close(engine->epoll_fd);
+#endif
+	free(engine->timers);
+	free(engine);
+	socket_deinit();
 }
 
-/** \brief Reports error message from openSSL library
+/** \brief State of one request of a batch */
+struct batch_item {
+	struct HttpBatch *batch;
+	size_t index; /**< @brief Index of the request in the batch */
+	size_t host; /**< @brief Index of the first request of the batch to the same host */
+	bool started;
+	bool finished;
+};
+
+/** \brief Requests of http_batch_start, driven by an event engine while the caller waits */
+struct HttpBatch {
+	struct HttpEngine *engine;
+	struct HttpRequest const *requests;
+	struct HttpData *results;
+	struct batch_item *items;
+	size_t count;
+	size_t max_concurrency;
+	time_t timeout;
+	size_t in_flight;
+	size_t *host_in_flight; /**< @brief Requests in flight per host, indexed by batch_item.host */
+	size_t next; /**< @brief All requests before this index have been started */
+	size_t *finished; /**< @brief Indices of finished requests in the order they finished */
+	size_t finished_count;
+	size_t reported; /**< @brief Number of finished requests returned by http_batch_wait_any */
+	size_t affinity; /**< @brief Number of finished requests whose host has been considered for the next request */
+};
+
+/** \brief Checks whether two requests of a batch go to the same host and can share a connection */
+static bool batch_same_host(struct HttpRequest const *const a, struct HttpRequest const *const b) {
+	return (a->command == HttpCommand_GetHttp) == (b->command == HttpCommand_GetHttp) && !strcasecmp(a->host, b->host);
+}
+
+/** \brief Finds a request of @p batch which has not been started yet and whose host is below BATCH_MAX_PER_HOST
+ * \details Requests to a host at its limit wait until a request to it finished and then reuse its connection.
+ *
+ * \param batch struct HttpBatch* batch
+ * \param like size_t index of a request whose host should be matched, HTTP_BATCH_NONE to take the next request in order
+ * \return size_t index of the request, HTTP_BATCH_NONE if there is none
  *
  */
-static void report_and_exit(const char *msg) {
-	int error = get_last_error();
-	myperror(__LINE__, msg, error);
-	ERR_print_errors_fp(stderr);
-	exit(-1);
+static size_t batch_find_unstarted(struct HttpBatch *batch, size_t like) {
+	while (batch->next < batch->count && batch->items[batch->next].started)
+		batch->next++;
+	for (size_t i = batch->next; i < batch->count; i++) {
+		struct batch_item const *item = &batch->items[i];
+		if (!item->started && batch->host_in_flight[item->host] < BATCH_MAX_PER_HOST
+				&& (like == HTTP_BATCH_NONE || item->host == batch->items[like].host))
+			return i;
+	}
+	return HTTP_BATCH_NONE;
 }
 
-/** \brief Initialize openSSL and HTTPS
+/** \brief Records the result of a finished request of a batch */
+static void batch_callback(struct HttpData data, void *user_data) {
+	struct batch_item *item = user_data;
+	struct HttpBatch *batch = item->batch;
+	batch->results[item->index] = data;
+	item->finished = true;
+	batch->finished[batch->finished_count++] = item->index;
+	batch->in_flight--;
+	batch->host_in_flight[item->host]--;
+}
+
+/** \brief Submits request @p index of @p batch to its engine
  *
  * \return void
  *
  */
-static void https_init() {
-	SSL_load_error_strings();
-	SSL_library_init();
+static void batch_start(struct HttpBatch *batch, size_t index) {
+	struct HttpRequest const *request = &batch->requests[index];
+	batch->items[index].started = true;
+	batch->in_flight++;
+	batch->host_in_flight[batch->items[index].host]++;
+	if (!http_engine_submit(batch->engine, request->command, request->host, request->file, request->user_agent,
+			request->add_info, batch->timeout, batch_callback, &batch->items[index]))
+		batch_callback((struct HttpData) { .error = EError_InvalidArgument }, &batch->items[index]);
 }
 
-/** \brief Cleanup openSSL and HTTPS
+/** \brief Starts requests until the concurrency limit is reached
+ * \details Requests to the host of a request which just finished are started first, so they pick up the connection
+ which has just been returned to the keep-alive pool.
  *
- * \param ctx SSL_CTX*
- * \param bio BIO*
+ * \param batch struct HttpBatch* batch
  * \return void
  *
  */
-static void https_cleanup(SSL_CTX *ctx, BIO *bio) {
-	SSL_CTX_free(ctx);
-	BIO_free_all(bio);
+static void batch_fill(struct HttpBatch *batch) {
+	while (batch->affinity < batch->finished_count && batch->in_flight < batch->max_concurrency) {
+		size_t index = batch_find_unstarted(batch, batch->finished[batch->affinity++]);
+		if (index != HTTP_BATCH_NONE)
+			batch_start(batch, index);
+	}
+	batch->affinity = batch->finished_count;
+	while (batch->in_flight < batch->max_concurrency) {
+		size_t index = batch_find_unstarted(batch, HTTP_BATCH_NONE);
+		if (index == HTTP_BATCH_NONE)
+			break;
+		batch_start(batch, index);
+	}
 }
 
-/** \brief Connect via HTTP to host
+struct HttpBatch* http_batch_start(struct HttpRequest const *requests, struct HttpData *results, size_t count,
+		size_t max_concurrency, time_t timeout) {
+	if ((!requests || !results) && count)
+		return 0;
+	struct HttpBatch *batch = calloc(1, sizeof(struct HttpBatch));
+	if (!batch)
+		return 0;
+	*batch = (struct HttpBatch) { .engine = http_engine_create(), .requests = requests, .results = results,
+			.items = calloc(count ? count : 1, sizeof(struct batch_item)),
+			.count = count, .max_concurrency = max_concurrency ? max_concurrency : BATCH_DEFAULT_CONCURRENCY,
+			.timeout = timeout, .host_in_flight = calloc(count ? count : 1, sizeof(size_t)),
+			.finished = malloc((count ? count : 1) * sizeof(size_t)) };
+	size_t *hosts = malloc((count ? count : 1) * sizeof(size_t)); // First request of every distinct host
+	if (!batch->engine || !batch->items || !batch->host_in_flight || !batch->finished || !hosts) {
+		http_engine_destroy(batch->engine);
+		free(batch->items);
+		free(batch->host_in_flight);
+		free(batch->finished);
+		free(batch);
+		free(hosts);
+		return 0;
+	}
+	size_t host_count = 0;
+	for (size_t i = 0; i < count; i++) {
+		size_t host = 0;
+		while (host < host_count && !batch_same_host(&requests[hosts[host]], &requests[i]))
+			host++;
+		if (host == host_count)
+			hosts[host_count++] = i;
+		batch->items[i] = (struct batch_item) { .batch = batch, .index = i, .host = hosts[host] };
+		results[i] = (struct HttpData) { 0 };
+	}
+	free(hosts);
+	batch_fill(batch);
+	return batch;
+}
+
+/** \brief Advances the requests of @p batch once
  *
- * \param hostname const char* hostname to be connected to
- * \param ctx_in SSL_CTX**
- * \return BIO*
+ * \param batch struct HttpBatch* batch
+ * \param deadline int64_t time in milliseconds to wait until at most, -1 to wait for the next event
+ * \return bool false if @p deadline has passed
  *
  */
-static BIO* https_connect(const char *hostname, SSL_CTX **ctx_in) {
-	size_t BuffSize = 1000;
-	char name[BuffSize];
-
-	const SSL_METHOD *method = TLS_client_method();
-	if (NULL == method)
-		report_and_exit("TLSv1_2_client_method...");
-
-	*ctx_in = SSL_CTX_new(method);
-	if (NULL == *ctx_in)
-		report_and_exit("SSL_CTX_new...");
-
-	BIO *bio = BIO_new_ssl_connect(*ctx_in);
-	if (NULL == bio)
-		report_and_exit("BIO_new_ssl_connect...");
-
-	SSL *ssl = NULL;
-
-	/* link bio channel, SSL session, and server endpoint */
-
-	sprintf(name, "%s:%s", hostname, "https");
-	BIO_get_ssl(bio, &ssl); /* session */
-	SSL_set_mode(ssl, SSL_MODE_AUTO_RETRY); /* robustness */
-	BIO_set_conn_hostname(bio, name); /* prepare to connect */
-
-	/* try to connect */
-	if (BIO_do_connect(bio) <= 0) {
-		https_cleanup(*ctx_in, bio);
-		report_and_exit("BIO_do_connect...");
+static bool batch_run(struct HttpBatch *batch, int64_t deadline) {
+	int wait_ms = -1;
+	if (deadline >= 0) {
+		int64_t remaining = deadline - clock_now_ms();
+		wait_ms = remaining > 0 ? remaining : 0;
 	}
+	http_engine_run(batch->engine, wait_ms);
+	batch_fill(batch);
+	return deadline < 0 || clock_now_ms() < deadline;
+}
 
-#define SKIP_VERIFICATION
-#ifndef SKIP_VERIFICATION
-    /* verify truststore, check cert */
+size_t http_batch_wait_any(struct HttpBatch *batch, int timeout_ms) {
+	if (!batch)
+		return HTTP_BATCH_NONE;
+	int64_t deadline = timeout_ms < 0 ? -1 : clock_now_ms() + timeout_ms;
+	while (batch->reported == batch->finished_count) {
+		if (batch->finished_count == batch->count || !batch_run(batch, deadline))
+			break;
+	}
+	if (batch->reported == batch->finished_count)
+		return HTTP_BATCH_NONE;
+	return batch->finished[batch->reported++];
+}
 
-    if (!SSL_CTX_load_verify_locations(*ctx_in,
-                                       "/etc/ssl/certs/ca-certificates.crt", /* truststore */
-                                       "/etc/ssl/certs/")) /* more truststore */
-       report_and_exit("SSL_CTX_load_verify_locations...");
+size_t http_batch_wait_all(struct HttpBatch *batch, int timeout_ms) {
+	if (!batch)
+		return 0;
+	int64_t deadline = timeout_ms < 0 ? -1 : clock_now_ms() + timeout_ms;
+	while (batch->finished_count < batch->count && batch_run(batch, deadline))
+		;
+	batch->reported = batch->finished_count;
+	return batch->count - batch->finished_count;
+}
 
-    long verify_flag = SSL_get_verify_result(ssl);
-    if (verify_flag != X509_V_OK)
-        fprintf(stderr,
-                "##### Certificate verification error (%i) but continuing...\n",
-                (int) verify_flag);
-#else
-#warning "Warning: SSL Verification is being skipped. Man in the Middle Attacks can not be discovered"
-#endif // SKIP_VERIFICATION
+void http_batch_free(struct HttpBatch *batch) {
+	if (!batch)
+		return;
+	http_engine_destroy(batch->engine);
+	for (size_t i = 0; i < batch->count; i++) {
+		if (!batch->items[i].finished)
+			batch->results[i].error = EError_Aborted;
+	}
+	free(batch->items);
+	free(batch->host_in_flight);
+	free(batch->finished);
+	free(batch);
+}
 
-	return bio;
+bool http_get_many(struct HttpRequest const *requests, struct HttpData *results, size_t count,
+		size_t max_concurrency, time_t timeout) {
+	struct HttpBatch *batch = http_batch_start(requests, results, count, max_concurrency, timeout);
+	if (!batch)
+		return false;
+	http_batch_wait_all(batch, -1);
+	http_batch_free(batch);
+	return true;
 }
 
-/** \brief Receives https reponse from bio
+/** \brief Pipelines requests to one host over one connection at a time
+ * \details Up to @p depth requests are written ahead of the oldest unanswered one. If the connection breaks or the
+ server closes it, the unanswered requests are sent again over a new connection. The requests are given up after
+ two connections in a row failed without answering any request.
  *
- * \param bio BIO*
- * \return struct HttpData
+ * \param requests struct HttpRequest const* requests of the caller
+ * \param results struct HttpData* results of the caller
+ * \param indices size_t const* indices of the requests of this group, all to the same host and scheme
+ * \param count size_t number of requests in the group
+ * \param depth size_t maximum number of unanswered requests on the connection
+ * \param deadline int64_t deadline in milliseconds of clock_now_ms, 0 for none
+ * \return void
  *
  */
-static struct HttpData https_receive(BIO *bio, time_t timeout) {
-	size_t resp_len = 1E6, recv_len = 0;
-	char *response = calloc(resp_len, sizeof(char));
-	/* read HTTP response from server and print to stdout */
-	while (1) {
-		if(socket_istimedout(timeout))
+static void http_pipeline_group(struct HttpRequest const *requests, struct HttpData *results, size_t const *indices,
+		size_t count, size_t depth, int64_t deadline) {
+	struct HttpRequest const *first = &requests[indices[0]];
+	bool is_https = first->command != HttpCommand_GetHttp;
+	unsigned short port = is_https ? HTTPS_PORT : HTTP_PORT;
+	enum EError error = EError_OutOfMemory;
+	size_t answered = 0;
+	char **messages = calloc(count, sizeof(char*));
+	bool prepared = messages;
+	for (size_t i = 0; prepared && i < count; i++) {
+		struct HttpRequest const *request = &requests[indices[i]];
+		char *header = 0;
+		if (request->command == HttpCommand_GetHttpsUserAgent && !(header = http_join_user_agent(request->add_info,
+				request->user_agent))) {
+			prepared = false;
 			break;
-		int n = BIO_read(bio, response + recv_len, resp_len - recv_len);
-		if (n <= 0)
-			break; /* 0 is end-of-stream, < 0 is an error */
-		recv_len += n;
+		}
+		messages[i] = http_create_request(request->host, request->file, header ? header : request->add_info);
+		free(header);
+		prepared = messages[i];
 	}
-	response = realloc(response, strlen(response) + 1);
 
-	struct HttpData ret = http_parse_header(response, recv_len);
-	ret.data = response;
-	return ret;
-}
-
-struct HttpData https_get(char const *const host, char const *const file, char const *const add_info, time_t timeout) {
-	struct HttpData ret = { 0 };
-	https_init();
-	SSL_CTX *ctx = NULL;
-	BIO *bio = https_connect(host, &ctx);
-	char *http_request = http_create_request(host, file, add_info);
-	int sent_bytes = BIO_puts(bio, http_request);
-	if (sent_bytes == -1 || sent_bytes == 0) {
-		int error = get_last_error();
-		myperror(__LINE__, "Error while sending data over HTTPS socket!",
-				error);
-		return ret;
-	}
-	assert(strlen(http_request) == sent_bytes);
-	free(http_request);
-	http_request = NULL;
+	// Pipelined requests are measured from the start of the group
+	int64_t start = http_metrics ? clock_now_us() : 0;
+	struct http_response response = { 0 };
+	for (int failures = 0; prepared && answered < count && failures < 2;) {
+		http_connection *conn = pool_acquire(first->host, port, is_https);
+		if (!conn)
+			conn = is_https ? https_connection_open(first->host, deadline, 0, &error) :
+					http_connection_open(first->host, deadline, 0, &error);
+		if (!conn)
+			break;
+		error = socket_set_blocking(connection_get_socket(conn), false) ? EError_NoError : EError_ConnectionError;
+		size_t sent = answered;
+		bool progress = false, keep_alive = true;
+		while (error == EError_NoError && answered < count && keep_alive) {
+			// The transfer limit applies to each response from the moment it is the oldest one outstanding
+			int64_t transfer_deadline = socket_phase_deadline(deadline, timeout_transfer_ms);
+			while (sent < count && (!depth || sent - answered < depth) && error == EError_NoError) {
+				error = connection_write_all(conn, messages[sent], strlen(messages[sent]), transfer_deadline);
+				if (error == EError_NoError)
+					sent++;
+			}
+			if (sent == answered)
+				break;
 
-	ret = https_receive(bio, timeout);
-	if (ret.received_data_length != ret.content_length) {
-		if (ret.http_code != 200 || http_has_content_information(ret.data)) {
-			int error = get_last_error();
-			myperror(__LINE__, "Error during receiving of https_get", error);
-			ret.data = http_get_error_msg(ret.http_code, ret.data);
+			// Earlier responses may already have delivered the start of this one
+			http_parser_init(&response.parser);
+			enum EError receive_error = EError_NoError;
+			switch (response.length ? http_response_append(&response, 0) : ParserState_Header) {
+			case ParserState_Complete:
+				break;
+			case ParserState_Error:
+				receive_error = EError_InvalidResponse;
+				break;
+			default:
+				receive_error = connection_receive(conn, &response, transfer_deadline);
+				break;
+			}
+			if (receive_error != EError_NoError) {
+				if (response.received || receive_error == EError_Timeout) {
+					results[indices[answered]] = http_response_to_data(&response, receive_error);
+					if (start)
+						metrics_record(&results[indices[answered]], strlen(messages[answered]), start);
+					answered++;
+				}
+				error = receive_error;
+				break;
+			}
+			struct http_response next;
+			if (!http_response_take_leftover(&response, &next)) {
+				error = EError_OutOfMemory;
+				break;
+			}
+			keep_alive = response.parser.keep_alive;
+			results[indices[answered]] = http_response_to_data(&response, EError_NoError);
+			if (start)
+				metrics_record(&results[indices[answered]], strlen(messages[answered]), start);
+			answered++;
+			response = next;
+			progress = true;
 		}
+		if (error == EError_NoError && keep_alive && answered == count && !response.length)
+			pool_release(conn);
+		else
+			connection_close(conn);
+		// Bytes of a broken connection are useless for the next one
+		http_response_inflate_free(&response);
+		free(response.buffer);
+		response = (struct http_response) { 0 };
+		if (error == EError_Timeout)
+			break;
+		failures = progress ? 0 : failures + 1;
 	}
-	https_cleanup(ctx, bio);
-	if (http_is_response_ok(ret.data)) {
-		ret.data = http_remove_header(ret.data);
+
+	for (; answered < count; answered++) {
+		results[indices[answered]] = (struct HttpData) { .error = error != EError_NoError ? error : EError_ConnectionError };
+		if (start)
+			metrics_record(&results[indices[answered]], 0, start);
 	}
-	return ret;
+	for (size_t i = 0; messages && i < count; i++)
+		free(messages[i]);
+	free(messages);
 }
 
-struct HttpData https_get_with_useragent(char const *const host,
-		char const *const file, char const *const user_agent,
-		char const *const add_info, time_t timeout) {
-	struct HttpData ret = { 0 };
-	size_t buffer_length = 150;
-	if (user_agent) {
-		char *http_useragent = socket_get_useragent(user_agent);
-		assert(strlen(http_useragent) < buffer_length - 1);
-		if (add_info) {
-			buffer_length += strlen(add_info);
-		}
-		char buffer[buffer_length];
-		if (add_info) {
-			strcpy(buffer, add_info);
-			strcat(buffer, http_useragent);
-		} else {
-			strcpy(buffer, http_useragent);
+bool http_get_pipelined(struct HttpRequest const *requests, struct HttpData *results, size_t count, size_t depth,
+		time_t timeout) {
+	if ((!requests || !results) && count)
+		return false;
+	int64_t deadline = socket_deadline(timeout);
+	size_t *indices = malloc((count ? count : 1) * sizeof(size_t));
+	bool *grouped = calloc(count ? count : 1, sizeof(bool));
+	if (!indices || !grouped) {
+		free(indices);
+		free(grouped);
+		return false;
+	}
+	if (socket_init() != SOCK_OK) {
+		free(indices);
+		free(grouped);
+		return false;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (grouped[i])
+			continue;
+		if (!requests[i].host || !requests[i].file || strlen(requests[i].host) >= POOL_MAX_HOSTNAME
+				|| (requests[i].command == HttpCommand_GetHttpsUserAgent && !requests[i].user_agent)) {
+			results[i] = (struct HttpData) { .error = EError_InvalidArgument };
+			continue;
 		}
-		free(http_useragent);
-
-		ret = https_get(host, file, buffer, timeout);
+		size_t group = 0;
+		for (size_t j = i; j < count; j++) {
+			if (!grouped[j] && requests[j].host && requests[j].file
+					&& (requests[j].command != HttpCommand_GetHttpsUserAgent || requests[j].user_agent)
+					&& batch_same_host(&requests[i], &requests[j])) {
+				grouped[j] = true;
+				indices[group++] = j;
+			}
+		}
+		http_pipeline_group(requests, results, indices, group, depth, deadline);
 	}
-	return ret;
+	free(indices);
+	free(grouped);
+	socket_deinit();
+	return true;
 }
 
-static _Atomic(size_t) active_threads = 0;
-static _Atomic(socket_thread_data) threadData;
+/** \brief Slot of the request queue. @p sequence tells producers and consumers whose turn it is */
+struct thread_queue_cell {
+	_Atomic(size_t) sequence;
+	socket_thread_data data;
+};
+
+/** \brief Persistent worker threads processing the requests of http_get_with_thread
+ * \details Requests are passed by value through a bounded lock-free multi-producer multi-consumer ring (D. Vyukov).
+ Producers and consumers each claim a position with one compare-and-swap. Semaphores count queued requests and free
+ slots, so idle workers and submitters waiting for a free slot sleep instead of spinning.
+ */
+struct thread_pool {
+	pthread_t *workers;
+	size_t worker_count;
+	struct thread_queue_cell *cells;
+	size_t mask; /**< @brief Number of cells - 1, the number of cells is a power of two */
+	_Alignas(64) _Atomic(size_t) enqueue_pos;
+	_Alignas(64) _Atomic(size_t) dequeue_pos;
+	_Alignas(64) _Atomic(size_t) submitters; /**< @brief Number of threads currently submitting a request */
+	_Alignas(64) _Atomic(size_t) busy; /**< @brief Number of workers currently processing a request */
+	sem_t items; /**< @brief Number of queued requests */
+	sem_t slots; /**< @brief Number of free cells */
+	_Atomic(bool) running;
+	_Atomic(bool) stopping; /**< @brief Shutdown requested, workers exit once the queue is empty */
+};
+
+static pthread_mutex_t thread_pool_lock = PTHREAD_MUTEX_INITIALIZER; // Serializes starting, stopping and configuring the pool
+static struct thread_pool thread_pool;
+static size_t thread_pool_workers = MAX_THREADS;
+static size_t thread_pool_queue_size = THREAD_POOL_DEFAULT_QUEUE;
+static _Atomic(enum HttpQueuePolicy) thread_pool_policy = HttpQueuePolicy_Block;
+static _Thread_local bool thread_pool_worker = false; /**< @brief The thread is a worker of the pool */
+static _Thread_local unsigned thread_pool_inline_depth = 0; /**< @brief Requests the worker is making itself, nested */
 
-static bool thread_data_is_empty(socket_thread_data data) {
-	return data.file == NULL
-			&& data.host == NULL;
-	// Only these two need to be checked. If these are NULL, the request would make no sense
+/** \brief Appends @p data to the request queue
+ *
+ * \param data socket_thread_data const* request
+ * \return bool false if the queue is full
+ *
+ */
+static bool thread_queue_push(socket_thread_data const *const data) {
+	size_t pos = atomic_load_explicit(&thread_pool.enqueue_pos, memory_order_relaxed);
+	struct thread_queue_cell *cell;
+	while (true) {
+		cell = &thread_pool.cells[pos & thread_pool.mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t) sequence - (intptr_t) pos;
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&thread_pool.enqueue_pos, &pos, pos + 1, memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = atomic_load_explicit(&thread_pool.enqueue_pos, memory_order_relaxed);
+		}
+	}
+	cell->data = *data;
+	atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+	return true;
 }
 
-static void* thread_wrapper(void *thread_arg) {
-	assert(thread_arg);
-	_Atomic(socket_thread_data)* ptr_arg = thread_arg;
-	socket_thread_data copy = *ptr_arg;
-	*ptr_arg = (socket_thread_data) {0};
+/** \brief Takes the oldest request from the request queue
+ *
+ * \param data socket_thread_data* receives the request
+ * \return bool false if the queue is empty or the oldest request is still being written by its producer
+ *
+ */
+static bool thread_queue_pop(socket_thread_data *data) {
+	size_t pos = atomic_load_explicit(&thread_pool.dequeue_pos, memory_order_relaxed);
+	struct thread_queue_cell *cell;
+	while (true) {
+		cell = &thread_pool.cells[pos & thread_pool.mask];
+		size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		intptr_t diff = (intptr_t) sequence - (intptr_t) (pos + 1);
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&thread_pool.dequeue_pos, &pos, pos + 1, memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos = atomic_load_explicit(&thread_pool.dequeue_pos, memory_order_relaxed);
+		}
+	}
+	*data = cell->data;
+	atomic_store_explicit(&cell->sequence, pos + thread_pool.mask + 1, memory_order_release);
+	return true;
+}
 
-	while (active_threads > MAX_THREADS)
-		; // Wait for other threads to finish
+/** \brief Waits on a semaphore, restarting after signals */
+static void thread_sem_wait(sem_t *sem) {
+	while (sem_wait(sem) && errno == EINTR)
+		;
+}
 
+/** \brief Processes one request of http_get_with_thread and calls its callback
+ *
+ * \param copy socket_thread_data request
+ * \return void
+ *
+ */
+static void thread_process(socket_thread_data copy) {
 	struct HttpData retData = { 0 };
+	int64_t dequeued = copy.queued ? clock_now_us() : 0;
+	struct HttpStreamCallbacks const *stream = copy.stream ? &copy.callbacks : 0;
 	if (copy.command == HttpCommand_GetHttp) {
-		retData = http_get(copy.host, copy.file, copy.add_info, copy.timeout);
+		retData = http_fetch(copy.host, copy.file, copy.add_info, copy.timeout, false, stream, 0);
 	} else if (copy.command == HttpCommand_GetHttps) {
-		retData = https_get(copy.host, copy.file, copy.add_info, copy.timeout);
+		retData = http_fetch(copy.host, copy.file, copy.add_info, copy.timeout, true, stream, 0);
 	} else if (copy.command == HttpCommand_GetHttpsUserAgent
 			&& copy.user_agent) {
-		retData = https_get_with_useragent(copy.host, copy.file,
-				copy.user_agent, copy.add_info, copy.timeout);
+		char *header = http_join_user_agent(copy.add_info, copy.user_agent);
+		if (header) {
+			retData = http_fetch(copy.host, copy.file, header, copy.timeout, true, stream, 0);
+			free(header);
+		}
 	} else {
 		assert(0);
 	}
+	if (copy.queued)
+		retData.timing.queued_us = dequeued - copy.queued;
 
 	pthread_t thread_id = pthread_self();
 	copy.callback_func(thread_id, retData);
-	assert(active_threads > 0);
-	active_threads--;
+}
 
+/** \brief Worker thread of the thread pool. Sleeps until a request is queued
+ *
+ * \param thread_arg void* unused
+ * \return void* NULL
+ *
+ */
+static void* thread_worker(void *thread_arg) {
+	thread_pool_worker = true;
+	while (true) {
+		thread_sem_wait(&thread_pool.items);
+		socket_thread_data data;
+		bool stop = false;
+		while (!thread_queue_pop(&data)) {
+			if (atomic_load(&thread_pool.stopping) && atomic_load(&thread_pool.enqueue_pos)
+					== atomic_load(&thread_pool.dequeue_pos)) {
+				stop = true;
+				break;
+			}
+			sched_yield(); // A producer claimed the next cell but has not filled it yet
+		}
+		if (stop)
+			break;
+		sem_post(&thread_pool.slots);
+		atomic_fetch_add_explicit(&thread_pool.busy, 1, memory_order_relaxed);
+		thread_process(data);
+		atomic_fetch_sub_explicit(&thread_pool.busy, 1, memory_order_relaxed);
+	}
 	return NULL;
 }
 
+/** \brief Starts the worker threads if they are not running yet. Must be called with thread_pool_lock held
+ *
+ * \return bool false if the pool could not be started
+ *
+ */
+static bool thread_pool_start_locked(void) {
+	if (atomic_load(&thread_pool.running))
+		return true;
+	size_t cells = 1;
+	while (cells < thread_pool_queue_size)
+		cells *= 2;
+	thread_pool.cells = malloc(cells * sizeof(struct thread_queue_cell));
+	thread_pool.workers = malloc(thread_pool_workers * sizeof(pthread_t));
+	if (!thread_pool.cells || !thread_pool.workers || sem_init(&thread_pool.items, 0, 0)) {
+		free(thread_pool.cells);
+		free(thread_pool.workers);
+		return false;
+	}
+	if (sem_init(&thread_pool.slots, 0, thread_pool_queue_size)) {
+		sem_destroy(&thread_pool.items);
+		free(thread_pool.cells);
+		free(thread_pool.workers);
+		return false;
+	}
+	for (size_t i = 0; i < cells; i++)
+		atomic_init(&thread_pool.cells[i].sequence, i);
+	thread_pool.mask = cells - 1;
+	atomic_store(&thread_pool.enqueue_pos, 0);
+	atomic_store(&thread_pool.dequeue_pos, 0);
+	atomic_store(&thread_pool.stopping, false);
+	for (thread_pool.worker_count = 0; thread_pool.worker_count < thread_pool_workers; thread_pool.worker_count++) {
+		if (pthread_create(&thread_pool.workers[thread_pool.worker_count], 0, thread_worker, 0) != 0)
+			break;
+	}
+	if (!thread_pool.worker_count) {
+		sem_destroy(&thread_pool.items);
+		sem_destroy(&thread_pool.slots);
+		free(thread_pool.cells);
+		free(thread_pool.workers);
+		return false;
+	}
+	atomic_store(&thread_pool.running, true);
+	return true;
+}
+
+/** \brief Queues @p data for the thread pool
+ * \details If the queue is full, the caller waits for a free slot or the request is rejected, depending on the queue policy.
+ A worker submitting from a callback never waits: if all workers did, none would be left to free a slot. With the
+ blocking policy it processes the request itself instead, unless THREAD_POOL_MAX_INLINE of these requests are already
+ nested on its stack; then the request is rejected. Submitting does not take a lock once the pool is running.
+ *
+ * \param data socket_thread_data request to be processed
+ * \return pthread_t 0 if the request has been queued, -1 otherwise
+ *
+ */
+static pthread_t thread_start(socket_thread_data data) {
+	pthread_t retID = -1;
+	if (!data.host || !data.file || !data.callback_func || socket_istimedout(socket_deadline(data.timeout)))
+		return retID;
+	data.queued = http_timing ? clock_now_us() : 0;
+
+	if (!atomic_load(&thread_pool.running)) {
+		pthread_mutex_lock(&thread_pool_lock);
+		thread_pool_start_locked();
+		pthread_mutex_unlock(&thread_pool_lock);
+	}
+	bool inline_process = false;
+	atomic_fetch_add(&thread_pool.submitters, 1);
+	if (atomic_load(&thread_pool.running) && !atomic_load(&thread_pool.stopping)) {
+		bool block = atomic_load(&thread_pool_policy) == HttpQueuePolicy_Block;
+		bool slot;
+		if (block && !thread_pool_worker) {
+			thread_sem_wait(&thread_pool.slots);
+			slot = true;
+		} else {
+			slot = !sem_trywait(&thread_pool.slots);
+			inline_process = !slot && block && thread_pool_inline_depth < THREAD_POOL_MAX_INLINE;
+		}
+		if (slot && atomic_load(&thread_pool.stopping)) {
+			sem_post(&thread_pool.slots);
+		} else if (slot) {
+			bool pushed = thread_queue_push(&data);
+			assert(pushed); // A free slot has been reserved
+			(void) pushed;
+			sem_post(&thread_pool.items);
+			retID = 0;
+		}
+	}
+	atomic_fetch_sub(&thread_pool.submitters, 1);
+	if (inline_process) {
+		thread_pool_inline_depth++;
+		thread_process(data);
+		thread_pool_inline_depth--;
+		retID = 0;
+	}
+	return retID;
+}
+
+bool http_thread_pool_configure(size_t workers, size_t queue_size, enum HttpQueuePolicy policy) {
+	if (!workers || !queue_size)
+		return false;
+	pthread_mutex_lock(&thread_pool_lock);
+	bool ret = !atomic_load(&thread_pool.running);
+	if (ret) {
+		thread_pool_workers = workers;
+		thread_pool_queue_size = queue_size;
+	}
+	atomic_store(&thread_pool_policy, policy);
+	pthread_mutex_unlock(&thread_pool_lock);
+	return ret;
+}
+
+void http_thread_pool_shutdown(void) {
+	pthread_mutex_lock(&thread_pool_lock);
+	if (!atomic_load(&thread_pool.running)) {
+		pthread_mutex_unlock(&thread_pool_lock);
+		return;
+	}
+	atomic_store(&thread_pool.stopping, true);
+	// Let submitters which passed the check finish. Blocked ones get a slot as the workers drain the queue
+	while (atomic_load(&thread_pool.submitters))
+		sched_yield();
+	// The workers process the remaining requests, then each one consumes one of these wakeups and exits
+	for (size_t i = 0; i < thread_pool.worker_count; i++)
+		sem_post(&thread_pool.items);
+	for (size_t i = 0; i < thread_pool.worker_count; i++)
+		pthread_join(thread_pool.workers[i], 0);
+
+	atomic_store(&thread_pool.running, false);
+	sem_destroy(&thread_pool.items);
+	sem_destroy(&thread_pool.slots);
+	free(thread_pool.cells);
+	free(thread_pool.workers);
+	thread_pool.cells = 0;
+	thread_pool.workers = 0;
+	thread_pool.worker_count = 0;
+	pthread_mutex_unlock(&thread_pool_lock);
+}
+
 pthread_t http_get_with_thread(enum HttpCommand command, char const *const host,
 		char const *const file, char const *const user_agent,
 		char const *const add_info, time_t timeout, HttpCallback *callback_func) {
-	threadData = (socket_thread_data ) { 0 };
-	pthread_t retID = -1;
-	if (host && file && callback_func && !socket_istimedout(timeout)) {
-		while(!thread_data_is_empty(threadData))
-			;	// Wait for other threads to take the data and reset this struct
-		threadData = (socket_thread_data ) { .command = command, .host = host,
-						.file = file, .user_agent = user_agent, .add_info =
-								add_info, .timeout = timeout,
-								.callback_func = callback_func, };
-		pthread_attr_t attr;
-		int s = pthread_attr_init(&attr);
-		if (s != 0)
-			return retID;
-		s = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-		if (s != 0)
-			return retID;
-
-		if (pthread_create(&retID, &attr, thread_wrapper, &threadData) != 0)
-			return 0;
+	return thread_start((socket_thread_data ) { .command = command, .host = host,
+					.file = file, .user_agent = user_agent, .add_info =
+							add_info, .timeout = timeout,
+							.callback_func = callback_func, });
+}
+
+pthread_t http_get_stream_with_thread(enum HttpCommand command, char const *const host,
+		char const *const file, char const *const user_agent,
+		char const *const add_info, time_t timeout, struct HttpStreamCallbacks callbacks,
+		HttpCallback *callback_func) {
+	return thread_start((socket_thread_data ) { .command = command, .host = host,
+					.file = file, .user_agent = user_agent, .add_info =
+							add_info, .timeout = timeout,
+							.callback_func = callback_func, .stream = true, .callbacks = callbacks, });
+}
 
-		active_threads++;
+/** \brief Sum of the counters of all metrics shards */
+struct metrics_snapshot {
+	uint64_t requests[METRICS_STATUS_CODES];
+	uint64_t errors[METRICS_ERRORS];
+	uint64_t bytes_received;
+	uint64_t bytes_sent;
+	uint64_t connections_opened;
+	uint64_t connections_closed;
+	uint64_t latency[METRICS_LATENCY_BUCKETS];
+	uint64_t latency_count;
+	uint64_t latency_sum;
+};
+
+/** \brief Adds up the counters of all shards. Concurrent requests may or may not be included */
+static void metrics_collect(struct metrics_snapshot *snapshot) {
+	memset(snapshot, 0, sizeof(struct metrics_snapshot));
+	for (size_t s = 0; s < METRICS_SHARDS; s++) {
+		struct metrics_shard *shard = &metrics_shards[s];
+		for (size_t i = 0; i < METRICS_STATUS_CODES; i++)
+			snapshot->requests[i] += atomic_load_explicit(&shard->requests[i], memory_order_relaxed);
+		for (size_t i = 0; i < METRICS_ERRORS; i++)
+			snapshot->errors[i] += atomic_load_explicit(&shard->errors[i], memory_order_relaxed);
+		for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+			snapshot->latency[i] += atomic_load_explicit(&shard->latency[i], memory_order_relaxed);
+		snapshot->bytes_received += atomic_load_explicit(&shard->bytes_received, memory_order_relaxed);
+		snapshot->bytes_sent += atomic_load_explicit(&shard->bytes_sent, memory_order_relaxed);
+		snapshot->connections_opened += atomic_load_explicit(&shard->connections_opened, memory_order_relaxed);
+		snapshot->connections_closed += atomic_load_explicit(&shard->connections_closed, memory_order_relaxed);
+		snapshot->latency_sum += atomic_load_explicit(&shard->latency_sum, memory_order_relaxed);
 	}
-	return retID;
+	for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+		snapshot->latency_count += snapshot->latency[i];
+}
+
+/** \brief Returns a quantile of a latency histogram
+ *
+ * \param snapshot struct metrics_snapshot const* collected counters
+ * \param quantile double between 0 and 1
+ * \return int64_t highest duration in microseconds of the bucket containing the quantile, 0 if no request was recorded
+ *
+ */
+static int64_t metrics_quantile(struct metrics_snapshot const *snapshot, double quantile) {
+	if (!snapshot->latency_count)
+		return 0;
+	double rank = quantile * snapshot->latency_count;
+	uint64_t target = rank < 1 ? 1 : rank > snapshot->latency_count ? snapshot->latency_count : (uint64_t) rank;
+	if (target < rank && target < snapshot->latency_count)
+		target++;
+	uint64_t seen = 0;
+	for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++) {
+		seen += snapshot->latency[i];
+		if (seen >= target)
+			return metrics_latency_bucket_end(i) - 1;
+	}
+	return metrics_latency_bucket_end(METRICS_LATENCY_BUCKETS - 1) - 1;
+}
+
+/** \brief Text rendered by the metrics exporter */
+struct metrics_text {
+	char *data;
+	size_t length;
+	size_t capacity;
+	bool failed; /**< @brief An allocation failed, the text is incomplete */
+};
+
+/** \brief Appends formatted text, growing the buffer as needed */
+static void metrics_printf(struct metrics_text *text, char const *format, ...) {
+	while (!text->failed) {
+		va_list args;
+		va_start(args, format);
+		int n = vsnprintf(text->data + text->length, text->capacity - text->length, format, args);
+		va_end(args);
+		if (n >= 0 && (size_t) n < text->capacity - text->length) {
+			text->length += n;
+			return;
+		}
+		size_t capacity = 2 * text->capacity + (n > 0 ? n : 0);
+		char *data = n >= 0 ? realloc(text->data, capacity) : 0;
+		if (!data) {
+			text->failed = true;
+			return;
+		}
+		text->data = data;
+		text->capacity = capacity;
+	}
+}
+
+/** \brief Appends the HELP and TYPE lines of a metric */
+static void metrics_family(struct metrics_text *text, char const *name, char const *type, char const *help) {
+	metrics_printf(text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/** \brief Appends a metric with a single value */
+static void metrics_value(struct metrics_text *text, char const *name, char const *type, char const *help,
+		double value) {
+	metrics_family(text, name, type, help);
+	metrics_printf(text, "%s %.15g\n", name, value);
+}
+
+static char const *const metrics_error_names[METRICS_ERRORS] = { "NoError", "AddrInfoError", "CreateSocketError",
+		"ConnectionError", "HostUnknown", "IncompleteResponse", "TlsError", "CertificateError", "Timeout",
+		"InvalidResponse", "OutOfMemory", "Aborted", "InvalidArgument", };
+
+void http_set_metrics(bool enabled) {
+	http_metrics = enabled;
+}
+
+void http_metrics_reset(void) {
+	for (size_t s = 0; s < METRICS_SHARDS; s++) {
+		struct metrics_shard *shard = &metrics_shards[s];
+		for (size_t i = 0; i < METRICS_STATUS_CODES; i++)
+			atomic_store_explicit(&shard->requests[i], 0, memory_order_relaxed);
+		for (size_t i = 0; i < METRICS_ERRORS; i++)
+			atomic_store_explicit(&shard->errors[i], 0, memory_order_relaxed);
+		for (size_t i = 0; i < METRICS_LATENCY_BUCKETS; i++)
+			atomic_store_explicit(&shard->latency[i], 0, memory_order_relaxed);
+		atomic_store_explicit(&shard->bytes_received, 0, memory_order_relaxed);
+		atomic_store_explicit(&shard->bytes_sent, 0, memory_order_relaxed);
+		atomic_store_explicit(&shard->latency_sum, 0, memory_order_relaxed);
+	}
+}
+
+int64_t http_metrics_latency_quantile(double quantile) {
+	struct metrics_snapshot snapshot;
+	metrics_collect(&snapshot);
+	return metrics_quantile(&snapshot, quantile);
+}
+
+char* http_metrics_render(void) {
+	struct metrics_snapshot snapshot;
+	metrics_collect(&snapshot);
+	struct HttpPoolStats pool = http_pool_get_stats();
+	struct HttpCacheStats cache = http_cache_get_stats();
+	pthread_mutex_lock(&thread_pool_lock);
+	size_t workers = thread_pool.worker_count;
+	size_t dequeued = atomic_load(&thread_pool.dequeue_pos);
+	size_t queued = atomic_load(&thread_pool.running) ? atomic_load(&thread_pool.enqueue_pos) - dequeued : 0;
+	pthread_mutex_unlock(&thread_pool_lock);
+	size_t resolver_threads = 0;
+#ifndef _WIN32
+	pthread_mutex_lock(&dns_resolver_lock);
+	resolver_threads = dns_resolver_threads;
+	pthread_mutex_unlock(&dns_resolver_lock);
+#endif
+
+	struct metrics_text text = { .data = malloc(16384), .capacity = 16384 };
+	if (!text.data)
+		return 0;
+	metrics_family(&text, "simplehttpget_requests_total", "counter",
+			"Completed requests by status code, 0 if no response was received.");
+	for (size_t i = 0; i < METRICS_STATUS_CODES; i++) {
+		if (snapshot.requests[i])
+			metrics_printf(&text, "simplehttpget_requests_total{code=\"%zu\"} %llu\n", i,
+					(unsigned long long) snapshot.requests[i]);
+	}
+	metrics_family(&text, "simplehttpget_request_errors_total", "counter", "Failed requests by error.");
+	for (size_t i = 1; i < METRICS_ERRORS; i++)
+		metrics_printf(&text, "simplehttpget_request_errors_total{error=\"%s\"} %llu\n", metrics_error_names[i],
+				(unsigned long long) snapshot.errors[i]);
+
+	metrics_family(&text, "simplehttpget_request_duration_seconds", "histogram", "Duration of completed requests.");
+	uint64_t cumulative = 0;
+	size_t bucket = 0;
+	for (unsigned power = 4; power <= 37; power++) {
+		uint64_t bound = (uint64_t) 1 << power;
+		for (; metrics_latency_bucket_end(bucket) <= bound; bucket++)
+			cumulative += snapshot.latency[bucket];
+		metrics_printf(&text, "simplehttpget_request_duration_seconds_bucket{le=\"%.6f\"} %llu\n", bound / 1e6,
+				(unsigned long long) cumulative);
+	}
+	metrics_printf(&text, "simplehttpget_request_duration_seconds_bucket{le=\"+Inf\"} %llu\n"
+			"simplehttpget_request_duration_seconds_sum %.6f\nsimplehttpget_request_duration_seconds_count %llu\n",
+			(unsigned long long) snapshot.latency_count, snapshot.latency_sum / 1e6,
+			(unsigned long long) snapshot.latency_count);
+	metrics_family(&text, "simplehttpget_request_duration_quantiles_seconds", "summary",
+			"Quantiles of the duration of completed requests, at most 12.5 % above the exact value.");
+	static double const quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+	for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+		metrics_printf(&text, "simplehttpget_request_duration_quantiles_seconds{quantile=\"%g\"} %.6f\n", quantiles[i],
+				metrics_quantile(&snapshot, quantiles[i]) / 1e6);
+	metrics_printf(&text, "simplehttpget_request_duration_quantiles_seconds_sum %.6f\n"
+			"simplehttpget_request_duration_quantiles_seconds_count %llu\n", snapshot.latency_sum / 1e6,
+			(unsigned long long) snapshot.latency_count);
+
+	metrics_value(&text, "simplehttpget_received_bytes_total", "counter",
+			"Bytes of responses received, without TLS framing.", snapshot.bytes_received);
+	metrics_value(&text, "simplehttpget_sent_bytes_total", "counter", "Bytes of requests sent, without TLS framing.",
+			snapshot.bytes_sent);
+	metrics_value(&text, "simplehttpget_connections_opened_total", "counter", "Connections opened.",
+			snapshot.connections_opened);
+	metrics_value(&text, "simplehttpget_connections_active", "gauge",
+			"Connections currently open, including idle ones.",
+			snapshot.connections_opened - snapshot.connections_closed);
+
+	metrics_value(&text, "simplehttpget_pool_hits_total", "counter", "Requests served over an idle pooled connection.",
+			pool.hits);
+	metrics_value(&text, "simplehttpget_pool_misses_total", "counter", "Requests which opened a new connection.",
+			pool.misses);
+	metrics_value(&text, "simplehttpget_pool_evictions_total", "counter", "Idle connections closed by the pool.",
+			pool.evictions);
+	metrics_value(&text, "simplehttpget_pool_idle_connections", "gauge", "Connections kept idle in the pool.",
+			pool.idle_connections);
+	metrics_value(&text, "simplehttpget_pool_hit_ratio", "gauge", "Share of requests served over a pooled connection.",
+			pool.hits + pool.misses ? (double) pool.hits / (pool.hits + pool.misses) : 0);
+
+	metrics_value(&text, "simplehttpget_cache_hits_total", "counter", "Requests answered from the response cache.",
+			cache.hits);
+	metrics_value(&text, "simplehttpget_cache_disk_hits_total", "counter", "Cache hits answered from the disk cache.",
+			cache.disk_hits);
+	metrics_value(&text, "simplehttpget_cache_revalidations_total", "counter",
+			"Stale cached responses confirmed by 304 Not Modified.", cache.revalidations);
+	metrics_value(&text, "simplehttpget_cache_misses_total", "counter",
+			"Cacheable requests which received a full response.", cache.misses);
+	metrics_value(&text, "simplehttpget_cache_stores_total", "counter", "Responses added to the cache.", cache.stores);
+	metrics_value(&text, "simplehttpget_cache_evictions_total", "counter",
+			"Responses removed to stay within the size limit.", cache.evictions);
+	metrics_value(&text, "simplehttpget_cache_saved_bytes_total", "counter",
+			"Body bytes not transferred thanks to the cache.", cache.bytes_saved);
+	metrics_value(&text, "simplehttpget_cache_entries", "gauge", "Responses in the memory cache.", cache.entries);
+	metrics_value(&text, "simplehttpget_cache_size_bytes", "gauge", "Bytes used by the memory cache.", cache.size);
+	metrics_value(&text, "simplehttpget_cache_disk_entries", "gauge",
+			"Responses in the disk cache.", cache.disk_entries);
+	metrics_value(&text, "simplehttpget_cache_disk_size_bytes", "gauge",
+			"Bytes used by the disk cache.", cache.disk_size);
+	metrics_value(&text, "simplehttpget_cache_hit_ratio", "gauge",
+			"Share of cacheable requests answered without a request.", cache.hits + cache.revalidations + cache.misses ?
+					(double) cache.hits / (cache.hits + cache.revalidations + cache.misses) : 0);
+
+	metrics_value(&text, "simplehttpget_thread_pool_workers", "gauge",
+			"Worker threads of http_get_with_thread.", workers);
+	metrics_value(&text, "simplehttpget_thread_pool_busy_workers", "gauge", "Worker threads processing a request.",
+			atomic_load(&thread_pool.busy));
+	metrics_value(&text, "simplehttpget_thread_pool_queue_depth", "gauge",
+			"Requests waiting for a worker thread.", queued);
+	metrics_value(&text, "simplehttpget_dns_resolver_threads", "gauge",
+			"Threads resolving host names in the background.", resolver_threads);
+	if (text.failed) {
+		free(text.data);
+		return 0;
+	}
+	return text.data;
 }
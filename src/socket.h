@@ -17,7 +17,14 @@
  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifndef SIMPLEHTTPGET_SOCKET_H
+#define SIMPLEHTTPGET_SOCKET_H
+
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
 enum EError {
 	EError_NoError,
@@ -26,18 +33,55 @@ enum EError {
 	EError_ConnectionError,
 	EError_HostUnknown,
 	EError_IncompleteResponse,
+	EError_TlsError,
+	EError_CertificateError,
+	EError_Timeout,
+	EError_InvalidResponse,
+	EError_OutOfMemory,
+	EError_Aborted,
+	EError_InvalidArgument,
+};
+
+/** \brief Timing of a request, filled if enabled with http_set_timing. Durations are in microseconds */
+struct HttpTiming {
+	bool measured; /**< @brief true if the request has been timed, false if timing is disabled or the response came from the response cache */
+	bool connection_reused; /**< @brief An idle keep-alive connection has been used, there was no dns, connect and tls phase */
+	bool tls_session_reused; /**< @brief The TLS handshake resumed a cached session */
+	bool dns_cached; /**< @brief The addresses of the host were taken from the dns cache */
+	int64_t queued_us; /**< @brief Time spent in the request queue of the thread pool, only set by http_get_with_thread */
+	int64_t dns_us; /**< @brief Resolving the host name */
+	int64_t connect_us; /**< @brief Establishing the TCP connection */
+	int64_t tls_us; /**< @brief TLS handshake */
+	int64_t ttfb_us; /**< @brief Time to first byte, from sending the request until the first byte of the response arrived */
+	int64_t transfer_us; /**< @brief From the first byte until the response was complete */
+	int64_t total_us; /**< @brief The whole request including a retry on a new connection */
+	size_t bytes_sent; /**< @brief Bytes written to the socket, including TLS records of the handshake */
+	size_t bytes_received; /**< @brief Bytes read from the socket, including TLS records of the handshake */
 };
 
 /** \brief Data is handled between this library and the caller through this struct */
-struct HttpDataFailible {
+struct HttpData {
 	enum EError error; /**< @brief Error Code */
 	int http_code; /**< @brief HTTP Response code of the requested server */
 	size_t received_bytes; /**< @brief The total number of received bytes, including HTTP header */
-	size_t received_data_length; /**< @brief The total number of received data bytes, excluding HTTP header */
+	size_t received_data_length; /**< @brief The total number of received data bytes, excluding HTTP header. After decompression if the body was compressed */
+	size_t compressed_length; /**< @brief Number of compressed body bytes if the body was decompressed, otherwise 0 */
 	size_t content_length; /**< @brief The content length of the HTTP response, according to the HTTP header sent by the server */
-	char *data;
+	char *data; /**< @brief Body of a 200 response, location of a 301 response, otherwise the whole response. Points into @p response, read-only if @p mapped_length is non-zero */
+	char *response; /**< @brief The whole response starting with the HTTP header, owns the memory of @p data. Release it with http_data_free */
+	size_t header_length; /**< @brief Length of the HTTP header at the start of @p response */
+	size_t mapped_length; /**< @brief Non-zero if @p response is a read-only mapping of a disk cache file. Writing to @p response or @p data then crashes */
+	struct HttpTiming timing; /**< @brief Timing of the request, see http_set_timing */
 };
 
+/** \brief Releases the memory of a response returned by this library
+ *
+ * \param data struct HttpData* response, its pointers are reset
+ * \return void
+ *
+ */
+void http_data_free(struct HttpData *data);
+
 /** \brief This enum is used to tell the library, what method should be used to fetch data in an threaded call */
 enum HttpCommand {
 	HttpCommand_GetHttp, /**< @brief Request data using regular HTTP */
@@ -47,7 +91,60 @@ enum HttpCommand {
 
 typedef void HttpCallback(pthread_t threadID, struct HttpData); /**< @brief A Callback Function for this library shall have this form */
 
-/** \brief A very simple http request is being made and the result returned. The returned string needs to be freed by the user
+/** \brief Called once with the http header of a streamed response. Returning false aborts the transfer with EError_Aborted */
+typedef bool HttpHeadersCallback(int http_code, char const *header, size_t header_length, void *user_data);
+/** \brief Called for every received block of the body of a streamed response. Chunked bodies are already decoded.
+ The data is only valid during the call. Returning false aborts the transfer with EError_Aborted */
+typedef bool HttpDataCallback(char const *data, size_t length, void *user_data);
+
+/** \brief Callbacks receiving a streamed response */
+struct HttpStreamCallbacks {
+	HttpHeadersCallback *on_headers; /**< @brief May be 0 */
+	HttpDataCallback *on_data; /**< @brief May be 0 */
+	void *user_data; /**< @brief Passed to both callbacks */
+};
+
+/** \brief Behaviour of http_get_with_thread when the request queue of the thread pool is full */
+enum HttpQueuePolicy {
+	HttpQueuePolicy_Block, /**< @brief Wait until a worker takes a queued request. Workers submitting from a callback make the request themselves, up to 8 nested */
+	HttpQueuePolicy_Reject, /**< @brief Reject the request immediately */
+};
+
+/** \brief Statistics of the keep-alive connection pool */
+struct HttpPoolStats {
+	size_t hits; /**< @brief Number of requests served over an idle pooled connection */
+	size_t misses; /**< @brief Number of requests which had to open a new connection */
+	size_t evictions; /**< @brief Number of idle connections closed because they expired or the pool was full */
+	size_t idle_connections; /**< @brief Number of connections currently kept idle in the pool */
+};
+
+/** \brief Statistics of the response cache */
+struct HttpCacheStats {
+	size_t hits; /**< @brief Number of requests answered from the cache without a request */
+	size_t disk_hits; /**< @brief Number of the hits answered from the disk cache */
+	size_t revalidations; /**< @brief Number of stale responses confirmed by a 304 Not Modified */
+	size_t misses; /**< @brief Number of requests which received a full response */
+	size_t stores; /**< @brief Number of responses added to the cache */
+	size_t evictions; /**< @brief Number of responses removed to stay within the size limit */
+	size_t bytes_saved; /**< @brief Number of body bytes not transferred thanks to the cache */
+	size_t entries; /**< @brief Number of responses currently cached */
+	size_t size; /**< @brief Number of bytes currently used by the cache */
+	size_t disk_entries; /**< @brief Number of responses currently stored in the disk cache */
+	size_t disk_size; /**< @brief Number of bytes currently used by the disk cache */
+};
+
+/** \brief Limits of the phases of a request in milliseconds, 0 for no limit
+ * \details The limits are measured on a monotonic clock and apply in addition to the timeout moment of a request.
+ A phase skipped by a pooled connection or a cached host name does not count. */
+struct HttpTimeouts {
+	unsigned dns_ms; /**< @brief Resolving the host name */
+	unsigned connect_ms; /**< @brief Establishing the TCP connection, all addresses together */
+	unsigned tls_ms; /**< @brief TLS handshake */
+	unsigned transfer_ms; /**< @brief Sending the request and receiving the whole response */
+	unsigned total_ms; /**< @brief The whole request, from the call until the response is complete */
+};
+
+/** \brief A very simple http request is being made and the result returned. The returned data needs to be released with http_data_free
  * \details This function initializes the socket interface, connects to @p host, requests @p file and adds @p add_info into the request header.
  The returned message is being checked for validity. If valid, the http header is removed and the http body returned.
  *
@@ -58,7 +155,7 @@ typedef void HttpCallback(pthread_t threadID, struct HttpData); /**< @brief A Ca
  * \return char*
  *
  */
-struct HttpDataFallible http_get(char const *const host, char const *const file,
+struct HttpData http_get(char const *const host, char const *const file,
 		char const *const add_info, time_t timeout);
 
 /** \brief Checks the internet availability
@@ -68,7 +165,7 @@ struct HttpDataFallible http_get(char const *const host, char const *const file,
  */
 bool socket_check_connection();
 
-/** \brief A very simple http request is being made and the result returned. The returned string needs to be freed by the user
+/** \brief A very simple http request is being made and the result returned. The returned data needs to be released with http_data_free
  * \details This function initializes the socket interface, connects to @p host, requests @p file and adds @p add_info into the request header.
  The returned message is being checked for validity. If valid, the http header is removed and the http body returned.
  *
@@ -79,10 +176,10 @@ bool socket_check_connection();
  * \return struct HttpData
  *
  */
-struct HttpDataFallible https_get(char const *const host, char const *const file,
+struct HttpData https_get(char const *const host, char const *const file,
 		char const *const add_info, time_t timeout);
 
-/** \brief A very simple http request is being made and the result returned. The returned string needs to be freed by the user. This function additionally transmits the user agent.
+/** \brief A very simple http request is being made and the result returned. The returned data needs to be released with http_data_free. This function additionally transmits the user agent.
  * \details This function initializes the socket interface, connects to @p host, requests @p file and adds @p add_info into the request header.
  The returned message is being checked for validity. If valid, the http header is removed and the http body returned.
  *
@@ -94,11 +191,135 @@ struct HttpDataFallible https_get(char const *const host, char const *const file
  * \return struct HttpData
  *
  */
-struct HttpDataFallible https_get_with_useragent(char const *const host,
+struct HttpData https_get_with_useragent(char const *const host,
 		char const *const file, char const *const user_agent,
 		char const *const add_info, time_t timeout);
 
+/** \brief Like http_get, but the response is passed to @p callbacks while it is received instead of being returned
+ * \details The response is received into a fixed size buffer, so memory use does not depend on the size of the response.
+ @p callbacks.on_headers is called once, then @p callbacks.on_data for every received block of the body.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param callbacks struct HttpStreamCallbacks callbacks receiving the response
+ * \return struct HttpData result of the request, data is always 0
+ *
+ */
+struct HttpData http_get_stream(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, struct HttpStreamCallbacks callbacks);
+
+/** \brief Like https_get, but the response is passed to @p callbacks while it is received instead of being returned
+ * \details See http_get_stream.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param callbacks struct HttpStreamCallbacks callbacks receiving the response
+ * \return struct HttpData result of the request, data is always 0
+ *
+ */
+struct HttpData https_get_stream(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, struct HttpStreamCallbacks callbacks);
+
+/** \brief Like http_get, but the body of a 200 response is written to @p fd instead of being returned
+ * \details On Linux the body is moved from the socket to @p fd with splice, so it is not copied through user space.
+ Otherwise, or if @p fd does not support splice, it is written from a fixed size buffer. The bodies of other responses
+ are discarded. A failed write aborts the transfer with EError_Aborted.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param fd int blocking file descriptor receiving the body
+ * \return struct HttpData result of the request, data is always 0
+ *
+ */
+struct HttpData http_get_to_fd(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, int fd);
+
+/** \brief Like https_get, but the body of a 200 response is written to @p fd instead of being returned
+ * \details The body is decrypted into a fixed size buffer and written from there. The bodies of other responses
+ are discarded. A failed write aborts the transfer with EError_Aborted.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param fd int blocking file descriptor receiving the body
+ * \return struct HttpData result of the request, data is always 0
+ *
+ */
+struct HttpData https_get_to_fd(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, int fd);
+
+/** \brief Like http_get, but the body is downloaded in byte ranges over up to @p segments parallel connections
+ * \details The size of the body is requested with HEAD first. Each range is received with its own Range request
+ and copied directly to its place in the result. If the server does not accept byte ranges or the body is smaller
+ than 64 KiB per segment, a single request is made instead.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param segments size_t maximum number of parallel connections, 0 for the default of 4
+ * \return struct HttpData result of the request, like http_get
+ *
+ */
+struct HttpData http_get_segmented(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, size_t segments);
+
+/** \brief Like https_get, but the body is downloaded in byte ranges over up to @p segments parallel connections, see http_get_segmented
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param segments size_t maximum number of parallel connections, 0 for the default of 4
+ * \return struct HttpData result of the request, like https_get
+ *
+ */
+struct HttpData https_get_segmented(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, size_t segments);
+
+/** \brief Like http_get_segmented, but the body is written to @p fd at its current position
+ * \details The file is extended to the size of the body and every range is written at its place. Afterwards the
+ file position is behind the body. If @p fd is not seekable, the body is received like http_get_to_fd.
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param segments size_t maximum number of parallel connections, 0 for the default of 4
+ * \param fd int file descriptor receiving the body
+ * \return struct HttpData result of the request, data is always 0
+ *
+ */
+struct HttpData http_get_segmented_to_fd(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, size_t segments, int fd);
+
+/** \brief Like http_get_segmented_to_fd over HTTPS
+ *
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param segments size_t maximum number of parallel connections, 0 for the default of 4
+ * \param fd int file descriptor receiving the body
+ * \return struct HttpData result of the request, data is always 0
+ *
+ */
+struct HttpData https_get_segmented_to_fd(char const *const host, char const *const file,
+		char const *const add_info, time_t timeout, size_t segments, int fd);
+
 /** \brief Based on the value of @p command, an HTTP or HTTPS request is made in a parallel thread. When finished, @p callback_func is called.
+ * \details The request is queued for a pool of persistent worker threads, see http_thread_pool_configure. The strings
+ passed must stay valid until @p callback_func has been called. Called from a callback while the queue is full, the
+ request is made before returning with HttpQueuePolicy_Block instead of waiting for a slot no worker could free. Such
+ requests nest when their callbacks submit again; beyond a depth of 8 the request is rejected like with
+ HttpQueuePolicy_Reject.
  *
  * \param command enum HttpCommand Determines whether an HTTP, HTTPS or HTTPS with user agent request is made
  * \param host char const*const host to be connected
@@ -107,10 +328,435 @@ struct HttpDataFallible https_get_with_useragent(char const *const host,
  * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
  * \param callback_func HttpCallback Callback function to be called when the data is fully fetched or the connection timed out
  * \param timeout time_t the desired timeout moment, or 0 for no timeout
- * \return int thread ID
+ * \return pthread_t 0 if the request has been queued, -1 if it was rejected
  *
  */
 pthread_t http_get_with_thread(enum HttpCommand command, char const *const host,
 		char const *const file, char const *const user_agent,
 		char const *const add_info, time_t timeout,
 		HttpCallback *callback_func);
+
+/** \brief Like http_get_with_thread, but the response is passed to @p callbacks while it is received
+ * \details The callbacks are called from the parallel thread, see http_get_stream. @p callback_func is called at the end
+ with the result of the request, its data is always 0.
+ *
+ * \param command enum HttpCommand Determines whether an HTTP, HTTPS or HTTPS with user agent request is made
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param user_agent char const*const string containing application name, the string is internally processed to be http conforming
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param callbacks struct HttpStreamCallbacks callbacks receiving the response
+ * \param callback_func HttpCallback Callback function to be called when the transfer has finished
+ * \return pthread_t 0 if the request has been queued, -1 if it was rejected
+ *
+ */
+pthread_t http_get_stream_with_thread(enum HttpCommand command, char const *const host,
+		char const *const file, char const *const user_agent,
+		char const *const add_info, time_t timeout, struct HttpStreamCallbacks callbacks,
+		HttpCallback *callback_func);
+
+/** \brief Configures the worker threads processing the requests of http_get_with_thread
+ * \details The workers are started by the first threaded request. @p workers and @p queue_size can only be changed
+ while the workers are not running, call http_thread_pool_shutdown first to resize a running pool.
+ *
+ * \param workers size_t number of worker threads, default is 5
+ * \param queue_size size_t maximum number of queued requests, default is 64
+ * \param policy enum HttpQueuePolicy behaviour when the queue is full, default is HttpQueuePolicy_Block
+ * \return bool false if the sizes are 0 or could not be changed because the workers are running
+ *
+ */
+bool http_thread_pool_configure(size_t workers, size_t queue_size, enum HttpQueuePolicy policy);
+
+/** \brief Stops the worker threads
+ * \details Requests still queued are processed before the workers exit. Requests submitted during the shutdown are rejected.
+ The pool is started again by the next threaded request.
+ *
+ * \return void
+ *
+ */
+void http_thread_pool_shutdown(void);
+
+/** \brief Sets how long an idle connection is kept in the keep-alive pool
+ * \details Connections to the same host, port and scheme are reused by http_get, https_get and the threaded API.
+ A connection which has been idle for longer than @p seconds is closed. Setting 0 disables connection reuse.
+ *
+ * \param seconds time_t maximum idle time in seconds, default is 30
+ * \return void
+ *
+ */
+void http_pool_set_idle_timeout(time_t seconds);
+
+/** \brief Enables transparent decompression of response bodies
+ * \details When enabled, requests carry "Accept-Encoding: gzip, deflate" and gzip or deflate encoded bodies are decompressed while they are received.
+ Buffered results contain the header followed by the decompressed body, streamed results pass decompressed blocks to on_data.
+ The Content-Length of a compressed response describes the compressed body.
+ *
+ * \param enable bool true to request compressed responses, default is false
+ * \return void
+ *
+ */
+void http_set_compression(bool enable);
+
+/** \brief Sets the maximum number of idle connections kept in the keep-alive pool
+ *
+ * \param max_idle size_t maximum number of idle connections, default is 32
+ * \return void
+ *
+ */
+void http_pool_set_max_idle(size_t max_idle);
+
+/** \brief Returns the statistics of the keep-alive pool
+ *
+ * \return struct HttpPoolStats
+ *
+ */
+struct HttpPoolStats http_pool_get_stats(void);
+
+/** \brief Enables the in-memory response cache used by http_get and https_get, and sets its size limit
+ * \details 200 responses are stored according to Cache-Control and Expires, keyed by scheme, host, file and
+ additional header info. A fresh response is returned without contacting the server. A stale response is revalidated
+ with If-None-Match or If-Modified-Since, and a 304 answer returns the cached response. The least recently used
+ responses are evicted to stay within @p max_size. The cache is thread-safe and disabled by default.
+ *
+ * \param max_size size_t maximum number of bytes used by cached responses, 0 disables the cache
+ * \return void
+ *
+ */
+void http_cache_configure(size_t max_size);
+
+/** \brief Enables the persistent disk cache used by http_get and https_get after the in-memory cache
+ * \details Every response is stored in its own file in @p directory, next to an index file with the keys, validators
+ and freshness of the responses. The index is read again by the next process using the same directory. A disk cache
+ hit returns a read-only memory mapping of the file instead of a copy, so the returned data must not be modified,
+ see HttpData.mapped_length. The least recently used responses are removed to stay within @p max_size.
+ The index is rewritten after every 64 changes, by http_disk_cache_flush and when the cache is reconfigured. Changes
+ after the last write are lost when the process ends, their files are removed by the next process. Not available on
+ Windows.
+ *
+ * \param directory char const*const cache directory, created if missing. 0 disables the disk cache
+ * \param max_size size_t maximum number of bytes used by the cached responses
+ * \return bool false if the directory is not usable
+ *
+ */
+bool http_disk_cache_configure(char const *const directory, size_t max_size);
+
+/** \brief Writes the pending changes of the disk cache to its index file
+ * \details Call it before the process ends to keep the responses stored since the index was last written.
+ *
+ * \return bool false if the index could not be written
+ *
+ */
+bool http_disk_cache_flush(void);
+
+/** \brief Returns the statistics of the response cache
+ *
+ * \return struct HttpCacheStats
+ *
+ */
+struct HttpCacheStats http_cache_get_stats(void);
+
+/** \brief Removes every response from the memory and disk caches
+ *
+ * \return void
+ *
+ */
+void http_cache_clear(void);
+
+/** \brief Closes every idle connection of the keep-alive pool
+ *
+ * \return void
+ *
+ */
+void http_pool_cleanup(void);
+
+/** \brief Enables or disables the verification of server certificates for HTTPS
+ * \details Verification is enabled by default, unless the library is compiled with SKIP_VERIFICATION.
+ If enabled, the certificate chain and the host name are checked and a failing check results in EError_CertificateError.
+ *
+ * \param verify bool true to verify server certificates
+ * \return void
+ *
+ */
+void https_set_verification(bool verify);
+
+/** \brief Loads additional trusted certificates into the SSL context shared by all HTTPS requests
+ * \details The system truststore is loaded once on the first HTTPS request. Use this function to trust further certificates, e.g. a private CA.
+ *
+ * \param ca_file char const*const PEM file containing certificates, or 0
+ * \param ca_path char const*const directory containing hashed certificates, or 0
+ * \return bool true on success
+ *
+ */
+bool https_set_ca_locations(char const *const ca_file, char const *const ca_path);
+
+/** \brief Sets the file the TLS session cache is persisted to and loads the sessions stored in it
+ * \details New HTTPS connections resume a previous session with the same host, using session tickets or TLS 1.3 PSK,
+ which saves a round trip and the key exchange. Sessions are kept in memory; with a session file they survive a restart of the process.
+ The file contains secret key material and is created accessible only by the current user.
+ *
+ * \param path char const*const session file, or 0 to stop persisting sessions
+ * \return bool true on success, also if the file does not exist yet. false if it is unreadable or damaged, the
+ sessions before the damage are loaded and the file is still used by https_session_cache_save
+ *
+ */
+bool https_session_cache_set_file(char const *const path);
+
+/** \brief Writes the TLS session cache to the file set by https_session_cache_set_file
+ * \details Call this function before the process terminates or periodically.
+ *
+ * \return bool true on success
+ *
+ */
+bool https_session_cache_save(void);
+
+/** \brief Sets how long resolved host names are cached
+ * \details Every host name is resolved once and the addresses are reused by all requests until @p ttl expires.
+ Host names which do not exist are cached for @p negative_ttl. A ttl of 0 disables the respective caching.
+ *
+ * \param ttl time_t time to live of resolved addresses in seconds, default is 60
+ * \param negative_ttl time_t time to live of unknown host names in seconds, default is 10
+ * \return void
+ *
+ */
+void http_dns_cache_set_ttl(time_t ttl, time_t negative_ttl);
+
+struct addrinfo;
+
+typedef int HttpGetAddrInfo(char const *node, char const *service, struct addrinfo const *hints,
+		struct addrinfo **res); /**< @brief A resolver with the interface of getaddrinfo */
+typedef void HttpFreeAddrInfo(struct addrinfo *res); /**< @brief Releases the results of an HttpGetAddrInfo */
+
+/** \brief Replaces getaddrinfo as the resolver of host names
+ * \details @p resolve is called on the resolver threads and by synchronous requests without a dns timeout, with
+ the same arguments as getaddrinfo. Its results are cached like those of getaddrinfo, EAI_NONAME as an unknown host.
+ Resolutions already running finish with the previous resolver. Useful to resolve names from another source or to
+ test the resolution.
+ *
+ * \param resolve HttpGetAddrInfo* resolver, 0 to use getaddrinfo again
+ * \param release HttpFreeAddrInfo* releases the results of @p resolve, 0 if @p resolve is 0
+ * \return bool false if only one of the functions is 0
+ *
+ */
+bool http_dns_set_resolver(HttpGetAddrInfo *resolve, HttpFreeAddrInfo *release);
+
+/** \brief Removes every entry from the dns cache
+ *
+ * \return void
+ *
+ */
+void http_dns_cache_clear(void);
+
+/** \brief Enables recording the timing of every request in struct HttpData
+ * \details The timing is recorded by http_get, https_get, their variants and http_get_with_thread. Disabled, no time
+ is measured at all.
+ *
+ * \param enabled bool true to record the timing, default is false
+ * \return void
+ *
+ */
+void http_set_timing(bool enabled);
+
+/** \brief Sets the per phase and total time limits of every request
+ * \details A request exceeding any limit fails with EError_Timeout. This applies to the blocking functions, the threaded
+ API, batches and the event engine. The timeout moment passed to a request has a resolution of one second, the limits set
+ here are enforced to the millisecond.
+ *
+ * \param timeouts struct HttpTimeouts limits in milliseconds, all 0 by default
+ * \return void
+ *
+ */
+void http_set_timeouts(struct HttpTimeouts timeouts);
+
+/** \brief Returns the limits set by http_set_timeouts
+ *
+ * \return struct HttpTimeouts
+ *
+ */
+struct HttpTimeouts http_get_timeouts(void);
+
+/** \brief Enables the metrics registry
+ * \details Every finished call of a fetching API is counted once by status code and error, with its duration.
+ A response served by the cache counts as one request without bytes, a revalidated one with the cached status. A
+ segmented download counts as one request with the bytes of all its HEAD and range requests. Pipelined, batch and
+ engine requests are counted one by one. Counters are kept per thread shard, durations in a log-linear histogram with
+ at most 12.5 % error. Open connections are counted even while metrics are disabled.
+ *
+ * \param enabled bool true to record requests, default is false
+ * \return void
+ *
+ */
+void http_set_metrics(bool enabled);
+
+/** \brief Sets the request counters, bytes and durations of the metrics registry to 0
+ *
+ * \return void
+ *
+ */
+void http_metrics_reset(void);
+
+/** \brief Returns a quantile of the durations recorded by the metrics registry
+ *
+ * \param quantile double between 0 and 1, for example 0.99
+ * \return int64_t duration in microseconds, 0 if no request has been recorded
+ *
+ */
+int64_t http_metrics_latency_quantile(double quantile);
+
+/** \brief Renders the metrics registry, the keep-alive pool, the response cache and the thread pool in the Prometheus text format
+ *
+ * \return char* NUL terminated text to be released with free, 0 on allocation error
+ *
+ */
+char* http_metrics_render(void);
+
+/** \brief An event engine drives many HTTP and HTTPS requests concurrently from a single thread
+ * \details Connect, TLS handshake, send and receive of every request are multiplexed on non blocking sockets using epoll (poll on other systems).
+ Idle connections are taken from and returned to the keep-alive pool. An engine must only be used by one thread at a time.
+ */
+struct HttpEngine;
+
+typedef void HttpEngineCallback(struct HttpData data, void *user_data); /**< @brief Called by the engine when a request finished. The data needs to be released with http_data_free */
+
+/** \brief Creates an event engine
+ *
+ * \return struct HttpEngine* engine, 0 on error
+ *
+ */
+struct HttpEngine* http_engine_create(void);
+
+/** \brief Starts a request on the event engine. @p callback_func is called exactly once when the request finished, failed or timed out
+ * \details The request is processed while http_engine_run is called. If the request fails immediately, @p callback_func is called before this function returns.
+ *
+ * \param engine struct HttpEngine* engine driving the request
+ * \param command enum HttpCommand Determines whether an HTTP, HTTPS or HTTPS with user agent request is made
+ * \param host char const*const host to be connected
+ * \param file char const*const file to be requested
+ * \param user_agent char const*const string containing application name, only used for HttpCommand_GetHttpsUserAgent
+ * \param add_info char const*const Additional informations to be placed into the http request header. If no additional info shall be placed into header, set 0
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \param callback_func HttpEngineCallback* Callback function to be called when the request finished
+ * \param user_data void* passed to @p callback_func
+ * \return bool true if the request has been accepted
+ *
+ */
+bool http_engine_submit(struct HttpEngine *engine, enum HttpCommand command,
+		char const *const host, char const *const file, char const *const user_agent,
+		char const *const add_info, time_t timeout, HttpEngineCallback *callback_func,
+		void *user_data);
+
+/** \brief Waits for socket events and timers and advances the requests of the engine
+ * \details Call this function in a loop until it returns 0. Callbacks are called from within this function.
+ *
+ * \param engine struct HttpEngine* engine
+ * \param timeout_ms int maximum time to wait for an event in milliseconds, -1 to wait until an event or timer occurs
+ * \return size_t number of requests still in flight
+ *
+ */
+size_t http_engine_run(struct HttpEngine *engine, int timeout_ms);
+
+/** \brief Returns the number of requests in flight
+ *
+ * \param engine struct HttpEngine const*const engine
+ * \return size_t number of requests in flight
+ *
+ */
+size_t http_engine_pending(struct HttpEngine const *const engine);
+
+/** \brief Destroys an engine. Requests in flight are aborted without calling their callback
+ *
+ * \param engine struct HttpEngine* engine
+ * \return void
+ *
+ */
+void http_engine_destroy(struct HttpEngine *engine);
+
+/** \brief One request of a batch */
+struct HttpRequest {
+	enum HttpCommand command; /**< @brief Determines whether an HTTP, HTTPS or HTTPS with user agent request is made */
+	char const *host;
+	char const *file;
+	char const *user_agent; /**< @brief Only used for HttpCommand_GetHttpsUserAgent */
+	char const *add_info; /**< @brief Additional informations to be placed into the http request header, may be 0 */
+};
+
+struct HttpBatch; /**< @brief Requests running concurrently, see http_batch_start */
+
+#define HTTP_BATCH_NONE ((size_t) -1) /**< @brief Returned by http_batch_wait_any if no request finished */
+
+/** \brief Starts running @p requests concurrently and stores their results in @p results
+ * \details At most @p max_concurrency requests are in flight at the same time, and at most 6 of them to the same
+ host. Further requests to a host wait until one of its requests finished and then reuse its connection. When a request
+ finishes, the next request to the same host is preferred for the same reason. The requests are advanced
+ while http_batch_wait_any or http_batch_wait_all is called. @p requests and @p results must stay valid until
+ http_batch_free has been called.
+ *
+ * \param requests struct HttpRequest const* requests to be made
+ * \param results struct HttpData* receives the result of every request at the same index. Every result needs to be released with http_data_free
+ * \param count size_t number of requests
+ * \param max_concurrency size_t maximum number of requests in flight, 0 for the default of 16
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \return struct HttpBatch* batch, 0 on error
+ *
+ */
+struct HttpBatch* http_batch_start(struct HttpRequest const *requests, struct HttpData *results, size_t count,
+		size_t max_concurrency, time_t timeout);
+
+/** \brief Waits until a request of @p batch finished which has not been returned before
+ *
+ * \param batch struct HttpBatch* batch
+ * \param timeout_ms int maximum time to wait in milliseconds, -1 to wait without limit
+ * \return size_t index of the finished request, HTTP_BATCH_NONE on timeout or if all requests have been returned
+ *
+ */
+size_t http_batch_wait_any(struct HttpBatch *batch, int timeout_ms);
+
+/** \brief Waits until all requests of @p batch finished
+ *
+ * \param batch struct HttpBatch* batch
+ * \param timeout_ms int maximum time to wait in milliseconds, -1 to wait without limit
+ * \return size_t number of requests which have not finished yet
+ *
+ */
+size_t http_batch_wait_all(struct HttpBatch *batch, int timeout_ms);
+
+/** \brief Frees @p batch. Requests which have not finished are aborted, their result has the error EError_Aborted
+ *
+ * \param batch struct HttpBatch* batch
+ * \return void
+ *
+ */
+void http_batch_free(struct HttpBatch *batch);
+
+/** \brief Makes all @p requests concurrently and waits until they finished
+ * \details See http_batch_start.
+ *
+ * \param requests struct HttpRequest const* requests to be made
+ * \param results struct HttpData* receives the result of every request at the same index. Every result needs to be released with http_data_free
+ * \param count size_t number of requests
+ * \param max_concurrency size_t maximum number of requests in flight, 0 for the default of 16
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \return bool false if the batch could not be started
+ *
+ */
+bool http_get_many(struct HttpRequest const *requests, struct HttpData *results, size_t count,
+		size_t max_concurrency, time_t timeout);
+
+/** \brief Makes @p requests using HTTP/1.1 pipelining
+ * \details Requests to the same host and scheme are written back-to-back on one persistent connection, without waiting
+ for the previous response, and the responses are matched in order. This saves a round trip per request on high latency
+ links. If the connection breaks or the server closes it, the requests which have not been answered are sent again over
+ a new connection. The hosts are processed one after another.
+ *
+ * \param requests struct HttpRequest const* requests to be made
+ * \param results struct HttpData* receives the result of every request at the same index. Every result needs to be released with http_data_free
+ * \param count size_t number of requests
+ * \param depth size_t maximum number of unanswered requests on a connection, 0 for no limit
+ * \param timeout time_t the desired timeout moment, or 0 for no timeout
+ * \return bool false on invalid arguments or if out of memory
+ *
+ */
+bool http_get_pipelined(struct HttpRequest const *requests, struct HttpData *results, size_t count, size_t depth,
+		time_t timeout);
+
+#endif // SIMPLEHTTPGET_SOCKET_H
@@ -49,22 +49,23 @@ int main(void) {
 	size_t resp_len = 0;
 	char *http_response = NULL;
 
-	http_response = http_get(host, file, add_info, timeout).data;
+	struct HttpData http_data = http_get(host, file, add_info, timeout);
+	http_response = http_data.data;
 	assert(http_response);
 	resp_len = strlen(http_response);
 	printf("HTTP Response length: %zu\n", resp_len);
 	fflush(stdout);
-	free(http_response);
+	http_data_free(&http_data);
 
-	http_response = http_get("www.gogle.com", "/", 0, timeout).data;
+	http_data = http_get("www.gogle.com", "/", 0, timeout);
+	http_response = http_data.data;
 	assert(http_response);
 	if (*http_response)
 		resp_len = strlen(http_response);
 	else
 		resp_len = 0;
 	printf("HTTP Response length: %zu\n", resp_len);
-	if (http_response)
-		free(http_response);
+	http_data_free(&http_data);
 
 	struct HttpData data = https_get("www.gogle.com", "/", 0, timeout);
 	assert(data.data);
@@ -73,7 +74,7 @@ int main(void) {
 	else
 		resp_len = 0;
 	printf("HTTPS Response length: %zu\n", resp_len);
-	free(http_response);
+	http_data_free(&data);
 
 	puts("\n\nEnd of SimpleHTTPGet Test!\n\n");
 	return 0;